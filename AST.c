@@ -14,8 +14,8 @@
         (compiler)->had_error = true;                                                                        \
         fprintf(stderr, AST_ERROR_PREFIX_FORMART " '%.*s' is already declared at " FILE_ROW_COL_FORMAT "\n", \
                 (compiler)->file_path,                                                                       \
-                (token).row,                                                                                 \
-                (token).col,                                                                                 \
+                (size_t)(token).row,                                                                                 \
+                (size_t)(token).col,                                                                                 \
                 (int)(token).length,                                                                         \
                 (token).start,                                                                               \
                 (compiler)->file_path,                                                                       \
@@ -29,8 +29,8 @@
         (compiler)->had_error = true;                                        \
         fprintf(stderr, AST_ERROR_PREFIX_FORMART " '%.*s' is not defined\n", \
                 (compiler)->file_path,                                       \
-                (token).row,                                                 \
-                (token).col,                                                 \
+                (size_t)(token).row,                                                 \
+                (size_t)(token).col,                                                 \
                 (int)(token).length,                                         \
                 (token).start);                                              \
     } while (0)
@@ -41,32 +41,73 @@
         compiler->had_error = true;                                                                           \
         fprintf(stderr, AST_ERROR_PREFIX_FORMART " cannot read variable '%.*s' in its own initialization.\n", \
                 (compiler)->file_path,                                                                        \
-                (token).row,                                                                                  \
-                (token).col,                                                                                  \
+                (size_t)(token).row,                                                                                  \
+                (size_t)(token).col,                                                                                  \
                 (int)(token).length,                                                                          \
                 (token).start);                                                                               \
     } while (0)
 
-AST *init_ast(AST_Type type)
+void ast_redeclaration_error(Compiler *compiler, Token token, int slot)
 {
-    AST *ast = calloc(1, sizeof(AST));
-    if (type == AST_COMPOUND ||
-        type == AST_SEQUENCEEXPR ||
-        type == AST_FOR_LOOP ||
-        type == AST_BLOCK ||
-        type == AST_FUNCTION_DECL ||
-        type == AST_FUNCTION_CALL)
+    Declaration *previous = compiler_global_at(compiler, slot);
+    AST_REDEC_ERROR(compiler, token, previous->row, previous->col);
+}
+int ast_declare_global(Compiler *compiler, ObjString *name, Token token, Value value)
+{
+    int slot = compiler_declare_global(compiler, name, token.row, token.col, value);
+    if (slot == -1)
     {
-        init_array(&ast->childs);
+        compiler->had_error = true;
+        fprintf(stderr, AST_ERROR_PREFIX_FORMART " Too many global variables.\n", compiler->file_path, token.row, token.col);
     }
+    return slot;
+}
+AST *init_ast(Arena *arena, AST_Type type)
+{
+    AST *ast = arena_allocate(arena, sizeof(AST));
     ast->type = type;
     return ast;
 }
-size_t ast_push(AST *ast, AST *child)
+void ast_set_token(AST *ast, Token token)
+{
+    ast->token.start = token.start;
+    ast->token.length = (uint32_t)token.length;
+    ast->token.row = (uint32_t)token.row;
+    ast->token.col = (uint32_t)token.col;
+    ast->token.type = token.type;
+}
+Token ast_token(AST *ast)
 {
-    size_t i = array_size(&ast->childs);
-    array_push(&ast->childs, child);
-    return i;
+    return init_token(ast->token.start, ast->token.type, ast->token.length, ast->token.row, ast->token.col);
+}
+bool ast_has_childs(AST *ast)
+{
+    switch (ast->type)
+    {
+    case AST_COMPOUND:
+    case AST_SEQUENCEEXPR:
+    case AST_FOR_LOOP:
+    case AST_BLOCK:
+    case AST_FUNCTION_DECL:
+        return true;
+    default:
+        return false;
+    }
+}
+/* children live in the arena too, a full list moves to one twice its size */
+size_t ast_push(Arena *arena, AST *ast, AST *child)
+{
+    if (ast->childs.count == ast->childs.capacity)
+    {
+        uint32_t capacity = ast->childs.capacity == 0 ? 4 : ast->childs.capacity * 2;
+        AST **items = arena_allocate(arena, capacity * sizeof(AST *));
+        if (ast->childs.count != 0)
+            memcpy(items, ast->childs.items, ast->childs.count * sizeof(AST *));
+        ast->childs.items = items;
+        ast->childs.capacity = capacity;
+    }
+    ast->childs.items[ast->childs.count] = child;
+    return ast->childs.count++;
 }
 char *ast_to_str(AST *ast)
 {
@@ -157,7 +198,8 @@ char *ast_to_json(AST *ast)
         free(number);
     }
 
-    if (ast->left != NULL)
+    bool operands = !ast_has_childs(ast) && ast->type != AST_NUMBER;
+    if (operands && ast->left != NULL)
     {
         char *left_key = ",\"left\": ";
         c = realloc(c, strlen(c) + strlen(left_key) + 1 * sizeof(char));
@@ -171,7 +213,7 @@ char *ast_to_json(AST *ast)
             free(temp);
         }
     }
-    if (ast->right != NULL)
+    if (operands && ast->right != NULL)
     {
         char *right_key = ",\"right\": ";
         c = realloc(c, strlen(c) + strlen(right_key) + 1 * sizeof(char));
@@ -198,16 +240,23 @@ char *ast_to_json(AST *ast)
             free(temp);
         }
     }
-    if (array_size(&ast->childs) != 0)
+    if (ast_has_childs(ast) && array_size(&ast->childs) != 0)
     {
         char *children = ",\"children\": [";
         c = realloc(c, strlen(c) + strlen(children) + 1 * sizeof(char));
         strcat(c, children);
+        bool first = true;
         for (size_t i = 0; i < array_size(&ast->childs); i++)
         {
             AST *child = array_at(&ast->childs, i);
             if (child)
             {
+                if (!first)
+                {
+                    c = realloc(c, strlen(c) + 2 * sizeof(char));
+                    strcat(c, ",");
+                }
+                first = false;
                 char *temp = ast_to_json(child);
                 if (temp)
                 {
@@ -215,11 +264,6 @@ char *ast_to_json(AST *ast)
                     strcat(c, temp);
                     free(temp);
                 }
-                if (i != array_size(&ast->childs) - 1)
-                {
-                    c = realloc(c, strlen(c) + 2 * sizeof(char));
-                    strcat(c, ",");
-                }
             }
         }
         c = realloc(c, strlen(c) + 2 * sizeof(char));
@@ -235,67 +279,177 @@ void ast_print(AST *root)
     fprintf(stdout, "%s\n", temp);
     free(temp);
 }
-void ast_free(AST *ast)
+size_t ast_emit_jump(Compiler *compiler, OpCode instruction)
+{
+    chunk_push(compiler->function->chunk, instruction);
+    chunk_push(compiler->function->chunk, 0xff);
+    chunk_push(compiler->function->chunk, 0xff);
+    return array_size(compiler->function->chunk) - 2;
+}
+bool ast_is_literal(AST *ast)
+{
+    switch (ast->type)
+    {
+    case AST_NUMBER:
+    case AST_STRING:
+    case AST_TRUE:
+    case AST_FALSE:
+    case AST_NULL:
+        return true;
+    default:
+        return false;
+    }
+}
+/* truthiness of a literal, follows is_falsey in the VM */
+bool ast_literal_truthy(AST *ast)
+{
+    switch (ast->type)
+    {
+    case AST_NUMBER:
+        return ast->number != 0;
+    case AST_STRING:
+        return strlen(ast->name) != 0;
+    case AST_TRUE:
+        return true;
+    default:
+        return false;
+    }
+}
+/*
+ * compiles code that can never run into a scratch chunk and throws it away,
+ * it is still checked and still declares its globals like any other code.
+ */
+void ast_dead_to_byte(AST *ast, Compiler *compiler, void (*to_byte)(AST *, Compiler *))
 {
     if (!ast)
         return;
-    for (size_t i = 0; i < array_size(&ast->childs); i++)
+    ObjFunction *function = compiler->function;
+    Chunk *chunk = function->chunk;
+    Values *values = function->values;
+    size_t local_count = array_size(&compiler->locals);
+    size_t break_count = array_size(&compiler->breaks);
+    size_t continue_count = array_size(&compiler->continues);
+    size_t far_jump_count = array_size(&compiler->far_jumps);
+    ConstantIndex constants = compiler->constants;
+
+    function->chunk = init_chunk();
+    function->values = init_values();
+    init_array(&compiler->constants);
+    to_byte(ast, compiler);
+    chunk_free(function->chunk);
+    values_free(function->values);
+    array_free(&compiler->constants);
+
+    function->chunk = chunk;
+    function->values = values;
+    compiler->constants = constants;
+    compiler->locals.count = local_count;
+    compiler->breaks.count = break_count;
+    compiler->continues.count = continue_count;
+    compiler->far_jumps.count = far_jump_count;
+}
+/*
+ * emits the jump taken when `condition` is false. a relational condition is
+ * fused into one compare-and-branch that consumes both operands, anything
+ * else is evaluated and tested by OP_JMP_IF_FALSE.
+ * returns whether the condition was left on the stack for the caller to pop.
+ */
+bool ast_emit_condition_jump(AST *condition, Compiler *compiler, size_t *offset)
+{
+    OpCode instruction = OP_JMP_IF_FALSE;
+    if (condition->type == AST_BINARY)
+        switch (condition->token.type)
+        {
+        case TOKEN_EQUALS:
+            instruction = OP_JMP_IF_NOT_EQUAL;
+            break;
+        case TOKEN_NOT_EQUALS:
+            instruction = OP_JMP_IF_NOT_NOT_EQUAL;
+            break;
+        case TOKEN_LT:
+            instruction = OP_JMP_IF_NOT_LT;
+            break;
+        case TOKEN_LTE:
+            instruction = OP_JMP_IF_NOT_LTE;
+            break;
+        case TOKEN_GT:
+            instruction = OP_JMP_IF_NOT_GT;
+            break;
+        case TOKEN_GTE:
+            instruction = OP_JMP_IF_NOT_GTE;
+            break;
+        default:
+            break;
+        }
+    if (instruction == OP_JMP_IF_FALSE)
     {
-        AST *child = array_at(&ast->childs, i);
-        ast_free(child);
+        ast_to_byte(condition, compiler);
+        *offset = ast_emit_jump(compiler, instruction);
+        return true;
     }
-    if (array_size(&ast->childs))
-        array_free(&ast->childs);
-    if (ast->value)
-        ast_free(ast->value);
-    if (ast->left)
-        ast_free(ast->left);
-    if (ast->right)
-        ast_free(ast->right);
-
-    if (ast->name)
-        free(ast->name);
-    free(ast);
+    ast_to_byte(condition->left, compiler);
+    ast_to_byte(condition->right, compiler);
+    *offset = ast_emit_jump(compiler, instruction);
+    return false;
 }
-size_t ast_emit_jump(Compiler *compiler, OpCode instruction)
+void ast_emit_global(Compiler *compiler, OpCode instruction, int slot)
 {
     chunk_push(compiler->function->chunk, instruction);
-    chunk_push(compiler->function->chunk, 0xff);
-    chunk_push(compiler->function->chunk, 0xff);
-    return array_size(compiler->function->chunk) - 2;
+    chunk_push(compiler->function->chunk, (slot >> 8) & 0xff);
+    chunk_push(compiler->function->chunk, slot & 0xff);
 }
-void ast_emit_loop(Compiler *compiler, size_t loop_start)
+/* the short form takes a one byte pool index, past 256 constants the long one takes three */
+void ast_emit_constant(Compiler *compiler, Value value)
 {
-    chunk_push(compiler->function->chunk, OP_LOOP);
-    size_t offset = array_size(compiler->function->chunk) - loop_start + 2;
-    if (offset > UINT16_MAX)
+    uint32_t index = compiler_add_constant(compiler, value);
+    if (index < UINT8_COUNT)
     {
-        compiler->had_error = true;
-        fprintf(stderr, "Loop body too large.\n");
+        chunk_push(compiler->function->chunk, OP_CONSTANT);
+        chunk_push(compiler->function->chunk, index);
+        return;
     }
-    chunk_push(compiler->function->chunk, (offset >> 8) & 0xff);
-    chunk_push(compiler->function->chunk, offset & 0xff);
+    chunk_push(compiler->function->chunk, OP_CONSTANT_LONG);
+    chunk_push(compiler->function->chunk, (index >> 16) & 0xff);
+    chunk_push(compiler->function->chunk, (index >> 8) & 0xff);
+    chunk_push(compiler->function->chunk, index & 0xff);
 }
-void ast_patch_jump(Compiler *compiler, size_t offset)
+/* instruction is OP_GET_LOCAL or OP_SET_LOCAL, slots past 255 take the two byte form */
+void ast_emit_local(Compiler *compiler, OpCode instruction, int slot)
 {
-    size_t jmp = array_size(compiler->function->chunk);
-    if (jmp > UINT16_MAX)
+    if (slot < UINT8_COUNT)
     {
-        compiler->had_error = true;
-        fprintf(stderr, "Too much code to jump over.\n");
+        chunk_push(compiler->function->chunk, instruction);
+        chunk_push(compiler->function->chunk, (byte)slot);
+        return;
     }
-    array_at(compiler->function->chunk, offset) = (jmp >> 8) & 0xff;
-    array_at(compiler->function->chunk, offset + 1) = jmp & 0xff;
+    chunk_push(compiler->function->chunk, instruction == OP_GET_LOCAL ? OP_GET_LOCAL_LONG : OP_SET_LOCAL_LONG);
+    chunk_push(compiler->function->chunk, (slot >> 8) & 0xff);
+    chunk_push(compiler->function->chunk, slot & 0xff);
+}
+void ast_emit_loop(Compiler *compiler, size_t loop_start)
+{
+    Chunk *chunk = compiler->function->chunk;
+    size_t offset = array_size(chunk);
+    OpCode instruction = offset + 3 - loop_start > UINT16_MAX ? OP_LOOP_LONG : OP_LOOP;
+    chunk_push(chunk, instruction);
+    for (size_t i = 1; i < chunk_instruction_length(instruction); i++)
+        chunk_push(chunk, 0);
+    chunk_patch_jump(chunk, offset, loop_start);
 }
 void ast_patch_jump_with(Compiler *compiler, size_t offset, size_t with)
 {
+    // offset is the jump's operand, the opcode sits right before it
     if (with > UINT16_MAX)
     {
-        compiler->had_error = true;
-        fprintf(stderr, "Too much code to jump over.\n");
+        FarJump jump = {offset - 1, with};
+        array_push(&compiler->far_jumps, jump);
+        return;
     }
-    array_at(compiler->function->chunk, offset) = (with >> 8) & 0xff;
-    array_at(compiler->function->chunk, offset + 1) = with & 0xff;
+    chunk_patch_jump(compiler->function->chunk, offset - 1, with);
+}
+void ast_patch_jump(Compiler *compiler, size_t offset)
+{
+    ast_patch_jump_with(compiler, offset, array_size(compiler->function->chunk));
 }
 void ast_begin_scope(Compiler *compiler)
 {
@@ -304,29 +458,50 @@ void ast_begin_scope(Compiler *compiler)
 void ast_end_scope(Compiler *compiler)
 {
     compiler->scope_depth--;
-    while (compiler->local_count > 0 && compiler->locals[compiler->local_count - 1].depth > compiler->scope_depth)
+    while (array_size(&compiler->locals) > 0 && array_at(&compiler->locals, array_size(&compiler->locals) - 1).depth > compiler->scope_depth)
     {
         chunk_push(compiler->function->chunk, OP_POP);
-        compiler->local_count--;
+        compiler->locals.count--;
     }
 }
-void ast_resolve_breaks(Compiler *compiler)
+/* patches the breaks of the loop that started with `base` pending breaks */
+void ast_resolve_breaks(Compiler *compiler, size_t base)
 {
-    for (byte i = 0; i < compiler->break_stack_count; i++)
-    {
-        byte offset = compiler->break_stack[i];
-        ast_patch_jump(compiler, offset);
-    }
-    compiler->break_stack_count = 0;
+    for (size_t i = base; i < array_size(&compiler->breaks); i++)
+        ast_patch_jump(compiler, array_at(&compiler->breaks, i));
+    compiler->breaks.count = base;
+}
+void ast_resolve_continues(Compiler *compiler, size_t base, size_t loop_start)
+{
+    for (size_t i = base; i < array_size(&compiler->continues); i++)
+        ast_patch_jump_with(compiler, array_at(&compiler->continues, i), loop_start);
+    compiler->continues.count = base;
 }
-void ast_resolve_continues(Compiler *compiler, size_t loop_start)
+bool ast_is_expr(AST *ast)
 {
-    for (byte i = 0; i < compiler->continue_stack_count; i++)
+    switch (ast->type)
     {
-        byte offset = compiler->continue_stack[i];
-        ast_patch_jump_with(compiler, offset, loop_start);
+    case AST_COMPOUND:
+    case AST_STMT:
+    case AST_IF:
+    case AST_VAR:
+    case AST_WHILE:
+    case AST_FOR_LOOP:
+    case AST_BLOCK:
+    case AST_FUNCTION_DECL:
+        return false;
+    default:
+        return true;
     }
-    compiler->continue_stack_count = 0;
+}
+/* compiles a statement, discarding the value an expression statement leaves behind */
+void ast_stmt_to_byte(AST *ast, Compiler *compiler)
+{
+    if (!ast)
+        return;
+    ast_to_byte(ast, compiler);
+    if (ast_is_expr(ast))
+        chunk_push(compiler->function->chunk, OP_POP);
 }
 void ast_binary_to_byte(AST *binary, Compiler *compiler)
 {
@@ -363,21 +538,18 @@ void ast_binary_to_byte(AST *binary, Compiler *compiler)
         int arg = -1;
         if (compiler->scope_depth > 0)
         {
-            arg = compiler_resolve_local(compiler, binary->left->token);
+            arg = compiler_resolve_local(compiler, ast_token(binary->left));
         }
         if (arg != -1)
         {
-            chunk_push(compiler->function->chunk, OP_SET_LOCAL);
-            chunk_push(compiler->function->chunk, (byte)arg);
+            ast_emit_local(compiler, OP_SET_LOCAL, arg);
         }
         else if (arg == -1)
         {
-            ObjString *interned = table_find_string(compiler->globals, binary->left->name);
-            if (interned == NULL)
+            int slot = compiler_resolve_global(compiler, binary->left->name);
+            if (slot == -1)
                 AST_REF_ERROR(compiler, binary->left->token);
-            Value str = OBJ_VAL(interned, binary->left->token.row, binary->left->token.col);
-            chunk_push(compiler->function->chunk, OP_SET_GLOBAL);
-            chunk_push(compiler->function->chunk, value_push(compiler->function->values, str));
+            ast_emit_global(compiler, OP_SET_GLOBAL, slot);
         }
         break;
     }
@@ -394,7 +566,7 @@ void ast_binary_to_byte(AST *binary, Compiler *compiler)
         chunk_push(compiler->function->chunk, OP_GT);
         break;
     case TOKEN_GTE:
-        chunk_push(compiler->function->chunk, OP_LTE);
+        chunk_push(compiler->function->chunk, OP_GTE);
         break;
     case TOKEN_AND:
     {
@@ -450,8 +622,7 @@ void ast_unary_to_byte(AST *ast, Compiler *compiler)
     case TOKEN_DECREMENT:
     case TOKEN_INCREMENT:
     {
-        chunk_push(compiler->function->chunk, OP_CONSTANT);
-        chunk_push(compiler->function->chunk, value_push(compiler->function->values, NUMBER_VAL(1, ast->token.row, ast->token.col)));
+        ast_emit_constant(compiler, NUMBER_VAL(1));
 
         OpCode code = ast->token.type == TOKEN_INCREMENT ? OP_ADD : OP_SUBTRACT;
         chunk_push(compiler->function->chunk, code);
@@ -459,19 +630,18 @@ void ast_unary_to_byte(AST *ast, Compiler *compiler)
         int arg = -1;
         if (compiler->scope_depth > 0)
         {
-            arg = compiler_resolve_local(compiler, ast->value->token);
+            arg = compiler_resolve_local(compiler, ast_token(ast->value));
             if (arg != -1)
             {
-                chunk_push(compiler->function->chunk, OP_SET_LOCAL);
-                chunk_push(compiler->function->chunk, (byte)arg);
+                ast_emit_local(compiler, OP_SET_LOCAL, arg);
             }
         }
         if (arg == -1)
         {
-            ObjString *interned = table_find_string(compiler->globals, ast->value->name);
-            Value str = OBJ_VAL(interned, ast->value->token.row, ast->value->token.col);
-            chunk_push(compiler->function->chunk, OP_SET_GLOBAL);
-            chunk_push(compiler->function->chunk, value_push(compiler->function->values, str));
+            int slot = compiler_resolve_global(compiler, ast->value->name);
+            if (slot == -1)
+                AST_REF_ERROR(compiler, ast->value->token);
+            ast_emit_global(compiler, OP_SET_GLOBAL, slot);
         }
         break;
     }
@@ -480,10 +650,8 @@ void ast_unary_to_byte(AST *ast, Compiler *compiler)
         NOTREACHABLE;
     }
 }
-void ast_to_byte(AST *ast, Compiler *compiler)
+void ast_node_to_byte(AST *ast, Compiler *compiler)
 {
-    if (!ast)
-        return;
     switch (ast->type)
     {
     case AST_BLOCK:
@@ -494,7 +662,7 @@ void ast_to_byte(AST *ast, Compiler *compiler)
         for (size_t i = 0; i < array_size(&ast->childs); i++)
         {
             AST *child = array_at(&ast->childs, i);
-            ast_to_byte(child, compiler);
+            ast_stmt_to_byte(child, compiler);
         }
         if (ast->type == AST_BLOCK)
         {
@@ -504,18 +672,16 @@ void ast_to_byte(AST *ast, Compiler *compiler)
     }
     case AST_NUMBER:
     {
-        chunk_push(compiler->function->chunk, OP_CONSTANT);
-        chunk_push(compiler->function->chunk, value_push(compiler->function->values, NUMBER_VAL(ast->number, ast->token.row, ast->token.col)));
+        ast_emit_constant(compiler, NUMBER_VAL(ast->number));
         break;
     }
     case AST_STRING:
     {
-        chunk_push(compiler->function->chunk, OP_CONSTANT);
         ObjString *interned = table_find_string(compiler->strings, ast->name);
-        ObjString *obj = interned == NULL ? cstr_to_objstr(ast->name) : interned;
-        Value str = OBJ_VAL(obj, ast->token.row, ast->token.col);
-        chunk_push(compiler->function->chunk, value_push(compiler->function->values, str));
-        table_set(compiler->strings, AS_STRING(str), NULL_VAL(str.row, str.col));
+        ObjString *obj = interned == NULL ? cstr_to_objstr(compiler->heap, ast->name) : interned;
+        Value str = OBJ_VAL(obj);
+        ast_emit_constant(compiler, str);
+        table_set(compiler->strings, AS_STRING(str), NULL_VAL);
         break;
     }
     case AST_BINARY:
@@ -540,20 +706,17 @@ void ast_to_byte(AST *ast, Compiler *compiler)
     }
     case AST_TRUE:
     {
-        chunk_push(compiler->function->chunk, OP_CONSTANT);
-        chunk_push(compiler->function->chunk, value_push(compiler->function->values, BOOL_VAL(true, ast->token.row, ast->token.col)));
+        ast_emit_constant(compiler, BOOL_VAL(true));
         break;
     }
     case AST_FALSE:
     {
-        chunk_push(compiler->function->chunk, OP_CONSTANT);
-        chunk_push(compiler->function->chunk, value_push(compiler->function->values, BOOL_VAL(false, ast->token.row, ast->token.col)));
+        ast_emit_constant(compiler, BOOL_VAL(false));
         break;
     }
     case AST_NULL:
     {
-        chunk_push(compiler->function->chunk, OP_CONSTANT);
-        chunk_push(compiler->function->chunk, value_push(compiler->function->values, NULL_VAL(ast->token.row, ast->token.col)));
+        ast_emit_constant(compiler, NULL_VAL);
         break;
     }
     case AST_STMT:
@@ -569,13 +732,13 @@ void ast_to_byte(AST *ast, Compiler *compiler)
         case TOKEN_BREAK:
         {
             size_t offset = ast_emit_jump(compiler, OP_JMP);
-            compiler->break_stack[compiler->break_stack_count++] = (byte)offset;
+            array_push(&compiler->breaks, offset);
             break;
         }
         case TOKEN_CONTINUE:
         {
             size_t offset = ast_emit_jump(compiler, OP_JMP);
-            compiler->continue_stack[compiler->continue_stack_count++] = (byte)offset;
+            array_push(&compiler->continues, offset);
             break;
         }
         case TOKEN_RETURN:
@@ -585,10 +748,13 @@ void ast_to_byte(AST *ast, Compiler *compiler)
                 compiler->had_error = true;
                 fprintf(stderr, AST_ERROR_PREFIX_FORMART " can't have return from top-level code.\n",
                         compiler->file_path,
-                        ast->token.row,
-                        ast->token.col);
+                        (size_t)ast->token.row,
+                        (size_t)ast->token.col);
             }
             ast_to_byte(ast->value, compiler);
+            // return f(...) is a call in tail position, it can reuse this frame
+            if (ast->value->type == AST_FUNCTION_CALL && compiler->type == TYPE_FUNCTION && !compiler->had_error)
+                array_at(compiler->function->chunk, array_size(compiler->function->chunk) - 2) = OP_TAIL_CALL;
             chunk_push(compiler->function->chunk, OP_RETURN);
             break;
         }
@@ -601,26 +767,35 @@ void ast_to_byte(AST *ast, Compiler *compiler)
     {
         if (compiler->scope_depth > 0)
         {
-            for (int i = compiler->local_count - 1; i >= 0; i--)
+            for (int i = (int)array_size(&compiler->locals) - 1; i >= 0; i--)
             {
-                Local *local = &compiler->locals[i];
+                Local *local = &array_at(&compiler->locals, i);
                 if (local->depth != -1 && local->depth < compiler->scope_depth)
                     break;
-                if (token_equal(ast->token, local->name))
+                if (token_equal(ast_token(ast), local->name))
                 {
                     AST_REDEC_ERROR(compiler, ast->token, local->name.row, local->name.col);
                     return;
                 }
             }
-            Local *local = &compiler->locals[compiler->local_count++];
-            local->name = ast->token;
-            local->depth = -1;
+            if (array_size(&compiler->locals) >= UINT16_COUNT)
+            {
+                compiler->had_error = true;
+                fprintf(stderr, AST_ERROR_PREFIX_FORMART " Too many local variables in function.\n",
+                        compiler->file_path,
+                        (size_t)ast->token.row,
+                        (size_t)ast->token.col);
+                return;
+            }
+            Local local = {ast_token(ast), -1};
+            array_push(&compiler->locals, local);
+            size_t slot = array_size(&compiler->locals) - 1;
             if (ast->value)
                 ast_to_byte(ast->value, compiler);
-            compiler->locals[compiler->local_count - 1].depth = compiler->scope_depth;
+            array_at(&compiler->locals, slot).depth = compiler->scope_depth;
             if (ast->value)
             {
-                int arg = compiler_resolve_local(compiler, ast->token);
+                int arg = compiler_resolve_local(compiler, ast_token(ast));
                 if (arg == -1)
                 {
                     compiler->had_error = true;
@@ -628,30 +803,20 @@ void ast_to_byte(AST *ast, Compiler *compiler)
                     // if this conddtion is true something is over cooked
                     fprintf(stderr, BOLDRED "NOT REACHABLE" RESET ": %s:%d in %s\n", __FILE__, __LINE__, __func__);
                 }
-                chunk_push(compiler->function->chunk, OP_SET_LOCAL);
-                chunk_push(compiler->function->chunk, (byte)arg);
-
-                ObjString *interned = table_find_string(compiler->variables, ast->name);
-                ObjString *obj = interned ? interned : cstr_to_objstr(ast->name);
-                Value str = OBJ_VAL(obj, ast->token.row, ast->token.col);
-                table_set(compiler->variables, obj, str);
+                ast_emit_local(compiler, OP_SET_LOCAL, arg);
             }
             return;
         }
-        ObjString *interned = table_find_string(compiler->globals, ast->name);
-        if (interned)
-        {
-            Value previous;
-            table_get(compiler->globals, interned, &previous);
-            AST_REDEC_ERROR(compiler, ast->token, previous.row, previous.col);
-        }
-        ObjString *obj = interned ? interned : cstr_to_objstr(ast->name);
-        Value str = OBJ_VAL(obj, ast->token.row, ast->token.col);
-        table_set(compiler->globals, obj, UNDEF_VAL(str.row, str.row));
+        int slot = compiler_resolve_global(compiler, ast->name);
+        if (slot != -1)
+            ast_redeclaration_error(compiler, ast_token(ast), slot);
+        else
+            slot = ast_declare_global(compiler, cstr_to_objstr(compiler->heap, ast->name), ast_token(ast), UNDEF_VAL);
+        if (slot == -1)
+            return;
         ast_to_byte(ast->value, compiler);
-        chunk_push(compiler->function->chunk, OP_DEFINE_GLOBAL);
-        chunk_push(compiler->function->chunk, value_push(compiler->function->values, str));
-        table_set(compiler->globals, obj, NULL_VAL(str.row, str.row));
+        ast_emit_global(compiler, OP_DEFINE_GLOBAL, slot);
+        compiler_global_at(compiler, slot)->value = NULL_VAL;
         break;
     }
     case AST_ID:
@@ -659,82 +824,88 @@ void ast_to_byte(AST *ast, Compiler *compiler)
         int arg = -1;
         if (compiler->scope_depth > 0)
         {
-            arg = compiler_resolve_local(compiler, ast->token);
+            arg = compiler_resolve_local(compiler, ast_token(ast));
             if (arg == -2)
             {
                 AST_VAR_SELF_INIT(compiler, ast->token);
             }
             else if (arg != -1)
             {
-                chunk_push(compiler->function->chunk, OP_GET_LOCAL);
-                chunk_push(compiler->function->chunk, (byte)arg);
-                ObjString *interend = table_find_string(compiler->variables, ast->name);
-                ObjString *obj = interend ? interend : cstr_to_objstr(ast->name);
-                Value str = OBJ_VAL(obj, ast->token.row, ast->token.col);
-                chunk_push(compiler->function->chunk, value_push(compiler->function->values, str));
+                ast_emit_local(compiler, OP_GET_LOCAL, arg);
             }
         }
         if (arg == -1)
         {
-            ObjString *interned = table_find_string(compiler->globals, ast->name);
-            if (interned == NULL)
+            int slot = compiler_resolve_global(compiler, ast->name);
+            if (slot == -1)
                 AST_REF_ERROR(compiler, ast->token);
-            if (interned)
-            {
-                Value init;
-                table_get(compiler->globals, interned, &init);
-                if (IS_UNDEF(init))
-                    AST_VAR_SELF_INIT(compiler, ast->token);
-            }
-            Value str = OBJ_VAL(interned, ast->token.row, ast->token.col);
-            chunk_push(compiler->function->chunk, OP_GET_GLOBAL);
-            chunk_push(compiler->function->chunk, value_push(compiler->function->values, str));
+            else if (IS_UNDEF(compiler_global_at(compiler, slot)->value))
+                AST_VAR_SELF_INIT(compiler, ast->token);
+            ast_emit_global(compiler, OP_GET_GLOBAL, slot);
         }
         break;
     }
     case AST_TERNARY:
     case AST_IF:
     {
-        ast_to_byte(ast->value, compiler);
-        size_t then_offset = ast_emit_jump(compiler, OP_JMP_IF_FALSE);
-        chunk_push(compiler->function->chunk, OP_POP);
-        ast_to_byte(ast->left, compiler);
-        ast_patch_jump(compiler, then_offset);
-
-        if (ast->right)
+        void (*branch_to_byte)(AST *, Compiler *) = ast->type == AST_IF ? ast_stmt_to_byte : ast_to_byte;
+        if (ast_is_literal(ast->value))
         {
-            size_t else_offset = ast_emit_jump(compiler, OP_JMP);
-            ast_patch_jump(compiler, then_offset);
-            chunk_push(compiler->function->chunk, OP_POP);
-            ast_to_byte(ast->right, compiler);
-            ast_patch_jump(compiler, else_offset);
+            bool truthy = ast_literal_truthy(ast->value);
+            branch_to_byte(truthy ? ast->left : ast->right, compiler);
+            ast_dead_to_byte(truthy ? ast->right : ast->left, compiler, branch_to_byte);
+            break;
         }
+        size_t then_offset = 0;
+        bool pop = ast_emit_condition_jump(ast->value, compiler, &then_offset);
+        if (pop)
+            chunk_push(compiler->function->chunk, OP_POP);
+        branch_to_byte(ast->left, compiler);
+
+        size_t else_offset = ast_emit_jump(compiler, OP_JMP);
+        ast_patch_jump(compiler, then_offset);
+        if (pop)
+            chunk_push(compiler->function->chunk, OP_POP);
+        branch_to_byte(ast->right, compiler);
+        ast_patch_jump(compiler, else_offset);
         break;
     }
     case AST_WHILE:
     {
+        if (ast_is_literal(ast->value) && !ast_literal_truthy(ast->value))
+        {
+            ast_dead_to_byte(ast->left, compiler, ast_stmt_to_byte);
+            break;
+        }
         size_t loop_start = array_size(compiler->function->chunk);
-        ast_to_byte(ast->value, compiler);
-
-        size_t exit_jmp = ast_emit_jump(compiler, OP_JMP_IF_FALSE);
-        chunk_push(compiler->function->chunk, OP_POP);
-        ast_to_byte(ast->left, compiler);
+        size_t break_base = array_size(&compiler->breaks);
+        size_t continue_base = array_size(&compiler->continues);
+        if (ast_is_literal(ast->value))
+        {
+            ast_stmt_to_byte(ast->left, compiler);
+            ast_emit_loop(compiler, loop_start);
+            ast_resolve_breaks(compiler, break_base);
+            ast_resolve_continues(compiler, continue_base, loop_start);
+            break;
+        }
+        size_t exit_jmp = 0;
+        bool pop = ast_emit_condition_jump(ast->value, compiler, &exit_jmp);
+        if (pop)
+            chunk_push(compiler->function->chunk, OP_POP);
+        ast_stmt_to_byte(ast->left, compiler);
         ast_emit_loop(compiler, loop_start);
         ast_patch_jump(compiler, exit_jmp);
-        if (compiler->break_stack_count == 0)
-        {
+        if (pop)
             chunk_push(compiler->function->chunk, OP_POP);
-        }
-        ast_resolve_breaks(compiler);
-        ast_resolve_continues(compiler, loop_start);
+        ast_resolve_breaks(compiler, break_base);
+        ast_resolve_continues(compiler, continue_base, loop_start);
         break;
     }
     case AST_POSTFIX:
     {
         ast_to_byte(ast->value, compiler);
         chunk_push(compiler->function->chunk, OP_DUP);
-        chunk_push(compiler->function->chunk, OP_CONSTANT);
-        chunk_push(compiler->function->chunk, value_push(compiler->function->values, NUMBER_VAL(1, ast->token.row, ast->token.col)));
+        ast_emit_constant(compiler, NUMBER_VAL(1));
 
         OpCode code = ast->token.type == TOKEN_INCREMENT ? OP_ADD : OP_SUBTRACT;
         chunk_push(compiler->function->chunk, code);
@@ -742,21 +913,18 @@ void ast_to_byte(AST *ast, Compiler *compiler)
         int arg = -1;
         if (compiler->scope_depth > 0)
         {
-            arg = compiler_resolve_local(compiler, ast->value->token);
+            arg = compiler_resolve_local(compiler, ast_token(ast->value));
             if (arg != -1)
             {
-                chunk_push(compiler->function->chunk, OP_SET_LOCAL);
-                chunk_push(compiler->function->chunk, (byte)arg);
+                ast_emit_local(compiler, OP_SET_LOCAL, arg);
             }
         }
         if (arg == -1)
         {
-            ObjString *interned = table_find_string(compiler->globals, ast->value->name);
-            if (interned == NULL)
+            int slot = compiler_resolve_global(compiler, ast->value->name);
+            if (slot == -1)
                 AST_REF_ERROR(compiler, ast->value->token);
-            Value str = OBJ_VAL(interned, ast->value->token.row, ast->value->token.col);
-            chunk_push(compiler->function->chunk, OP_SET_GLOBAL);
-            chunk_push(compiler->function->chunk, value_push(compiler->function->values, str));
+            ast_emit_global(compiler, OP_SET_GLOBAL, slot);
         }
 
         chunk_push(compiler->function->chunk, OP_POP);
@@ -767,71 +935,90 @@ void ast_to_byte(AST *ast, Compiler *compiler)
         ast_begin_scope(compiler);
 
         AST *initializer = array_at(&ast->childs, 0);
-        ast_to_byte(initializer, compiler);
+        ast_stmt_to_byte(initializer, compiler);
 
         size_t loop_start = array_size(compiler->function->chunk);
+        size_t break_base = array_size(&compiler->breaks);
+        size_t continue_base = array_size(&compiler->continues);
 
         AST *condition = array_at(&ast->childs, 1);
+        if (condition && ast_is_literal(condition))
+        {
+            if (!ast_literal_truthy(condition))
+            {
+                ast_dead_to_byte(ast->value, compiler, ast_stmt_to_byte);
+                ast_dead_to_byte(array_at(&ast->childs, 2), compiler, ast_stmt_to_byte);
+                ast_end_scope(compiler);
+                break;
+            }
+            condition = NULL;
+        }
         size_t end_offset = 0;
+        bool pop = false;
         if (condition)
         {
-            ast_to_byte(condition, compiler);
-            end_offset = ast_emit_jump(compiler, OP_JMP_IF_FALSE);
-            chunk_push(compiler->function->chunk, OP_POP);
+            pop = ast_emit_condition_jump(condition, compiler, &end_offset);
+            if (pop)
+                chunk_push(compiler->function->chunk, OP_POP);
         }
 
-        ast_to_byte(ast->value, compiler);
+        ast_stmt_to_byte(ast->value, compiler);
 
         AST *end_expr = array_at(&ast->childs, 2);
-        ast_to_byte(end_expr, compiler);
+        ast_stmt_to_byte(end_expr, compiler);
 
         ast_emit_loop(compiler, loop_start);
         if (condition)
+        {
             ast_patch_jump(compiler, end_offset);
+            if (pop)
+                chunk_push(compiler->function->chunk, OP_POP);
+        }
 
-        ast_resolve_breaks(compiler);
-        ast_resolve_continues(compiler, loop_start);
+        ast_resolve_breaks(compiler, break_base);
+        ast_resolve_continues(compiler, continue_base, loop_start);
 
         ast_end_scope(compiler);
         break;
     }
     case AST_FUNCTION_DECL:
     {
-        char *name = token_text(ast->token);
-        ObjString *interned = table_find_string(compiler->globals, name);
+        char *name = token_text(ast_token(ast));
+        int slot = compiler_resolve_global(compiler, name);
 
-        if (interned)
+        if (slot != -1 && !IS_NATIVE(compiler_global_at(compiler, slot)->value))
         {
-            Value previous;
-            table_get(compiler->globals, interned, &previous);
-            if (IS_NATIVE(previous))
-            {
-                table_remove(compiler->globals, interned);
-            }
-            else
-            {
-                AST_REDEC_ERROR(compiler, ast->token, previous.row, previous.col);
-            }
+            ast_redeclaration_error(compiler, ast_token(ast), slot);
         }
 
-        ObjString *function_name = interned ? interned : cstr_to_objstr(name);
+        ObjString *function_name = slot != -1 ? compiler_global_at(compiler, slot)->name : cstr_to_objstr(compiler->heap, name);
         free(name);
 
-        Compiler tempCompiler;
-        init_compiler(&tempCompiler, TYPE_FUNCTION);
-        Local *local = &tempCompiler.locals[0];
-        local->name = ast->token;
+        Compiler tempCompiler = {0};
+        init_compiler(&tempCompiler, TYPE_FUNCTION, compiler->heap);
+        Local *local = &array_at(&tempCompiler.locals, 0);
+        local->name = ast_token(ast);
 
         tempCompiler.file_path = compiler->file_path;
+        tempCompiler.optimize = compiler->optimize;
         tempCompiler.globals = compiler->globals;
         tempCompiler.strings = compiler->strings;
-        tempCompiler.variables = compiler->variables;
+        tempCompiler.declarations = compiler->declarations;
 
         tempCompiler.function->name = function_name;
         tempCompiler.function->arity = (int)ast->childs.count;
 
-        Value function_val = OBJ_VAL(tempCompiler.function, ast->token.row, ast->token.col);
-        table_set(compiler->globals, function_name, function_val);
+        Value function_val = OBJ_VAL(tempCompiler.function);
+        if (slot == -1)
+            slot = ast_declare_global(compiler, function_name, ast_token(ast), function_val);
+        if (slot != -1)
+        {
+            // a function may shadow a native, it takes over the native's slot
+            Declaration *declaration = compiler_global_at(compiler, slot);
+            declaration->value = function_val;
+            declaration->row = ast->token.row;
+            declaration->col = ast->token.col;
+        }
 
         ast_begin_scope(&tempCompiler);
         local->depth = tempCompiler.scope_depth;
@@ -839,7 +1026,7 @@ void ast_to_byte(AST *ast, Compiler *compiler)
         if (ast->childs.count > 255)
         {
             compiler->had_error = true;
-            fprintf(stderr, AST_ERROR_PREFIX_FORMART " Can't have more than 255 parameters.\n", compiler->file_path, ast->token.row, ast->token.col);
+            fprintf(stderr, AST_ERROR_PREFIX_FORMART " Can't have more than 255 parameters.\n", compiler->file_path, (size_t)ast->token.row, (size_t)ast->token.col);
         }
         else
         {
@@ -856,16 +1043,13 @@ void ast_to_byte(AST *ast, Compiler *compiler)
                 AST *child = array_at(&ast->value->childs, i);
                 if (child->type == AST_STMT && child->token.type == TOKEN_RETURN)
                     has_return = true;
-                ast_to_byte(child, &tempCompiler);
+                ast_stmt_to_byte(child, &tempCompiler);
             }
         if (!has_return)
         {
-            chunk_push(tempCompiler.function->chunk, OP_CONSTANT);
-            chunk_push(tempCompiler.function->chunk,
-                       value_push(tempCompiler.function->values,
-                                  NULL_VAL(ast->token.row, ast->token.col)));
-            compiler_end(&tempCompiler);
+            ast_emit_constant(&tempCompiler, NULL_VAL);
         }
+        compiler_end(&tempCompiler);
         if (compiler->had_error == false)
             compiler->had_error = tempCompiler.had_error;
 
@@ -873,14 +1057,13 @@ void ast_to_byte(AST *ast, Compiler *compiler)
     }
     case AST_FUNCTION_CALL:
     {
-        ObjString *function = table_find_string(compiler->globals, ast->left->name);
-        if (function == NULL)
+        int slot = compiler_resolve_global(compiler, ast->left->name);
+        if (slot == -1)
         {
             AST_REF_ERROR(compiler, ast->left->token);
             return;
         }
-        Value value = {0};
-        table_get(compiler->globals, function, &value);
+        Value value = compiler_global_at(compiler, slot)->value;
         int arg_count = 0;
         if (ast->value == NULL)
         {
@@ -912,8 +1095,8 @@ void ast_to_byte(AST *ast, Compiler *compiler)
                 compiler->had_error = true;
                 fprintf(stderr, AST_ERROR_PREFIX_FORMART " Function '%.*s' expected %d arguments but got %d arguments\n",
                         compiler->file_path,
-                        ast->left->token.row,
-                        ast->left->token.col,
+                        (size_t)ast->left->token.row,
+                        (size_t)ast->left->token.col,
                         (int)ast->left->token.length,
                         ast->left->token.start,
                         arity,
@@ -924,16 +1107,14 @@ void ast_to_byte(AST *ast, Compiler *compiler)
                 compiler->had_error = true;
                 fprintf(stderr, AST_ERROR_PREFIX_FORMART " Function '%.*s' can't have more then 255 arguments\n",
                         compiler->file_path,
-                        ast->left->token.row,
-                        ast->left->token.col,
+                        (size_t)ast->left->token.row,
+                        (size_t)ast->left->token.col,
                         (int)ast->left->token.length,
                         ast->left->token.start
                         );
             }
         }
-        Value function_val = OBJ_VAL(function, ast->left->token.row, ast->left->token.col);
-        chunk_push(compiler->function->chunk, OP_GET_GLOBAL);
-        chunk_push(compiler->function->chunk, value_push(compiler->function->values, function_val));
+        ast_emit_global(compiler, OP_GET_GLOBAL, slot);
 
         if (arg_count == 1)
         {
@@ -955,4 +1136,17 @@ void ast_to_byte(AST *ast, Compiler *compiler)
         ast_print(ast);
         NOTREACHABLE;
     }
+}
+/* every byte emitted for a node is stamped with the node's source position */
+void ast_to_byte(AST *ast, Compiler *compiler)
+{
+    if (!ast)
+        return;
+    Chunk *chunk = compiler->function->chunk;
+    uint32_t row = chunk->row;
+    uint32_t col = chunk->col;
+    if (ast->token.row != 0)
+        chunk_set_position(chunk, ast->token.row, ast->token.col);
+    ast_node_to_byte(ast, compiler);
+    chunk_set_position(chunk, row, col);
 }
\ No newline at end of file
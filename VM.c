@@ -6,33 +6,204 @@
 #include "VM.h"
 #include "object.h"
 #include "helper.h"
+#include "gc.h"
+#include "jit.h"
 
-VM *init_vm(Compiler *compiler)
+/* labels-as-values is a GNU extension, the plain switch is the portable fallback */
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define VM_COMPUTED_GOTO
+#endif
+
+VM *init_vm(Compiler *compiler, Heap *heap)
 {
     VM *vm = calloc(1, sizeof(VM));
+    vm->heap = heap;
 
     vm->sp = vm->stack.items;
 
     vm->file_path = compiler->file_path;
-    vm->globals = compiler->globals;
+    vm->out = stdout;
     vm->strings = compiler->strings;
-    vm->variables = compiler->variables;
+    vm->declarations = compiler->declarations;
+
+    // functions and natives are bound before the script runs, variables on OP_DEFINE_GLOBAL
+    vm->globals = init_values();
+    for (size_t i = 0; i < array_size(compiler->declarations); i++)
+    {
+        Value value = array_at(compiler->declarations, i).value;
+        array_push(vm->globals, IS_OBJ(value) ? value : UNDEF_VAL);
+    }
 
-    *vm->sp = OBJ_VAL(compiler->function, __LINE__, 0);
+    *vm->sp = OBJ_VAL(compiler->function);
     vm->sp++;
 
     CallFrame *frame = &vm->frames[vm->frame_count++];
     frame->function = compiler->function;
     frame->ip = compiler->function->chunk->items;
     frame->slots = vm->stack.items;
+    vm->jit = init_jit();
+    gc_attach(heap, vm);
     return vm;
 }
+/*
+ * swaps the program's functions for copies on the VM's heap before it runs.
+ * quickening rewrites the code it executes, this lets VMs of one program
+ * run on several threads at once.
+ */
+void vm_own_code(VM *vm)
+{
+    for (size_t i = 0; i < array_size(vm->globals); i++)
+    {
+        Value *global = &array_at(vm->globals, i);
+        if (IS_FUNCTION(*global))
+            *global = OBJ_VAL(function_copy(vm->heap, AS_FUNCTION(*global)));
+    }
+    CallFrame *frame = &vm->frames[0];
+    frame->function = function_copy(vm->heap, frame->function);
+    frame->ip = frame->function->chunk->items;
+    vm->stack.items[0] = OBJ_VAL(frame->function);
+}
+/* keeps every function interpreted, before the VM runs */
+void vm_disable_jit(VM *vm)
+{
+    jit_free(vm->jit);
+    vm->jit = NULL;
+}
 void vm_free(VM *vm)
 {
+    jit_free(vm->jit);
+    gc_detach(vm->heap);
+    values_free(vm->globals);
     free(vm);
 }
 
 
+#ifdef DEBUG_TRACE_EXECUTION
+static void vm_trace_instruction(VM *vm, CallFrame *frame)
+{
+    Chunk *chunk = frame->function->chunk;
+    chunk_print_instruction(chunk, (size_t)(frame->ip - chunk->items), stdout);
+    Value *slot = vm->stack.items;
+    printf("          ");
+    for (; slot < vm->sp; slot++)
+    {
+        printf("[");
+        value_print(*slot, 0, stdout);
+        printf("]");
+    }
+    printf("\n");
+    getc(stdin);
+}
+#define VM_TRACE_INSTRUCTION() vm_trace_instruction(vm, frame)
+#else
+#define VM_TRACE_INSTRUCTION()
+#endif
+
+/* source position of the instruction the frame is currently executing */
+static void vm_error_position(VM *vm, CallFrame *frame)
+{
+    Chunk *chunk = frame->function->chunk;
+    Position position = chunk_position_at(chunk, (size_t)(frame->ip - chunk->items) - 1);
+    vm->row = position.row;
+    vm->col = position.col;
+}
+
+static VM_Error vm_arity_error(VM *vm, CallFrame *frame, ObjFunction *function, int arg_count)
+{
+    char *template = "Function '%s' expects %d parameters, but %d was provided.";
+    char *message = calloc(strlen(template) + helper_num_places(function->arity) + helper_num_places(arg_count) + function->name->length, sizeof(char));
+    sprintf(message, template, function->name->chars, function->arity, arg_count);
+    vm->message = message;
+    vm_error_position(vm, frame);
+    return arg_count < function->arity ? VM_TOO_FEW_ARGUMENTS : VM_TOO_MANY_ARGUMENTS;
+}
+
+/*
+ * calls a function or native from outside the interpreter, e.g. a global
+ * looked up by an embedder. the previous call's stack is dropped, only the
+ * script stays in slot zero. the return value is left in vm->result.
+ */
+VM_Error vm_call(VM *vm, Value callee, int arg_count, Value *args)
+{
+    vm->sp = vm->stack.items + 1;
+    vm->frame_count = 0;
+    vm->row = vm->col = 0;
+    vm->message = NULL;
+    *vm->sp++ = callee;
+    for (int i = 0; i < arg_count; i++)
+        *vm->sp++ = args[i];
+    vm->stack.count = (size_t)(vm->sp - vm->stack.items);
+    if (IS_NATIVE(callee) && AS_NATIVE(callee)->arity == arg_count)
+    {
+        vm->result = AS_NATIVE(callee)->function(vm, vm->sp - arg_count);
+        return vm->message != NULL ? VM_TYPE_ERROR : VM_OK;
+    }
+    if (!IS_FUNCTION(callee))
+    {
+        vm->message = IS_NATIVE(callee) ? "wrong number of arguments" : "callee is not a function";
+        return IS_NATIVE(callee) ? VM_TOO_MANY_ARGUMENTS : VM_TYPE_ERROR;
+    }
+    ObjFunction *function = AS_FUNCTION(callee);
+    if (arg_count != function->arity)
+    {
+        vm->message = "wrong number of arguments";
+        return arg_count < function->arity ? VM_TOO_FEW_ARGUMENTS : VM_TOO_MANY_ARGUMENTS;
+    }
+    CallFrame *frame = &vm->frames[vm->frame_count++];
+    frame->function = function;
+    frame->ip = function->chunk->items;
+    frame->slots = vm->sp - arg_count - 1;
+    return vm_interpret(vm);
+}
+/* the one line report main prints for an error, returns what snprintf returns */
+int vm_format_error(VM *vm, VM_Error error, char *buffer, size_t size)
+{
+    switch (error)
+    {
+    case VM_TYPE_ERROR:
+        return snprintf(buffer, size, "TypeError at %s:%d:%d %s", vm->file_path, vm->row, vm->col, vm->message);
+    case VM_STACK_OVERFLOW:
+    case VM_STACK_UNDERFLOW:
+        return snprintf(buffer, size, "%s InternalError %s", vm->file_path, vm->message);
+    case VM_REFERENCE_ERROR:
+        return snprintf(buffer, size, "ReferenceError at %s:%d:%d %s", vm->file_path, vm->row, vm->col, vm->message);
+    case VM_TOO_FEW_ARGUMENTS:
+        return snprintf(buffer, size, "TooFewArguments at %s:%d:%d %s", vm->file_path, vm->row, vm->col, vm->message);
+    case VM_TOO_MANY_ARGUMENTS:
+        return snprintf(buffer, size, "TooManyArguments at %s:%d:%d %s", vm->file_path, vm->row, vm->col, vm->message);
+    default:
+        return snprintf(buffer, size, "%s", "");
+    }
+}
+/* the frames that were running, innermost first, followed by the formatted error */
+void vm_report_error(VM *vm, VM_Error error, FILE *stream)
+{
+    if (error != VM_OK)
+    {
+        for (int i = vm->frame_count - 1; i >= 0; --i)
+        {
+            CallFrame *frame = &vm->frames[i];
+            ObjFunction *function = frame->function;
+            fprintf(stream, "#%d ", i);
+            if (function->name == NULL)
+            {
+                fprintf(stream, "%s\n", vm->file_path);
+            }
+            else
+            {
+                fprintf(stream, "%s()\n", function->name->chars);
+            }
+        }
+    }
+    int length = vm_format_error(vm, error, NULL, 0);
+    if (length > 0)
+    {
+        char *message = malloc((size_t)length + 1);
+        vm_format_error(vm, error, message, (size_t)length + 1);
+        fprintf(stream, "%s\n", message);
+        free(message);
+    }
+}
 bool is_falsey(Value value)
 {
     return IS_NULL(value) ||
@@ -41,6 +212,13 @@ bool is_falsey(Value value)
            (IS_BOOL(value) && !AS_BOOL(value));
 }
 VM_Error vm_interpret(VM *vm)
+{
+    // a program compiled ahead of time starts out in native code
+    if (vm->frames[0].function->code != NULL)
+        return jit_run(vm, &vm->frames[0]);
+    return vm_run(vm, 0);
+}
+VM_Error vm_run(VM *vm, int base)
 {
     CallFrame *frame = &vm->frames[vm->frame_count - 1];
 
@@ -63,6 +241,14 @@ VM_Error vm_interpret(VM *vm)
         vm->stack.count--;  \
     } while (0)
 
+/* only where nothing but the stack holds objects, a collection may move them */
+#define VM_GC_SAFEPOINT()         \
+    do                            \
+    {                             \
+        if (vm->heap->pending)    \
+            gc_collect(vm->heap); \
+    } while (0)
+
 #define VM_STACK_PEEK(ident, offset) \
     do                               \
     {                                \
@@ -73,65 +259,115 @@ VM_Error vm_interpret(VM *vm)
 #define VM_READ_CONSTANT() (frame->function->values->items[VM_READ_BYTE()])
 #define VM_READ_STRING() AS_STRING(VM_READ_CONSTANT())
 #define VM_READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+#define VM_READ_UINT24() (frame->ip += 3, ((uint32_t)frame->ip[-3] << 16) | ((uint32_t)frame->ip[-2] << 8) | frame->ip[-1])
+#define VM_READ_LONG() (frame->ip += 4, ((uint32_t)frame->ip[-4] << 24) | ((uint32_t)frame->ip[-3] << 16) | ((uint32_t)frame->ip[-2] << 8) | frame->ip[-1])
+/* rewrites the executing instruction in place, only valid before operands are read */
+#define VM_QUICKEN(instruction) (frame->ip[-1] = (instruction))
 
-#define VM_TYPE_ERROR(must, given, _row, _col)                                          \
+#ifdef VM_COMPUTED_GOTO
+#define VM_TARGET(op) [op] = &&vm_##op
+#define VM_CASE(op) vm_##op
+#define VM_DEFAULT vm_illegal_instruction
+#define VM_SWITCH(instruction) goto *dispatch[(instruction)];
+#define VM_DISPATCH()                   \
+    do                                  \
+    {                                   \
+        VM_TRACE_INSTRUCTION();         \
+        goto *dispatch[VM_READ_BYTE()]; \
+    } while (0)
+/* while a loop is recorded every instruction is routed through vm_record first */
+#define VM_RECORDING(on) (dispatch = (on) ? record_table : dispatch_table)
+#else
+#define VM_CASE(op) case op
+#define VM_DEFAULT default
+#define VM_SWITCH(instruction) switch (instruction)
+#define VM_DISPATCH() continue
+#define VM_RECORDING(on) (recording = (on))
+#endif
+
+/* back-edge of an interpreted loop, a hot one is recorded and runs as a trace or native code */
+#define VM_LOOP_EDGE()                                        \
+    do                                                        \
+    {                                                         \
+        if (vm->jit != NULL || frame->function->code != NULL) \
+        {                                                     \
+            int status = jit_loop(vm, frame);                 \
+            if (status == JIT_RETURN)                         \
+            {                                                 \
+                if (vm->frame_count == 0)                     \
+                {                                             \
+                    VM_STACK_POP(vm->result);                 \
+                    return VM_OK;                             \
+                }                                             \
+                if (vm->frame_count == base)                  \
+                    return VM_OK;                             \
+                frame = &vm->frames[vm->frame_count - 1];     \
+            }                                                 \
+            else if (status != VM_OK)                         \
+                return (VM_Error)status;                      \
+            VM_RECORDING(jit_recording(vm->jit));             \
+        }                                                     \
+    } while (0)
+
+#define VM_TYPE_ERROR(must, given)                                                      \
     do                                                                                  \
     {                                                                                   \
         char *template = "Operand must be a type of " must ".But given type is \"%s\""; \
         char *message = calloc(strlen(template) + strlen((given)) + 1, sizeof(char));   \
         sprintf(message, template, (given));                                            \
         vm->message = message;                                                          \
-        vm->row = (_row);                                                               \
-        vm->col = (_col);                                                               \
+        vm_error_position(vm, frame);                                                   \
         return VM_TYPE_ERROR;                                                           \
     } while (0)
 
-#define VM_REF_ERROR(obj_str, value)                                                    \
+#define VM_REF_ERROR(obj_str)                                                           \
     do                                                                                  \
     {                                                                                   \
         char *template = "'%s' is not defined";                                         \
         char *message = calloc(strlen(template) + (obj_str)->length + 1, sizeof(char)); \
         sprintf(message, template, (obj_str)->chars);                                   \
-        vm->row = (value).row;                                                          \
-        vm->col = (value).col;                                                          \
+        vm_error_position(vm, frame);                                                   \
         vm->message = message;                                                          \
         return VM_REFERENCE_ERROR;                                                      \
     } while (0);
 
-#define LOGICAL_OP(op)                                                       \
-    do                                                                       \
-    {                                                                        \
-        if (vm->stack.count < 2)                                             \
-        {                                                                    \
-            vm->message = "stack underflow";                                 \
-            return VM_STACK_UNDERFLOW;                                       \
-        }                                                                    \
-        Value b = {0};                                                       \
-        VM_STACK_POP(b);                                                     \
-        Value a = {0};                                                       \
-        VM_STACK_POP(a);                                                     \
-        if (b.type != a.type)                                                \
-        {                                                                    \
-            VM_STACK_PUSH(BOOL_VAL(false, 0, 0));                            \
-        }                                                                    \
-        else                                                                 \
-            switch (b.type)                                                  \
-            {                                                                \
-            case VAL_BOOL:                                                   \
-                VM_STACK_PUSH(BOOL_VAL(AS_BOOL(a) op AS_BOOL(b), 0, 0));     \
-                break;                                                       \
-            case VAL_NUMBER:                                                 \
-                VM_STACK_PUSH(BOOL_VAL(AS_NUMBER(a) op AS_NUMBER(b), 0, 0)); \
-                break;                                                       \
-            case VAL_NULL:                                                   \
-                VM_STACK_PUSH(BOOL_VAL(true, 0, 0));                         \
-                break;                                                       \
-            case VAL_OBJ:                                                    \
-                VM_STACK_PUSH(BOOL_VAL(AS_OBJ(a) op AS_OBJ(b), 0, 0));       \
-                break;                                                       \
-            default:                                                         \
-                NOTREACHABLE;                                                \
-            }                                                                \
+#define LOGICAL_OP(op, quick)                  \
+    do                                         \
+    {                                          \
+        if (vm->stack.count < 2)               \
+        {                                      \
+            vm->message = "stack underflow";   \
+            return VM_STACK_UNDERFLOW;         \
+        }                                      \
+        Value b = {0};                         \
+        VM_STACK_POP(b);                       \
+        Value a = {0};                         \
+        VM_STACK_POP(a);                       \
+        bool result = false;                   \
+        VM_COMPARE(result, a, b, op);          \
+        VM_STACK_PUSH(BOOL_VAL(result));       \
+        if (IS_NUMBER(a) && IS_NUMBER(b))      \
+            VM_QUICKEN(quick);                 \
+    } while (0)
+
+/* compare-and-branch: pops both operands and jumps when the comparison is false */
+#define COMPARE_JUMP(op, read_offset)                   \
+    do                                                  \
+    {                                                   \
+        uint32_t offset = read_offset();                \
+        if (vm->stack.count < 2)                        \
+        {                                               \
+            vm->message = "stack underflow";            \
+            return VM_STACK_UNDERFLOW;                  \
+        }                                               \
+        Value b = {0};                                  \
+        VM_STACK_POP(b);                                \
+        Value a = {0};                                  \
+        VM_STACK_POP(a);                                \
+        bool result = false;                            \
+        VM_COMPARE(result, a, b, op);                   \
+        if (!result)                                    \
+            frame->ip = VM_CURRENT_CHUNK_BASE + offset; \
     } while (0)
 
 #define ARITHMETIC_OP(op, AS)                                       \
@@ -148,46 +384,162 @@ VM_Error vm_interpret(VM *vm)
         VM_STACK_POP(a);                                            \
         if (!IS_NUMBER(b) || !IS_NUMBER(a))                         \
         {                                                           \
-            int row = !IS_NUMBER(a) ? a.row : b.row;                \
-            int col = !IS_NUMBER(a) ? a.col : b.col;                \
             char *given_type = value_typeof(!IS_NUMBER(a) ? a : b); \
-            VM_TYPE_ERROR("\"Number\"", given_type, row, col);      \
+            VM_TYPE_ERROR("\"Number\"", given_type);                \
         }                                                           \
-        VM_STACK_PUSH(NUMBER_VAL(AS(a) op AS(b), b.row, b.col));    \
+        VM_STACK_PUSH(NUMBER_VAL(AS(a) op AS(b)));                  \
+    } while (0)
+
+/*
+ * quickened form of a binary numeric instruction, guarded by the operand
+ * types it was specialized for. when the guard fails the instruction
+ * deoptimizes back to its generic form and is executed again.
+ */
+#define NUMBER_OP(op, AS, make, generic)       \
+    do                                         \
+    {                                          \
+        Value b = vm->sp[-1];                  \
+        Value a = vm->sp[-2];                  \
+        if (IS_NUMBER(a) && IS_NUMBER(b))      \
+        {                                      \
+            vm->sp[-2] = make(AS(a) op AS(b)); \
+            vm->sp--;                          \
+            vm->stack.count--;                 \
+        }                                      \
+        else                                   \
+        {                                      \
+            frame->ip[-1] = (generic);         \
+            frame->ip--;                       \
+        }                                      \
     } while (0)
 
-#define UNARY_ARITHMETIC_OP(op, AS)                                    \
+/* local op= numeric constant, the superinstruction behind ++, -- and i = i + k */
+#define LOCAL_CONSTANT_OP(op)                                          \
     do                                                                 \
     {                                                                  \
-        Value value = {0};                                             \
-        VM_STACK_POP(value);                                           \
-        if (!IS_NUMBER(value))                                         \
-        {                                                              \
-            char *given_type = value_typeof(value);                    \
-            VM_TYPE_ERROR("Number", given_type, value.row, value.row); \
-        }                                                              \
-        VM_STACK_PUSH(NUMBER_VAL(op AS(value), value.row, value.col)); \
+        byte slot = VM_READ_BYTE();                                    \
+        Value constant = VM_READ_CONSTANT();                           \
+        Value *local = &frame->slots[slot];                            \
+        if (!IS_NUMBER(*local))                                        \
+            VM_TYPE_ERROR("\"Number\"", value_typeof(*local));         \
+        *local = NUMBER_VAL(AS_NUMBER(*local) op AS_NUMBER(constant)); \
+    } while (0)
+
+/* top of the stack op= numeric constant */
+#define CONSTANT_OP(op)                                               \
+    do                                                                \
+    {                                                                 \
+        Value constant = VM_READ_CONSTANT();                          \
+        Value a = vm->sp[-1];                                         \
+        if (!IS_NUMBER(a))                                            \
+            VM_TYPE_ERROR("\"Number\"", value_typeof(a));             \
+        vm->sp[-1] = NUMBER_VAL(AS_NUMBER(a) op AS_NUMBER(constant)); \
+    } while (0)
+
+#define UNARY_ARITHMETIC_OP(op, AS)                 \
+    do                                              \
+    {                                               \
+        Value value = {0};                          \
+        VM_STACK_POP(value);                        \
+        if (!IS_NUMBER(value))                      \
+        {                                           \
+            char *given_type = value_typeof(value); \
+            VM_TYPE_ERROR("Number", given_type);    \
+        }                                           \
+        VM_STACK_PUSH(NUMBER_VAL(op AS(value)));    \
     } while (0)
 
+#ifdef VM_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static void *dispatch_table[UINT8_COUNT] = {
+        [0 ... UINT8_MAX] = &&VM_DEFAULT,
+        VM_TARGET(OP_CALL),
+        VM_TARGET(OP_TAIL_CALL),
+        VM_TARGET(OP_DUP),
+        VM_TARGET(OP_LOOP),
+        VM_TARGET(OP_JMP),
+        VM_TARGET(OP_JMP_IF_FALSE),
+        VM_TARGET(OP_JMP_IF_NOT_EQUAL),
+        VM_TARGET(OP_JMP_IF_NOT_NOT_EQUAL),
+        VM_TARGET(OP_JMP_IF_NOT_LT),
+        VM_TARGET(OP_JMP_IF_NOT_LTE),
+        VM_TARGET(OP_JMP_IF_NOT_GT),
+        VM_TARGET(OP_JMP_IF_NOT_GTE),
+        VM_TARGET(OP_POP),
+        VM_TARGET(OP_SET_LOCAL),
+        VM_TARGET(OP_GET_LOCAL),
+        VM_TARGET(OP_SET_GLOBAL),
+        VM_TARGET(OP_DEFINE_GLOBAL),
+        VM_TARGET(OP_GET_GLOBAL),
+        VM_TARGET(OP_PRINT),
+        VM_TARGET(OP_RETURN),
+        VM_TARGET(OP_CONSTANT),
+        VM_TARGET(OP_ADD),
+        VM_TARGET(OP_SUBTRACT),
+        VM_TARGET(OP_MULTIPLY),
+        VM_TARGET(OP_DIVIDE),
+        VM_TARGET(OP_MOD),
+        VM_TARGET(OP_BITWISE_AND),
+        VM_TARGET(OP_BITWISE_OR),
+        VM_TARGET(OP_BITWISE_NOT),
+        VM_TARGET(OP_LEFT_SHIFT),
+        VM_TARGET(OP_RIGHT_SHIFT),
+        VM_TARGET(OP_EQUAL),
+        VM_TARGET(OP_NOT_EQUAL),
+        VM_TARGET(OP_LT),
+        VM_TARGET(OP_LTE),
+        VM_TARGET(OP_GT),
+        VM_TARGET(OP_GTE),
+        VM_TARGET(OP_NOT),
+        VM_TARGET(OP_NEGATE),
+        VM_TARGET(OP_INC_LOCAL),
+        VM_TARGET(OP_DEC_LOCAL),
+        VM_TARGET(OP_ADD_CONST),
+        VM_TARGET(OP_SUBTRACT_CONST),
+        VM_TARGET(OP_ADD_NUM),
+        VM_TARGET(OP_SUBTRACT_NUM),
+        VM_TARGET(OP_MULTIPLY_NUM),
+        VM_TARGET(OP_DIVIDE_NUM),
+        VM_TARGET(OP_MOD_NUM),
+        VM_TARGET(OP_EQUAL_NUM),
+        VM_TARGET(OP_NOT_EQUAL_NUM),
+        VM_TARGET(OP_LT_NUM),
+        VM_TARGET(OP_LTE_NUM),
+        VM_TARGET(OP_GT_NUM),
+        VM_TARGET(OP_GTE_NUM),
+        VM_TARGET(OP_CONSTANT_LONG),
+        VM_TARGET(OP_GET_LOCAL_LONG),
+        VM_TARGET(OP_SET_LOCAL_LONG),
+        VM_TARGET(OP_JMP_IF_FALSE_LONG),
+        VM_TARGET(OP_JMP_IF_NOT_EQUAL_LONG),
+        VM_TARGET(OP_JMP_IF_NOT_NOT_EQUAL_LONG),
+        VM_TARGET(OP_JMP_IF_NOT_LT_LONG),
+        VM_TARGET(OP_JMP_IF_NOT_LTE_LONG),
+        VM_TARGET(OP_JMP_IF_NOT_GT_LONG),
+        VM_TARGET(OP_JMP_IF_NOT_GTE_LONG),
+        VM_TARGET(OP_JMP_LONG),
+        VM_TARGET(OP_LOOP_LONG),
+    };
+#pragma GCC diagnostic pop
+    static void *record_table[UINT8_COUNT] = {[0 ... UINT8_MAX] = &&vm_record};
+    void **dispatch = dispatch_table;
+#else
+    bool recording = false;
+#endif
+
     for (;;)
     {
-#ifdef DEBUG_TRACE_EXECUTION
-        chunk_print_instruction(VM_CURRENT_CHUNK, (size_t)(frame->ip - VM_CURRENT_CHUNK_BASE), stdout);
-        Value *slot = vm->stack.items;
-        printf("          ");
-        for (; slot < vm->sp; slot++)
-        {
-            printf("[");
-            value_print(*slot, 0);
-            printf("]");
-        }
-        printf("\n");
-        getc(stdin);
-#endif
+        VM_TRACE_INSTRUCTION();
         byte instruction = VM_READ_BYTE();
-        switch (instruction)
+#ifndef VM_COMPUTED_GOTO
+        if (recording)
+            recording = jit_record(vm, frame);
+#endif
+        VM_SWITCH(instruction)
         {
-        case OP_CALL:
+        VM_CASE(OP_CALL):
+        vm_call:
         {
             if (vm->frame_count == FRAMES_MAX)
             {
@@ -205,28 +557,21 @@ VM_Error vm_interpret(VM *vm)
                 {
                     ObjFunction *function = AS_FUNCTION(value);
                     if (agr_count != function->arity)
-                    {
-                        char *template = "Function '%s' expects %d parameters, but %d was provided.";
-                        char *message = calloc(strlen(template) + helper_num_places(function->arity) + helper_num_places(agr_count) + function->name->length, sizeof(char));
-                        sprintf(message, template, function->name->chars, function->arity, agr_count);
-                        vm->message = message;
-                        vm->row = value.row;
-                        vm->col = value.col;
-                    }
-                    if (agr_count < function->arity)
-                    {
-                        return VM_TOO_FEW_ARGUMENTS;
-                    }
-                    if (agr_count > function->arity)
-                    {
-                        return VM_TOO_MANY_ARGUMENTS;
-                    }
+                        return vm_arity_error(vm, frame, function, agr_count);
                     CallFrame *call_frame = &vm->frames[vm->frame_count++];
                     call_frame->function = function;
                     call_frame->ip = function->chunk->items;
                     call_frame->slots = vm->sp - agr_count - 1;
+                    // a hot function runs natively until it returns here
+                    if (jit_hot(vm->jit, function))
+                    {
+                        VM_Error error = jit_run(vm, call_frame);
+                        if (error != VM_OK)
+                            return error;
+                        VM_DISPATCH();
+                    }
                     frame = call_frame;
-                    continue;
+                    VM_DISPATCH();
                 }
                 case OBJ_NATIVE:
                 {
@@ -234,13 +579,13 @@ VM_Error vm_interpret(VM *vm)
                     Value result = native->function(vm, vm->sp - agr_count);
                     if(vm->message)
                     {
+                        vm_error_position(vm, frame);
                         return VM_TYPE_ERROR;
                     }
                     vm->sp -= agr_count + 1;
-                    result.row = value.row;
-                    result.col = value.col;
                     VM_STACK_PUSH(result);
-                    continue;
+                    VM_GC_SAFEPOINT();
+                    VM_DISPATCH();
                 }
                 default:
                 {
@@ -249,29 +594,48 @@ VM_Error vm_interpret(VM *vm)
                 }
             }
             char *given = value_typeof(value);
-            VM_TYPE_ERROR("\"Function\"", given, value.row, value.col);
-            break;
+            VM_TYPE_ERROR("\"Function\"", given);
+            VM_DISPATCH();
         }
-        case OP_DUP:
+        VM_CASE(OP_TAIL_CALL):
+        {
+            // return f(...): the callee takes over the current frame and its slots.
+            // anything that is not a plain function call is left to OP_CALL
+            uint8_t arg_count = frame->ip[0];
+            Value callee = vm->sp[-1 - arg_count];
+            if (!IS_FUNCTION(callee) || AS_FUNCTION(callee)->arity != arg_count)
+                goto vm_call;
+            frame->ip++;
+            Value *args = vm->sp - arg_count - 1;
+            for (int i = 0; i <= arg_count; i++)
+                frame->slots[i] = args[i];
+            vm->sp = frame->slots + arg_count + 1;
+            vm->stack.count = vm->sp - vm->stack.items;
+            frame->function = AS_FUNCTION(callee);
+            frame->ip = frame->function->chunk->items;
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_DUP):
         {
             Value value = {0};
             VM_STACK_PEEK(value, 0);
             VM_STACK_PUSH(value);
-            break;
+            VM_DISPATCH();
         }
-        case OP_LOOP:
+        VM_CASE(OP_LOOP):
         {
             uint16_t offset = VM_READ_SHORT();
             frame->ip -= offset;
-            break;
+            VM_LOOP_EDGE();
+            VM_DISPATCH();
         }
-        case OP_JMP:
+        VM_CASE(OP_JMP):
         {
             uint16_t offset = VM_READ_SHORT();
             frame->ip = VM_CURRENT_CHUNK_BASE + offset;
-            break;
+            VM_DISPATCH();
         }
-        case OP_JMP_IF_FALSE:
+        VM_CASE(OP_JMP_IF_FALSE):
         {
             uint16_t offset = VM_READ_SHORT();
             Value value;
@@ -279,184 +643,312 @@ VM_Error vm_interpret(VM *vm)
             bool fval = is_falsey(value);
             if (fval)
                 frame->ip = VM_CURRENT_CHUNK_BASE + offset;
-            break;
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_JMP_IF_NOT_EQUAL):
+            COMPARE_JUMP(==, VM_READ_SHORT);
+            VM_DISPATCH();
+        VM_CASE(OP_JMP_IF_NOT_NOT_EQUAL):
+            COMPARE_JUMP(!=, VM_READ_SHORT);
+            VM_DISPATCH();
+        VM_CASE(OP_JMP_IF_NOT_LT):
+            COMPARE_JUMP(<, VM_READ_SHORT);
+            VM_DISPATCH();
+        VM_CASE(OP_JMP_IF_NOT_LTE):
+            COMPARE_JUMP(<=, VM_READ_SHORT);
+            VM_DISPATCH();
+        VM_CASE(OP_JMP_IF_NOT_GT):
+            COMPARE_JUMP(>, VM_READ_SHORT);
+            VM_DISPATCH();
+        VM_CASE(OP_JMP_IF_NOT_GTE):
+            COMPARE_JUMP(>=, VM_READ_SHORT);
+            VM_DISPATCH();
+        // wide forms, kept apart so the short ones above stay as they were
+        VM_CASE(OP_LOOP_LONG):
+        {
+            uint32_t offset = VM_READ_LONG();
+            frame->ip -= offset;
+            VM_LOOP_EDGE();
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_JMP_LONG):
+        {
+            uint32_t offset = VM_READ_LONG();
+            frame->ip = VM_CURRENT_CHUNK_BASE + offset;
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_JMP_IF_FALSE_LONG):
+        {
+            uint32_t offset = VM_READ_LONG();
+            Value value;
+            VM_STACK_PEEK(value, 0);
+            if (is_falsey(value))
+                frame->ip = VM_CURRENT_CHUNK_BASE + offset;
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_JMP_IF_NOT_EQUAL_LONG):
+            COMPARE_JUMP(==, VM_READ_LONG);
+            VM_DISPATCH();
+        VM_CASE(OP_JMP_IF_NOT_NOT_EQUAL_LONG):
+            COMPARE_JUMP(!=, VM_READ_LONG);
+            VM_DISPATCH();
+        VM_CASE(OP_JMP_IF_NOT_LT_LONG):
+            COMPARE_JUMP(<, VM_READ_LONG);
+            VM_DISPATCH();
+        VM_CASE(OP_JMP_IF_NOT_LTE_LONG):
+            COMPARE_JUMP(<=, VM_READ_LONG);
+            VM_DISPATCH();
+        VM_CASE(OP_JMP_IF_NOT_GT_LONG):
+            COMPARE_JUMP(>, VM_READ_LONG);
+            VM_DISPATCH();
+        VM_CASE(OP_JMP_IF_NOT_GTE_LONG):
+            COMPARE_JUMP(>=, VM_READ_LONG);
+            VM_DISPATCH();
+        VM_CASE(OP_GET_LOCAL_LONG):
+        {
+            uint16_t slot = VM_READ_SHORT();
+            VM_STACK_PUSH(frame->slots[slot]);
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_SET_LOCAL_LONG):
+        {
+            uint16_t slot = VM_READ_SHORT();
+            Value value;
+            VM_STACK_PEEK(value, 0);
+            frame->slots[slot] = value;
+            VM_DISPATCH();
+        }
+        VM_CASE(OP_CONSTANT_LONG):
+        {
+            Value constant = frame->function->values->items[VM_READ_UINT24()];
+            VM_STACK_PUSH(constant);
+            VM_DISPATCH();
         }
-        case OP_POP:
+        VM_CASE(OP_POP):
         {
             Value value;
             VM_STACK_POP(value);
             (void)value;
-            break;
+            VM_DISPATCH();
         }
-        case OP_SET_LOCAL:
+        VM_CASE(OP_SET_LOCAL):
         {
             byte slot = VM_READ_BYTE();
             Value value;
             VM_STACK_PEEK(value, 0);
             frame->slots[slot] = value;
-            break;
+            VM_DISPATCH();
         }
-        case OP_GET_LOCAL:
+        VM_CASE(OP_GET_LOCAL):
         {
             byte slot = VM_READ_BYTE();
-            Value name = VM_READ_CONSTANT();
-            Value value = frame->slots[slot];
-            value.row = name.row;
-            value.col = name.col;
-            VM_STACK_PUSH(value);
-            break;
+            VM_STACK_PUSH(frame->slots[slot]);
+            VM_DISPATCH();
         }
-        case OP_SET_GLOBAL:
+        VM_CASE(OP_SET_GLOBAL):
         {
-            Value name = VM_READ_CONSTANT();
-            ObjString *str = AS_STRING(name);
-            Value value = {0};
-            VM_STACK_PEEK(value, 0);
-            if (table_set(vm->globals, str, value))
+            uint16_t slot = VM_READ_SHORT();
+            Value *global = &array_at(vm->globals, slot);
+            if (IS_UNDEF(*global))
             {
-                table_remove(vm->globals, str);
-                VM_REF_ERROR(str, value);
+                VM_REF_ERROR(array_at(vm->declarations, slot).name);
             }
-            break;
+            Value previous = *global;
+            VM_STACK_PEEK(*global, 0);
+            gc_write_barrier_global(vm->heap, slot, previous, *global);
+            VM_DISPATCH();
         }
-        case OP_DEFINE_GLOBAL:
+        VM_CASE(OP_DEFINE_GLOBAL):
         {
-            ObjString *name = VM_READ_STRING();
-            Value value = {0};
-            VM_STACK_PEEK(value, 0);
-            table_set(vm->globals, name, value);
-            VM_STACK_POP(value);
-            break;
+            uint16_t slot = VM_READ_SHORT();
+            Value previous = array_at(vm->globals, slot);
+            VM_STACK_POP(array_at(vm->globals, slot));
+            gc_write_barrier_global(vm->heap, slot, previous, array_at(vm->globals, slot));
+            VM_DISPATCH();
         }
-        case OP_GET_GLOBAL:
+        VM_CASE(OP_GET_GLOBAL):
         {
-            Value name = VM_READ_CONSTANT();
-            ObjString *str = AS_STRING(name);
-            Value value = {0};
-            if (!table_get(vm->globals, str, &value))
+            uint16_t slot = VM_READ_SHORT();
+            Value value = array_at(vm->globals, slot);
+            if (IS_UNDEF(value))
             {
-                VM_REF_ERROR(str, name);
+                VM_REF_ERROR(array_at(vm->declarations, slot).name);
             }
-            value.row = name.row;
-            value.col = name.col;
             VM_STACK_PUSH(value);
-            break;
+            VM_DISPATCH();
         }
-        case OP_PRINT:
+        VM_CASE(OP_PRINT):
         {
             Value value = {0};
             VM_STACK_POP(value);
-            value_print(value, 1);
-            break;
+            value_print(value, 1, vm->out);
+            VM_DISPATCH();
         }
-        case OP_RETURN:
+        VM_CASE(OP_RETURN):
         {
             Value value = {0};
             vm->frame_count--;
             if (vm->frame_count == 0)
             {
                 VM_STACK_POP(value);
+                vm->result = value;
                 return VM_OK;
             }
             VM_STACK_POP(value);
             vm->sp = frame->slots;
             VM_STACK_PUSH(value);
+            if (vm->frame_count == base)
+                return VM_OK;
             frame = &vm->frames[vm->frame_count - 1];
-            break;
+            VM_DISPATCH();
         }
-        case OP_CONSTANT:
+        VM_CASE(OP_CONSTANT):
         {
             Value constant = VM_READ_CONSTANT();
             VM_STACK_PUSH(constant);
-            break;
+            VM_DISPATCH();
         }
-        case OP_ADD:
+        VM_CASE(OP_ADD):
         {
             Value b = {0};
             Value a = {0};
-            VM_STACK_POP(b);
-            VM_STACK_POP(a);
+            VM_STACK_PEEK(b, 0);
+            VM_STACK_PEEK(a, 1);
             if (IS_STRING(b) && IS_STRING(a))
             {
-                ObjString *bString = AS_STRING(b);
-                ObjString *aString = AS_STRING(a);
-                ObjString *result = new_string(NULL, aString->length + bString->length);
-                strcpy(result->chars, aString->chars);
-                strcat(result->chars, bString->chars);
-                result->hash = table_hash_string(result->chars, result->length);
-                VM_STACK_PUSH(OBJ_VAL(result, 0, 0));
+                ObjString *result = string_concat(vm->heap, AS_STRING(a), AS_STRING(b));
+                VM_STACK_POP(b);
+                VM_STACK_POP(a);
+                VM_STACK_PUSH(OBJ_VAL(result));
+                VM_GC_SAFEPOINT();
             }
             else if (IS_NUMBER(b) && IS_NUMBER(a))
             {
-                VM_STACK_PUSH(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b), 0, 0));
+                VM_STACK_POP(b);
+                VM_STACK_POP(a);
+                VM_STACK_PUSH(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
+                VM_QUICKEN(OP_ADD_NUM);
             }
             else
             {
-                uint32_t row = !IS_NUMBER(a) ? a.row : b.row;
-                uint32_t col = !IS_NUMBER(a) ? a.col : b.col;
                 char *given_type = value_typeof(!IS_NUMBER(a) ? a : b);
-                VM_TYPE_ERROR("\"Number\"", given_type, row, col);
+                VM_TYPE_ERROR("\"Number\"", given_type);
             }
-            break;
+            VM_DISPATCH();
         }
-        case OP_SUBTRACT:
+        VM_CASE(OP_SUBTRACT):
             ARITHMETIC_OP(-, AS_NUMBER);
-            break;
-        case OP_MULTIPLY:
+            VM_QUICKEN(OP_SUBTRACT_NUM);
+            VM_DISPATCH();
+        VM_CASE(OP_MULTIPLY):
             ARITHMETIC_OP(*, AS_NUMBER);
-            break;
-        case OP_DIVIDE:
+            VM_QUICKEN(OP_MULTIPLY_NUM);
+            VM_DISPATCH();
+        VM_CASE(OP_DIVIDE):
             ARITHMETIC_OP(/, AS_NUMBER);
-            break;
-        case OP_MOD:
+            VM_QUICKEN(OP_DIVIDE_NUM);
+            VM_DISPATCH();
+        VM_CASE(OP_MOD):
             ARITHMETIC_OP(%, AS_INTEGRAL);
-            break;
-        case OP_BITWISE_AND:
+            VM_QUICKEN(OP_MOD_NUM);
+            VM_DISPATCH();
+        VM_CASE(OP_BITWISE_AND):
             ARITHMETIC_OP(&, AS_INTEGRAL);
-            break;
-        case OP_BITWISE_OR:
+            VM_DISPATCH();
+        VM_CASE(OP_BITWISE_OR):
             ARITHMETIC_OP(|, AS_INTEGRAL);
-            break;
-        case OP_BITWISE_NOT:
+            VM_DISPATCH();
+        VM_CASE(OP_BITWISE_NOT):
             UNARY_ARITHMETIC_OP(~, AS_INTEGRAL);
-            break;
-        case OP_LEFT_SHIFT:
+            VM_DISPATCH();
+        VM_CASE(OP_LEFT_SHIFT):
             ARITHMETIC_OP(<<, AS_INTEGRAL);
-            break;
-        case OP_RIGHT_SHIFT:
+            VM_DISPATCH();
+        VM_CASE(OP_RIGHT_SHIFT):
             ARITHMETIC_OP(>>, AS_INTEGRAL);
-            break;
-        case OP_EQUAL:
-            LOGICAL_OP(==);
-            break;
-        case OP_NOT_EQUAL:
-            LOGICAL_OP(!=);
-            break;
-        case OP_LT:
-            LOGICAL_OP(<);
-            break;
-        case OP_LTE:
-            LOGICAL_OP(<=);
-            break;
-        case OP_GT:
-            LOGICAL_OP(>);
-            break;
-        case OP_GTE:
-            LOGICAL_OP(>=);
-            break;
-        case OP_NOT:
+            VM_DISPATCH();
+        VM_CASE(OP_EQUAL):
+            LOGICAL_OP(==, OP_EQUAL_NUM);
+            VM_DISPATCH();
+        VM_CASE(OP_NOT_EQUAL):
+            LOGICAL_OP(!=, OP_NOT_EQUAL_NUM);
+            VM_DISPATCH();
+        VM_CASE(OP_LT):
+            LOGICAL_OP(<, OP_LT_NUM);
+            VM_DISPATCH();
+        VM_CASE(OP_LTE):
+            LOGICAL_OP(<=, OP_LTE_NUM);
+            VM_DISPATCH();
+        VM_CASE(OP_GT):
+            LOGICAL_OP(>, OP_GT_NUM);
+            VM_DISPATCH();
+        VM_CASE(OP_GTE):
+            LOGICAL_OP(>=, OP_GTE_NUM);
+            VM_DISPATCH();
+        VM_CASE(OP_NOT):
         {
             Value val = {0};
             VM_STACK_POP(val);
-            VM_STACK_PUSH(BOOL_VAL(is_falsey(val), val.row, val.col));
-            break;
+            VM_STACK_PUSH(BOOL_VAL(is_falsey(val)));
+            VM_DISPATCH();
         }
-        case OP_NEGATE:
+        VM_CASE(OP_NEGATE):
         {
             UNARY_ARITHMETIC_OP(-, AS_NUMBER);
-            break;
+            VM_DISPATCH();
         }
-        default:
+        VM_CASE(OP_INC_LOCAL):
+            LOCAL_CONSTANT_OP(+);
+            VM_DISPATCH();
+        VM_CASE(OP_DEC_LOCAL):
+            LOCAL_CONSTANT_OP(-);
+            VM_DISPATCH();
+        VM_CASE(OP_ADD_CONST):
+            CONSTANT_OP(+);
+            VM_DISPATCH();
+        VM_CASE(OP_SUBTRACT_CONST):
+            CONSTANT_OP(-);
+            VM_DISPATCH();
+        VM_CASE(OP_ADD_NUM):
+            NUMBER_OP(+, AS_NUMBER, NUMBER_VAL, OP_ADD);
+            VM_DISPATCH();
+        VM_CASE(OP_SUBTRACT_NUM):
+            NUMBER_OP(-, AS_NUMBER, NUMBER_VAL, OP_SUBTRACT);
+            VM_DISPATCH();
+        VM_CASE(OP_MULTIPLY_NUM):
+            NUMBER_OP(*, AS_NUMBER, NUMBER_VAL, OP_MULTIPLY);
+            VM_DISPATCH();
+        VM_CASE(OP_DIVIDE_NUM):
+            NUMBER_OP(/, AS_NUMBER, NUMBER_VAL, OP_DIVIDE);
+            VM_DISPATCH();
+        VM_CASE(OP_MOD_NUM):
+            NUMBER_OP(%, AS_INTEGRAL, NUMBER_VAL, OP_MOD);
+            VM_DISPATCH();
+        VM_CASE(OP_EQUAL_NUM):
+            NUMBER_OP(==, AS_NUMBER, BOOL_VAL, OP_EQUAL);
+            VM_DISPATCH();
+        VM_CASE(OP_NOT_EQUAL_NUM):
+            NUMBER_OP(!=, AS_NUMBER, BOOL_VAL, OP_NOT_EQUAL);
+            VM_DISPATCH();
+        VM_CASE(OP_LT_NUM):
+            NUMBER_OP(<, AS_NUMBER, BOOL_VAL, OP_LT);
+            VM_DISPATCH();
+        VM_CASE(OP_LTE_NUM):
+            NUMBER_OP(<=, AS_NUMBER, BOOL_VAL, OP_LTE);
+            VM_DISPATCH();
+        VM_CASE(OP_GT_NUM):
+            NUMBER_OP(>, AS_NUMBER, BOOL_VAL, OP_GT);
+            VM_DISPATCH();
+        VM_CASE(OP_GTE_NUM):
+            NUMBER_OP(>=, AS_NUMBER, BOOL_VAL, OP_GTE);
+            VM_DISPATCH();
+#ifdef VM_COMPUTED_GOTO
+        vm_record:
+            if (!jit_record(vm, frame))
+                dispatch = dispatch_table;
+            goto *dispatch_table[frame->ip[-1]];
+#endif
+        VM_DEFAULT:
             fprintf(stderr, "[ERROR] illegal instruction pointer(%zu)\n", (size_t)(frame->ip - VM_CURRENT_CHUNK_BASE) - 1);
             return VM_ILLEGAL_INSTRUCTION;
         }
@@ -464,10 +956,68 @@ VM_Error vm_interpret(VM *vm)
 #undef VM_READ_BYTE
 #undef VM_READ_CONSTANT
 #undef VM_READ_SHORT
+#undef VM_READ_UINT24
+#undef VM_READ_LONG
 #undef VM_READ_STRING
 #undef VM_STACK_PUSH
 #undef VM_STACK_POP
 #undef VM_TYPE_ERROR
 #undef VM_CURRENT_CHUNK_BASE
 #undef VM_CURRENT_CHUNK
+#undef VM_CASE
+#undef VM_DEFAULT
+#undef VM_SWITCH
+#undef VM_DISPATCH
+#undef VM_RECORDING
+#undef VM_LOOP_EDGE
+}
+/*
+ * runs the call the caller frame's OP_CALL makes with the callee below its
+ * arg_count arguments, until the callee returns. frame->ip must be past
+ * the instruction.
+ */
+VM_Error vm_invoke(VM *vm, CallFrame *frame, int arg_count)
+{
+    if (vm->frame_count == FRAMES_MAX)
+    {
+        vm->message = "maximum call depth reached";
+        return VM_STACK_OVERFLOW;
+    }
+    vm->stack.count = (size_t)(vm->sp - vm->stack.items);
+    Value callee = vm->sp[-1 - arg_count];
+    if (IS_FUNCTION(callee))
+    {
+        ObjFunction *function = AS_FUNCTION(callee);
+        if (arg_count != function->arity)
+            return vm_arity_error(vm, frame, function, arg_count);
+        CallFrame *call_frame = &vm->frames[vm->frame_count++];
+        call_frame->function = function;
+        call_frame->ip = function->chunk->items;
+        call_frame->slots = vm->sp - arg_count - 1;
+        if (jit_hot(vm->jit, function))
+            return jit_run(vm, call_frame);
+        return vm_run(vm, vm->frame_count - 1);
+    }
+    if (IS_NATIVE(callee))
+    {
+        Value result = AS_NATIVE(callee)->function(vm, vm->sp - arg_count);
+        if (vm->message)
+        {
+            vm_error_position(vm, frame);
+            return VM_TYPE_ERROR;
+        }
+        vm->sp -= arg_count + 1;
+        *vm->sp++ = result;
+        vm->stack.count = (size_t)(vm->sp - vm->stack.items);
+        if (vm->heap->pending)
+            gc_collect(vm->heap);
+        return VM_OK;
+    }
+    char *template = "Operand must be a type of \"Function\".But given type is \"%s\"";
+    char *given = value_typeof(callee);
+    char *message = calloc(strlen(template) + strlen(given) + 1, sizeof(char));
+    sprintf(message, template, given);
+    vm->message = message;
+    vm_error_position(vm, frame);
+    return VM_TYPE_ERROR;
 }
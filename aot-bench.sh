@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+# compares scripts compiled ahead of time to C against the interpreter running them
+# usage: ./aot-bench.sh [runs] [files...]
+runs=${1:-3}
+shift
+# every example but while.p, which never ends, 01.p is fib(40)
+files=${@:-$(ls examples/*.p | grep -v while.p)}
+program="compiled/fu.out"
+
+make -B lib BUILD=1 >/dev/null || exit 1
+make -B BUILD=1 >/dev/null || exit 1
+
+measure() {
+    local command=$1
+    local start=$(date +%s%N)
+    for ((i = 0; i < runs; i++)); do
+        $command >/dev/null 2>&1 </dev/null
+    done
+    local end=$(date +%s%N)
+    echo $(((end - start) / 1000000))
+}
+
+for file in $files; do
+    name=compiled/aot-$(basename $file .p)
+    rm -f $name.c
+    $program --emit-c=$name.c $file >/dev/null 2>&1
+    if [ ! -f $name.c ]; then
+        echo "$file does not compile, skipped"
+        continue
+    fi
+    cc -O2 -Iincludes $name.c compiled/libclox.a -pthread -o $name.out || exit 1
+    interpreted_ms=$(measure "$program --no-jit $file")
+    aot_ms=$(measure $name.out)
+    echo "$file ($runs runs)"
+    echo "    interpreted: ${interpreted_ms}ms"
+    echo "    aot:         ${aot_ms}ms"
+    awk -v a=$interpreted_ms -v b=$aot_ms 'BEGIN { if (b > 0) printf "    speedup:     %.2fx\n", a / b }'
+done
@@ -0,0 +1,408 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "aot.h"
+#include "bytecode.h"
+#include "native.h"
+
+define_array(AotFunctions, ObjFunction *);
+
+/* the functions in the order the image keeps them, the script first */
+static void aot_functions(Compiler *compiler, AotFunctions *functions)
+{
+    init_array(functions);
+    array_push(functions, compiler->function);
+    for (size_t i = 0; i < array_size(compiler->declarations); i++)
+    {
+        Value value = compiler_global_at(compiler, (int)i)->value;
+        if (IS_FUNCTION(value))
+            array_push(functions, AS_FUNCTION(value));
+    }
+}
+
+static size_t aot_operand(byte *code, size_t size)
+{
+    size_t operand = 0;
+    for (size_t i = 0; i < size; i++)
+        operand = operand << 8 | code[i];
+    return operand;
+}
+/* a numeric constant as a literal the C compiler can fold, read from the pool when it has none */
+static void aot_emit_number(ObjFunction *function, size_t index, FILE *out)
+{
+    Value value = array_at(function->values, index);
+    if (IS_NUMBER(value) && isfinite(AS_NUMBER(value)))
+        fprintf(out, "%a", AS_NUMBER(value));
+    else
+        fprintf(out, "AS_NUMBER(constants[%zu])", index);
+}
+static const char *aot_operator(byte instruction)
+{
+    switch (instruction)
+    {
+    case OP_SUBTRACT:
+    case OP_SUBTRACT_NUM:
+    case OP_NEGATE:
+        return "-";
+    case OP_MULTIPLY:
+    case OP_MULTIPLY_NUM:
+        return "*";
+    case OP_DIVIDE:
+    case OP_DIVIDE_NUM:
+        return "/";
+    case OP_MOD:
+    case OP_MOD_NUM:
+        return "%";
+    case OP_BITWISE_AND:
+        return "&";
+    case OP_BITWISE_OR:
+        return "|";
+    case OP_BITWISE_NOT:
+        return "~";
+    case OP_LEFT_SHIFT:
+        return "<<";
+    case OP_RIGHT_SHIFT:
+        return ">>";
+    case OP_EQUAL:
+    case OP_EQUAL_NUM:
+    case OP_JMP_IF_NOT_EQUAL:
+    case OP_JMP_IF_NOT_EQUAL_LONG:
+        return "==";
+    case OP_NOT_EQUAL:
+    case OP_NOT_EQUAL_NUM:
+    case OP_JMP_IF_NOT_NOT_EQUAL:
+    case OP_JMP_IF_NOT_NOT_EQUAL_LONG:
+        return "!=";
+    case OP_LT:
+    case OP_LT_NUM:
+    case OP_JMP_IF_NOT_LT:
+    case OP_JMP_IF_NOT_LT_LONG:
+        return "<";
+    case OP_LTE:
+    case OP_LTE_NUM:
+    case OP_JMP_IF_NOT_LTE:
+    case OP_JMP_IF_NOT_LTE_LONG:
+        return "<=";
+    case OP_GT:
+    case OP_GT_NUM:
+    case OP_JMP_IF_NOT_GT:
+    case OP_JMP_IF_NOT_GT_LONG:
+        return ">";
+    case OP_GTE:
+    case OP_GTE_NUM:
+    case OP_JMP_IF_NOT_GTE:
+    case OP_JMP_IF_NOT_GTE_LONG:
+        return ">=";
+    default:
+        return "+";
+    }
+}
+/* the template of the instruction at offset */
+static void aot_emit_instruction(ObjFunction *function, size_t offset, FILE *out)
+{
+    Chunk *chunk = function->chunk;
+    byte *code = chunk->items + offset;
+    byte instruction = code[0];
+    size_t next = offset + chunk_instruction_length(instruction);
+    size_t operand = aot_operand(code + 1, next - offset - 1);
+    const char *op = aot_operator(instruction);
+    fprintf(out, "    ");
+    switch (instruction)
+    {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+        if (IS_NUMBER(array_at(function->values, operand)))
+        {
+            fprintf(out, "AOT_NUMBER(");
+            aot_emit_number(function, operand, out);
+            fprintf(out, ");\n");
+        }
+        else
+            fprintf(out, "AOT_CONSTANT(%zu);\n", operand);
+        break;
+    case OP_GET_LOCAL:
+    case OP_GET_LOCAL_LONG:
+        fprintf(out, "AOT_GET_LOCAL(%zu);\n", operand);
+        break;
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_LONG:
+        fprintf(out, "AOT_SET_LOCAL(%zu);\n", operand);
+        break;
+    case OP_GET_GLOBAL:
+        fprintf(out, "AOT_GET_GLOBAL(%zu, %zu);\n", operand, offset);
+        break;
+    case OP_SET_GLOBAL:
+        fprintf(out, "AOT_SET_GLOBAL(%zu, %zu);\n", operand, offset);
+        break;
+    case OP_DEFINE_GLOBAL:
+        fprintf(out, "AOT_DEFINE_GLOBAL(%zu);\n", operand);
+        break;
+    case OP_POP:
+        fprintf(out, "AOT_POP();\n");
+        break;
+    case OP_DUP:
+        fprintf(out, "AOT_DUP();\n");
+        break;
+    case OP_NOT:
+        fprintf(out, "AOT_NOT();\n");
+        break;
+    case OP_PRINT:
+        fprintf(out, "AOT_PRINT();\n");
+        break;
+    case OP_ADD:
+    case OP_ADD_NUM:
+        fprintf(out, "AOT_ADD(%zu);\n", offset);
+        break;
+    case OP_SUBTRACT:
+    case OP_SUBTRACT_NUM:
+    case OP_MULTIPLY:
+    case OP_MULTIPLY_NUM:
+    case OP_DIVIDE:
+    case OP_DIVIDE_NUM:
+        fprintf(out, "AOT_ARITHMETIC(%s, AS_NUMBER, %zu);\n", op, offset);
+        break;
+    case OP_MOD:
+    case OP_MOD_NUM:
+    case OP_BITWISE_AND:
+    case OP_BITWISE_OR:
+    case OP_LEFT_SHIFT:
+    case OP_RIGHT_SHIFT:
+        fprintf(out, "AOT_ARITHMETIC(%s, AS_INTEGRAL, %zu);\n", op, offset);
+        break;
+    case OP_NEGATE:
+        fprintf(out, "AOT_UNARY(-, AS_NUMBER, %zu);\n", offset);
+        break;
+    case OP_BITWISE_NOT:
+        fprintf(out, "AOT_UNARY(~, AS_INTEGRAL, %zu);\n", offset);
+        break;
+    case OP_EQUAL:
+    case OP_EQUAL_NUM:
+    case OP_NOT_EQUAL:
+    case OP_NOT_EQUAL_NUM:
+    case OP_LT:
+    case OP_LT_NUM:
+    case OP_LTE:
+    case OP_LTE_NUM:
+    case OP_GT:
+    case OP_GT_NUM:
+    case OP_GTE:
+    case OP_GTE_NUM:
+        fprintf(out, "AOT_COMPARE(%s);\n", op);
+        break;
+    case OP_JMP:
+    case OP_JMP_LONG:
+    case OP_LOOP:
+    case OP_LOOP_LONG:
+        fprintf(out, "goto at_%zu;\n", chunk_jump_target(chunk, offset));
+        break;
+    case OP_JMP_IF_FALSE:
+    case OP_JMP_IF_FALSE_LONG:
+        fprintf(out, "AOT_JUMP_IF_FALSE(at_%zu);\n", chunk_jump_target(chunk, offset));
+        break;
+    case OP_JMP_IF_NOT_EQUAL:
+    case OP_JMP_IF_NOT_EQUAL_LONG:
+    case OP_JMP_IF_NOT_NOT_EQUAL:
+    case OP_JMP_IF_NOT_NOT_EQUAL_LONG:
+    case OP_JMP_IF_NOT_LT:
+    case OP_JMP_IF_NOT_LT_LONG:
+    case OP_JMP_IF_NOT_LTE:
+    case OP_JMP_IF_NOT_LTE_LONG:
+    case OP_JMP_IF_NOT_GT:
+    case OP_JMP_IF_NOT_GT_LONG:
+    case OP_JMP_IF_NOT_GTE:
+    case OP_JMP_IF_NOT_GTE_LONG:
+        fprintf(out, "AOT_JUMP_IF_NOT(%s, at_%zu);\n", op, chunk_jump_target(chunk, offset));
+        break;
+    case OP_INC_LOCAL:
+    case OP_DEC_LOCAL:
+        fprintf(out, "AOT_LOCAL_CONSTANT(%s, %d, ", instruction == OP_INC_LOCAL ? "+" : "-", code[1]);
+        aot_emit_number(function, code[2], out);
+        fprintf(out, ", %zu);\n", offset);
+        break;
+    case OP_ADD_CONST:
+    case OP_SUBTRACT_CONST:
+        fprintf(out, "AOT_CONSTANT_OP(%s, ", instruction == OP_ADD_CONST ? "+" : "-");
+        aot_emit_number(function, operand, out);
+        fprintf(out, ", %zu);\n", offset);
+        break;
+    case OP_CALL:
+        fprintf(out, "AOT_CALL(%zu, %zu);\n", operand, next);
+        break;
+    case OP_TAIL_CALL:
+        fprintf(out, "AOT_TAIL_CALL(%zu, %zu);\n", operand, next);
+        break;
+    case OP_RETURN:
+        fprintf(out, "AOT_RETURN();\n");
+        break;
+    default:
+        // the interpreter reports it
+        fprintf(out, "AOT_BAIL(%zu);\n", offset);
+        break;
+    }
+}
+/*
+ * native code is entered at the start of the function, or at a loop header
+ * when an interpreted frame moves back into it, see jit_loop
+ */
+static void aot_emit_function(ObjFunction *function, size_t index, FILE *out)
+{
+    Chunk *chunk = function->chunk;
+    size_t size = array_size(chunk);
+    bool *targets = calloc(size + 1, sizeof(bool));
+    bool *headers = calloc(size + 1, sizeof(bool));
+    for (size_t offset = 0; offset < size; offset += chunk_instruction_length(array_at(chunk, offset)))
+    {
+        byte instruction = array_at(chunk, offset);
+        if (!chunk_is_jump(instruction))
+            continue;
+        size_t target = chunk_jump_target(chunk, offset);
+        targets[target] = true;
+        headers[target] = headers[target] || instruction == OP_LOOP || instruction == OP_LOOP_LONG;
+    }
+
+    fprintf(out, "/* %s */\n", function->name == NULL ? "<script>" : function->name->chars);
+    fprintf(out, "static int clox_function_%zu(VM *vm, CallFrame *frame)\n{\n", index);
+    fprintf(out, "    AOT_PROLOGUE();\n");
+    fprintf(out, "    switch (frame->ip - code)\n    {\n    case 0:\n        break;\n");
+    for (size_t offset = 1; offset < size; offset++)
+        if (headers[offset])
+            fprintf(out, "    case %zu:\n        goto at_%zu;\n", offset, offset);
+    fprintf(out, "    default:\n        return JIT_BAIL;\n    }\n");
+    for (size_t offset = 0; offset < size; offset += chunk_instruction_length(array_at(chunk, offset)))
+    {
+        if (targets[offset])
+            fprintf(out, "at_%zu:\n", offset);
+        aot_emit_instruction(function, offset, out);
+    }
+    // the compiler ends every function with a return, running past it is what the interpreter would refuse too
+    if (targets[size])
+        fprintf(out, "at_%zu:\n", size);
+    fprintf(out, "    return VM_ILLEGAL_INSTRUCTION;\n}\n");
+    free(targets);
+    free(headers);
+}
+static void aot_emit_string(const char *chars, FILE *out)
+{
+    fputc('"', out);
+    for (; *chars != '\0'; chars++)
+    {
+        if (*chars == '"' || *chars == '\\')
+            fputc('\\', out);
+        fputc(*chars, out);
+    }
+    fputc('"', out);
+}
+bool aot_emit(Compiler *compiler, uint64_t source_hash, uint32_t flags, FILE *out)
+{
+    size_t size = 0;
+    char *image = bytecode_image(compiler, source_hash, flags, &size);
+    if (image == NULL)
+        return false;
+    AotFunctions functions;
+    aot_functions(compiler, &functions);
+
+    fprintf(out, "/* %s compiled ahead of time, see includes/aot.h */\n", compiler->file_path);
+#ifdef NAN_BOXING
+    fprintf(out, "#define NAN_BOXING\n");
+#endif
+    fprintf(out, "#include \"aot.h\"\n\n");
+    // as words, the image is read in place and has to be aligned like a mapped one
+    size_t words = (size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    fprintf(out, "static uint64_t image[%zu] = {", words);
+    for (size_t i = 0; i < words; i++)
+    {
+        uint64_t word = 0;
+        size_t length = size - i * sizeof(uint64_t) < sizeof(uint64_t) ? size - i * sizeof(uint64_t) : sizeof(uint64_t);
+        memcpy(&word, image + i * sizeof(uint64_t), length);
+        fprintf(out, "%s0x%016llx,", i % 4 == 0 ? "\n    " : " ", (unsigned long long)word);
+    }
+    fprintf(out, "\n};\n\n");
+    free(image);
+
+    for (size_t i = 0; i < array_size(&functions); i++)
+    {
+        aot_emit_function(array_at(&functions, i), i, out);
+        fprintf(out, "\n");
+    }
+    fprintf(out, "static JitCode functions[] = {");
+    for (size_t i = 0; i < array_size(&functions); i++)
+        fprintf(out, "%sclox_function_%zu,", i % 4 == 0 ? "\n    " : " ", i);
+    fprintf(out, "\n};\n\n");
+    fprintf(out, "static AotProgram program = {\n    .path = ");
+    aot_emit_string(compiler->file_path, out);
+    fprintf(out, ",\n    .image = image,\n    .size = %zu,\n", size);
+    fprintf(out, "    .source_hash = 0x%016llxull,\n    .flags = %u,\n", (unsigned long long)source_hash, flags);
+    fprintf(out, "    .functions = functions,\n    .function_count = %zu,\n};\n\n", array_size(&functions));
+    fprintf(out, "int main(void)\n{\n    return aot_main(&program);\n}\n");
+    array_free(&functions);
+    return !ferror(out);
+}
+
+int aot_main(AotProgram *program)
+{
+    Heap *heap = init_heap();
+    Compiler compiler = {0};
+    init_compiler(&compiler, TYPE_SCRIPT, heap);
+    compiler.file_path = program->path;
+    native_init(&compiler);
+    BytecodeImage image = {.base = (char *)program->image, .size = program->size};
+    AotFunctions functions = {0};
+    bool loaded = bytecode_load_image(&compiler, &image, program->source_hash, program->flags);
+    if (loaded)
+        aot_functions(&compiler, &functions);
+    if (!loaded || array_size(&functions) != program->function_count)
+    {
+        fprintf(stderr, "Error: %s was compiled against another build of the runtime\n", program->path);
+        array_free(&functions);
+        compiler_free(&compiler);
+        heap_free(heap);
+        return 1;
+    }
+    for (size_t i = 0; i < array_size(&functions); i++)
+        array_at(&functions, i)->code = (void *)program->functions[i];
+    array_free(&functions);
+
+    VM *vm = init_vm(&compiler, heap);
+    // everything is native already
+    vm_disable_jit(vm);
+    VM_Error error = vm_interpret(vm);
+    vm_report_error(vm, error, stderr);
+    compiler_free(&compiler);
+    vm_free(vm);
+    heap_free(heap);
+    return 0;
+}
+int aot_call(VM *vm, CallFrame *frame, int arg_count)
+{
+    Value callee = vm->sp[-1 - arg_count];
+    ObjFunction *function = IS_FUNCTION(callee) ? AS_FUNCTION(callee) : NULL;
+    // errors, natives and interpreted functions take the interpreter's way
+    if (function == NULL || function->code == NULL || function->arity != arg_count || vm->frame_count == FRAMES_MAX)
+        return vm_invoke(vm, frame, arg_count);
+    CallFrame *call_frame = &vm->frames[vm->frame_count++];
+    call_frame->function = function;
+    call_frame->ip = function->chunk->items;
+    call_frame->slots = vm->sp - arg_count - 1;
+    int status = ((JitCode)function->code)(vm, call_frame);
+    if (status == JIT_BAIL)
+        return vm_run(vm, vm->frame_count - 1);
+    if (status == JIT_RESTART)
+        return jit_run(vm, call_frame);
+    return status;
+}
+bool aot_concat(VM *vm, Value *sp)
+{
+    Value b = sp[-1];
+    Value a = sp[-2];
+    if (!IS_STRING(a) || !IS_STRING(b))
+        return false;
+    sp[-2] = OBJ_VAL(string_concat(vm->heap, AS_STRING(a), AS_STRING(b)));
+    vm->sp = sp - 1;
+    vm->stack.count = (size_t)(vm->sp - vm->stack.items);
+    // the new string is on the stack, the generated code holds no other object
+    if (vm->heap->pending)
+        gc_collect(vm->heap);
+    return true;
+}
@@ -0,0 +1,53 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+struct ArenaBlock
+{
+    ArenaBlock *next;
+    size_t size;
+};
+
+#define ARENA_HEADER ((sizeof(ArenaBlock) + 7) & ~(size_t)7)
+
+void *arena_allocate(Arena *arena, size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+    if (size > (size_t)(arena->end - arena->top))
+    {
+        // oversized requests get a block of their own, the current one stays open
+        size_t block_size = size > ARENA_BLOCK_SIZE - ARENA_HEADER ? size + ARENA_HEADER : ARENA_BLOCK_SIZE;
+        ArenaBlock *block = malloc(block_size);
+        assert(block != NULL && "cannot allocate memory");
+        block->size = block_size;
+        block->next = arena->blocks;
+        arena->blocks = block;
+        char *start = (char *)block + ARENA_HEADER;
+        if (block_size != ARENA_BLOCK_SIZE)
+            return memset(start, 0, size);
+        arena->top = start;
+        arena->end = (char *)block + block_size;
+    }
+    void *pointer = arena->top;
+    arena->top += size;
+    return memset(pointer, 0, size);
+}
+char *arena_strndup(Arena *arena, const char *chars, size_t length)
+{
+    char *copy = arena_allocate(arena, length + 1);
+    memcpy(copy, chars, length);
+    return copy;
+}
+void arena_free(Arena *arena)
+{
+    ArenaBlock *block = arena->blocks;
+    while (block != NULL)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+    arena->top = arena->end = NULL;
+}
@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "batch.h"
+#include "lexer.h"
+#include "parser.h"
+#include "AST.h"
+#include "compiler.h"
+#include "VM.h"
+#include "native.h"
+#include "optimizer.h"
+#include "gc.h"
+
+typedef struct
+{
+    char *path;
+    Compiler compiler;
+    Heap *heap; /* frozen once compiled, shared by the runs */
+    bool compiled;
+} BatchScript;
+
+typedef struct
+{
+    BatchScript *script;
+    size_t index; /* of its input set */
+    char *input;
+    char *output; /* what the run printed */
+    size_t output_size;
+    char *error; /* its error line, NULL when it ran fine */
+    double latency; /* ms */
+} BatchJob;
+
+define_array(BatchJobs, BatchJob);
+define_array(Latencies, double);
+
+typedef struct
+{
+    BatchJobs jobs;
+    atomic_size_t next; /* first job no worker took yet */
+    BatchOptions options;
+} Batch;
+
+static double batch_now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+static void batch_compile(BatchScript *script, char *source, bool optimize)
+{
+    script->heap = init_heap();
+    Compiler *compiler = &script->compiler;
+    init_compiler(compiler, TYPE_SCRIPT, script->heap);
+    compiler->file_path = script->path;
+    compiler->optimize = optimize;
+    native_init(compiler);
+
+    Lexer *lexer = init_lexer(source, script->path);
+    Arena arena = {0};
+    Parser *parser = init_parser(lexer, &arena);
+    AST *ast = parser_parse(parser);
+    bool had_error = parser->had_error;
+    if (!had_error)
+    {
+        ast = optimizer_fold(ast);
+        ast_to_byte(ast, compiler);
+        had_error = compiler->had_error;
+    }
+    if (!had_error)
+        compiler_end(compiler);
+    arena_free(&arena);
+    parser_free(parser);
+    lexer_free(lexer);
+    // the runs only read the program, their collections leave it alone
+    gc_freeze(script->heap);
+    script->compiled = !had_error;
+}
+
+static FILE *batch_open_output(BatchJob *job)
+{
+#ifdef _WIN32
+    (void)job;
+    return tmpfile();
+#else
+    return open_memstream(&job->output, &job->output_size);
+#endif
+}
+static void batch_close_output(BatchJob *job, FILE *out)
+{
+#ifndef _WIN32
+    (void)job;
+#else
+    long size = ftell(out);
+    job->output_size = size > 0 ? (size_t)size : 0;
+    job->output = malloc(job->output_size + 1);
+    rewind(out);
+    job->output_size = fread(job->output, 1, job->output_size, out);
+#endif
+    fclose(out);
+}
+
+static void batch_execute(Batch *batch, BatchJob *job)
+{
+    BatchScript *script = job->script;
+    if (!script->compiled)
+    {
+        const char *template = "%s CompileError the script did not compile";
+        job->error = malloc(strlen(template) + strlen(script->path) + 1);
+        sprintf(job->error, template, script->path);
+        return;
+    }
+    double start = batch_now_ms();
+    Heap *heap = init_heap();
+    if (batch->options.gc_growth > 1)
+        gc_set_growth_factor(heap, batch->options.gc_growth);
+    gc_set_concurrent(heap, batch->options.gc_concurrent);
+    VM *vm = init_vm(&script->compiler, heap);
+    vm_own_code(vm);
+    if (!batch->options.jit)
+        vm_disable_jit(vm);
+    vm->input = job->input;
+    FILE *out = batch_open_output(job);
+    if (out != NULL)
+        vm->out = out;
+
+    VM_Error error = vm_interpret(vm);
+    int length = vm_format_error(vm, error, NULL, 0);
+    if (length > 0)
+    {
+        job->error = malloc((size_t)length + 1);
+        vm_format_error(vm, error, job->error, (size_t)length + 1);
+    }
+    vm_free(vm);
+    heap_free(heap);
+    job->latency = batch_now_ms() - start;
+    if (out != NULL)
+        batch_close_output(job, out);
+}
+static void *batch_worker(void *arg)
+{
+    Batch *batch = arg;
+    for (;;)
+    {
+        size_t next = atomic_fetch_add(&batch->next, 1);
+        if (next >= array_size(&batch->jobs))
+            return NULL;
+        batch_execute(batch, &array_at(&batch->jobs, next));
+    }
+}
+
+static int batch_compare_latency(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+static double batch_percentile(Latencies *latencies, double percentile)
+{
+    size_t index = (size_t)(percentile / 100 * (array_size(latencies) - 1) + 0.5);
+    return array_at(latencies, index);
+}
+static void batch_report(Batch *batch, double elapsed, FILE *stream)
+{
+    Latencies latencies = {0};
+    init_array(&latencies);
+    for (size_t i = 0; i < array_size(&batch->jobs); i++)
+    {
+        BatchJob *job = &array_at(&batch->jobs, i);
+        if (job->input != NULL)
+            fprintf(stream, "batch: %s#%zu %.3fms %s\n", job->script->path, job->index + 1, job->latency, job->error == NULL ? "ok" : "error");
+        else
+            fprintf(stream, "batch: %s %.3fms %s\n", job->script->path, job->latency, job->error == NULL ? "ok" : "error");
+        array_push(&latencies, job->latency);
+    }
+    fprintf(stream, "batch: %zu runs on %d workers in %.1fms, %.1f runs/s\n",
+            array_size(&batch->jobs), batch->options.workers, elapsed, array_size(&batch->jobs) / (elapsed / 1e3));
+    if (array_size(&latencies) > 0)
+    {
+        qsort(latencies.items, array_size(&latencies), sizeof(double), batch_compare_latency);
+        fprintf(stream, "batch: latency p50 %.3fms p90 %.3fms p99 %.3fms max %.3fms\n",
+                batch_percentile(&latencies, 50), batch_percentile(&latencies, 90),
+                batch_percentile(&latencies, 99), batch_percentile(&latencies, 100));
+    }
+    array_free(&latencies);
+}
+
+int batch_run(char **paths, char **sources, size_t count, char *inputs, BatchOptions options)
+{
+    Batch batch = {0};
+    init_array(&batch.jobs);
+    atomic_init(&batch.next, 0);
+    batch.options = options;
+    if (batch.options.workers < 1)
+        batch.options.workers = 1;
+
+    BatchScript *scripts = calloc(count, sizeof(BatchScript));
+    for (size_t i = 0; i < count; i++)
+    {
+        scripts[i].path = paths[i];
+        batch_compile(&scripts[i], sources[i], options.optimize);
+        if (inputs == NULL)
+        {
+            BatchJob job = {.script = &scripts[i]};
+            array_push(&batch.jobs, job);
+        }
+    }
+    // one run per line, the lines are cut in place
+    for (char *line = inputs; count > 0 && line != NULL && *line != '\0';)
+    {
+        char *end = strchr(line, '\n');
+        if (end != NULL)
+            *end = '\0';
+        if (end != NULL && end > line && end[-1] == '\r')
+            end[-1] = '\0';
+        BatchJob job = {.script = &scripts[0], .index = array_size(&batch.jobs), .input = line};
+        array_push(&batch.jobs, job);
+        line = end != NULL ? end + 1 : NULL;
+    }
+
+    double start = batch_now_ms();
+    pthread_t *workers = calloc((size_t)batch.options.workers, sizeof(pthread_t));
+    for (int i = 0; i < batch.options.workers; i++)
+        pthread_create(&workers[i], NULL, batch_worker, &batch);
+    for (int i = 0; i < batch.options.workers; i++)
+        pthread_join(workers[i], NULL);
+    double elapsed = batch_now_ms() - start;
+    free(workers);
+
+    int status = 0;
+    for (size_t i = 0; i < array_size(&batch.jobs); i++)
+    {
+        BatchJob *job = &array_at(&batch.jobs, i);
+        if (job->output_size > 0)
+            fwrite(job->output, 1, job->output_size, stdout);
+        fflush(stdout);
+        if (job->error != NULL)
+        {
+            fprintf(stderr, "%s\n", job->error);
+            status = 1;
+        }
+        free(job->output);
+        free(job->error);
+    }
+    batch_report(&batch, elapsed, stderr);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        compiler_free(&scripts[i].compiler);
+        heap_free(scripts[i].heap);
+    }
+    free(scripts);
+    array_free(&batch.jobs);
+    return status;
+}
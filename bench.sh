@@ -0,0 +1,37 @@
+#!/usr/bin/env bash
+# compares the threaded (computed goto) interpreter loop against the switch fallback
+# usage: ./bench.sh [runs] [files...]
+runs=${1:-200}
+shift
+files=${@:-examples/00.p}
+program="compiled/fu.out"
+# both builds are kept outside the tree and removed on exit
+binaries=$(mktemp -d)
+trap 'rm -rf "$binaries"' EXIT
+
+build() {
+    make -B BUILD=1 "$@" >/dev/null || exit 1
+}
+
+measure() {
+    local binary=$1
+    local file=$2
+    local start=$(date +%s%N)
+    for ((i = 0; i < runs; i++)); do
+        $binary $file >/dev/null
+    done
+    local end=$(date +%s%N)
+    echo $(((end - start) / 1000000))
+}
+
+build SWITCH_DISPATCH=1 && cp $program $binaries/fu-switch.out
+build && cp $program $binaries/fu-threaded.out
+
+for file in $files; do
+    switch_ms=$(measure $binaries/fu-switch.out $file)
+    threaded_ms=$(measure $binaries/fu-threaded.out $file)
+    echo "$file ($runs runs)"
+    echo "    switch:   ${switch_ms}ms"
+    echo "    threaded: ${threaded_ms}ms"
+    awk -v a=$switch_ms -v b=$threaded_ms 'BEGIN { if (b > 0) printf "    speedup:  %.2fx\n", a / b }'
+done
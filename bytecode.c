@@ -0,0 +1,531 @@
+#include "bytecode.h"
+#include "table.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define BYTECODE_MAGIC "PBC"
+#define BYTECODE_BYTE_ORDER 0x01020304u
+#define BYTECODE_ALIGN(size) (((size) + 7) & ~(uint64_t)7)
+#define BYTECODE_NONE UINT32_MAX /* the script has no name */
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order; /* read back in another order on a machine that does not match */
+    uint32_t flags;
+    uint64_t source_hash;
+    uint64_t size; /* of the whole file, a short write does not match */
+    uint64_t image_hash; /* of everything past the header, code is trusted once it matches */
+    uint32_t position_size;
+    uint32_t string_count;
+    uint32_t global_count;
+    uint32_t function_count;
+    uint64_t strings;
+    uint64_t globals;
+    uint64_t functions;
+} BytecodeHeader;
+
+typedef struct
+{
+    uint64_t offset; /* of the chars, nul terminated */
+    uint64_t length;
+} BytecodeString;
+
+typedef enum
+{
+    BYTECODE_VARIABLE,
+    BYTECODE_FUNCTION,
+    BYTECODE_NATIVE,
+} BytecodeGlobalKind;
+
+/* one per declaration, in slot order */
+typedef struct
+{
+    uint32_t name;
+    uint32_t kind;
+    uint32_t function; /* index into the functions when kind is BYTECODE_FUNCTION */
+    uint32_t row;
+    uint32_t col;
+    uint32_t padding;
+} BytecodeGlobal;
+
+/* the script comes first, then every function in the order its global was declared */
+typedef struct
+{
+    uint32_t name;
+    int32_t arity;
+    uint32_t constant_count;
+    uint32_t position_count;
+    uint64_t constants;
+    uint64_t positions; /* Position runs as the chunk keeps them */
+    uint64_t code;
+    uint64_t code_size;
+} BytecodeFunction;
+
+typedef enum
+{
+    BYTECODE_NUMBER,
+    BYTECODE_STRING,
+    BYTECODE_TRUE,
+    BYTECODE_FALSE,
+    BYTECODE_NULL,
+} BytecodeConstantKind;
+
+typedef struct
+{
+    uint32_t kind;
+    uint32_t string;
+    double number;
+} BytecodeConstant;
+
+define_array(Buffer, char);
+define_array(Strings, ObjString *);
+define_array(Functions, ObjFunction *);
+
+/*FNV-1a hash function 64 bit*/
+uint64_t bytecode_hash(const char *source, size_t length)
+{
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)source[i];
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+/* script.p caches to script.pbc, any other name gets .pbc appended */
+char *bytecode_cache_path(const char *source_path)
+{
+    size_t length = strlen(source_path);
+    if (length > 2 && strcmp(source_path + length - 2, ".p") == 0)
+        length -= 2;
+    char *path = malloc(length + sizeof(".pbc"));
+    assert(path != NULL && "cannot allocate memory");
+    memcpy(path, source_path, length);
+    strcpy(path + length, ".pbc");
+    return path;
+}
+
+/* appends size bytes at the next 8 byte boundary, returns their offset */
+static uint64_t bytecode_emit(Buffer *buffer, const void *data, size_t size)
+{
+    size_t offset = BYTECODE_ALIGN(array_size(buffer));
+    size_t end = offset + size;
+    if (end > buffer->capacity)
+    {
+        while (end > buffer->capacity)
+            buffer->capacity = array_grow_capacity(buffer->capacity);
+        buffer->items = realloc(buffer->items, buffer->capacity);
+        assert(buffer->items != NULL && "cannot allocate memory");
+    }
+    memset(buffer->items + array_size(buffer), 0, offset - array_size(buffer));
+    if (size != 0)
+        memcpy(buffer->items + offset, data, size);
+    buffer->count = end;
+    return offset;
+}
+static uint32_t bytecode_string_index(Table *index, Strings *strings, ObjString *string)
+{
+    Value slot;
+    if (table_get(index, string, &slot))
+        return (uint32_t)AS_INTEGRAL(slot);
+    table_set(index, string, NUMBER_VAL(array_size(strings)));
+    array_push(strings, string);
+    return (uint32_t)(array_size(strings) - 1);
+}
+static bool bytecode_write_function(Buffer *buffer, BytecodeFunction *record, ObjFunction *function, Table *index, Strings *strings)
+{
+    Chunk *chunk = function->chunk;
+    Values *values = function->values;
+    BytecodeConstant *constants = calloc(array_size(values) + 1, sizeof(BytecodeConstant));
+    bool ok = true;
+    for (size_t i = 0; i < array_size(values); i++)
+    {
+        Value value = array_at(values, i);
+        switch (VALUE_TYPE(value))
+        {
+        case VAL_NUMBER:
+            constants[i].kind = BYTECODE_NUMBER;
+            constants[i].number = AS_NUMBER(value);
+            break;
+        case VAL_BOOL:
+            constants[i].kind = AS_BOOL(value) ? BYTECODE_TRUE : BYTECODE_FALSE;
+            break;
+        case VAL_NULL:
+            constants[i].kind = BYTECODE_NULL;
+            break;
+        case VAL_OBJ:
+            if (IS_STRING(value))
+            {
+                constants[i].kind = BYTECODE_STRING;
+                constants[i].string = bytecode_string_index(index, strings, AS_STRING(value));
+                break;
+            }
+            ok = false;
+            break;
+        default:
+            ok = false;
+            break;
+        }
+    }
+    record->name = function->name == NULL ? BYTECODE_NONE : bytecode_string_index(index, strings, function->name);
+    record->arity = function->arity;
+    record->constant_count = (uint32_t)array_size(values);
+    record->position_count = (uint32_t)array_size(&chunk->positions);
+    record->constants = bytecode_emit(buffer, constants, array_size(values) * sizeof(BytecodeConstant));
+    record->positions = bytecode_emit(buffer, chunk->positions.items, array_size(&chunk->positions) * sizeof(Position));
+    record->code = bytecode_emit(buffer, chunk->items, array_size(chunk));
+    record->code_size = array_size(chunk);
+    free(constants);
+    return ok;
+}
+char *bytecode_image(Compiler *compiler, uint64_t source_hash, uint32_t flags, size_t *size)
+{
+    Buffer buffer = {0};
+    Table *index = init_table();
+    Strings strings = {0};
+    Functions functions = {0};
+    BytecodeHeader header = {0};
+    bytecode_emit(&buffer, &header, sizeof(header));
+
+    size_t global_count = array_size(compiler->declarations);
+    BytecodeGlobal *globals = calloc(global_count + 1, sizeof(BytecodeGlobal));
+    array_push(&functions, compiler->function);
+    for (size_t i = 0; i < global_count; i++)
+    {
+        Declaration *declaration = compiler_global_at(compiler, (int)i);
+        BytecodeGlobal *global = &globals[i];
+        global->name = bytecode_string_index(index, &strings, declaration->name);
+        global->row = (uint32_t)declaration->row;
+        global->col = (uint32_t)declaration->col;
+        if (IS_FUNCTION(declaration->value))
+        {
+            global->kind = BYTECODE_FUNCTION;
+            global->function = (uint32_t)array_size(&functions);
+            array_push(&functions, AS_FUNCTION(declaration->value));
+        }
+        else
+            global->kind = IS_NATIVE(declaration->value) ? BYTECODE_NATIVE : BYTECODE_VARIABLE;
+    }
+
+    bool ok = true;
+    BytecodeFunction *records = calloc(array_size(&functions), sizeof(BytecodeFunction));
+    for (size_t i = 0; i < array_size(&functions); i++)
+        ok = bytecode_write_function(&buffer, &records[i], array_at(&functions, i), index, &strings) && ok;
+
+    BytecodeString *string_records = calloc(array_size(&strings) + 1, sizeof(BytecodeString));
+    for (size_t i = 0; i < array_size(&strings); i++)
+    {
+        ObjString *string = array_at(&strings, i);
+        string_records[i].offset = bytecode_emit(&buffer, string->chars, string->length + 1);
+        string_records[i].length = string->length;
+    }
+
+    memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+    header.version = BYTECODE_VERSION;
+    header.byte_order = BYTECODE_BYTE_ORDER;
+    header.flags = flags;
+    header.source_hash = source_hash;
+    header.position_size = sizeof(Position);
+    header.string_count = (uint32_t)array_size(&strings);
+    header.global_count = (uint32_t)global_count;
+    header.function_count = (uint32_t)array_size(&functions);
+    header.strings = bytecode_emit(&buffer, string_records, array_size(&strings) * sizeof(BytecodeString));
+    header.globals = bytecode_emit(&buffer, globals, global_count * sizeof(BytecodeGlobal));
+    header.functions = bytecode_emit(&buffer, records, array_size(&functions) * sizeof(BytecodeFunction));
+    header.size = array_size(&buffer);
+    header.image_hash = bytecode_hash(buffer.items + sizeof(header), header.size - sizeof(header));
+    memcpy(buffer.items, &header, sizeof(header));
+
+    free(string_records);
+    free(records);
+    free(globals);
+    array_free(&functions);
+    array_free(&strings);
+    table_free(index);
+    if (!ok)
+    {
+        array_free(&buffer);
+        return NULL;
+    }
+    *size = array_size(&buffer);
+    return buffer.items;
+}
+bool bytecode_write(Compiler *compiler, const char *path, uint64_t source_hash, uint32_t flags)
+{
+    size_t size = 0;
+    char *image = bytecode_image(compiler, source_hash, flags, &size);
+    if (image == NULL)
+        return false;
+    // written aside and renamed, a concurrent run never maps half a file
+    char *temporary = malloc(strlen(path) + sizeof(".tmp"));
+    assert(temporary != NULL && "cannot allocate memory");
+    strcpy(temporary, path);
+    strcat(temporary, ".tmp");
+    FILE *file = fopen(temporary, "wb");
+    bool ok = file != NULL;
+    if (ok)
+    {
+        ok = fwrite(image, 1, size, file) == size;
+        ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+        remove(path);
+#endif
+        ok = ok && rename(temporary, path) == 0;
+        if (!ok)
+            remove(temporary);
+    }
+    free(temporary);
+    free(image);
+    return ok;
+}
+
+static bool bytecode_map(BytecodeImage *image, const char *path)
+{
+#ifdef _WIN32
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+    bool ok = fseek(file, 0L, SEEK_END) == 0;
+    long size = ok ? ftell(file) : -1;
+    ok = size >= (long)sizeof(BytecodeHeader) && fseek(file, 0L, SEEK_SET) == 0;
+    char *base = ok ? malloc((size_t)size) : NULL;
+    ok = base != NULL && fread(base, 1, (size_t)size, file) == (size_t)size;
+    fclose(file);
+    if (!ok)
+    {
+        free(base);
+        return false;
+    }
+    image->base = base;
+    image->size = (size_t)size;
+    image->mapped = false;
+    return true;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(BytecodeHeader))
+    {
+        close(fd);
+        return false;
+    }
+    // private and writable, quickening rewrites the code in place
+    void *base = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return false;
+    image->base = base;
+    image->size = (size_t)info.st_size;
+    image->mapped = true;
+    return true;
+#endif
+}
+void bytecode_unload(BytecodeImage *image)
+{
+    if (image->base == NULL)
+        return;
+#ifndef _WIN32
+    if (image->mapped)
+        munmap(image->base, image->size);
+    else
+#endif
+        free(image->base);
+    image->base = NULL;
+    image->size = 0;
+}
+
+/* count records of size bytes at an 8 byte aligned offset, all inside the image */
+static bool bytecode_fits(BytecodeImage *image, uint64_t offset, uint64_t count, uint64_t size)
+{
+    return offset % 8 == 0 && offset <= image->size && count <= (image->size - offset) / size;
+}
+static char *bytecode_chars(BytecodeImage *image, uint32_t string)
+{
+    BytecodeHeader *header = (BytecodeHeader *)image->base;
+    return image->base + ((BytecodeString *)(image->base + header->strings))[string].offset;
+}
+/* everything is checked before the first object is made, a stale or broken file changes nothing */
+static bool bytecode_check(BytecodeImage *image, Compiler *compiler, uint64_t source_hash, uint32_t flags)
+{
+    BytecodeHeader *header = (BytecodeHeader *)image->base;
+    if (memcmp(header->magic, BYTECODE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != BYTECODE_VERSION ||
+        header->byte_order != BYTECODE_BYTE_ORDER ||
+        header->flags != flags ||
+        header->source_hash != source_hash ||
+        header->size != image->size ||
+        header->position_size != sizeof(Position) ||
+        header->image_hash != bytecode_hash(image->base + sizeof(BytecodeHeader), image->size - sizeof(BytecodeHeader)))
+        return false;
+    if (!bytecode_fits(image, header->strings, header->string_count, sizeof(BytecodeString)) ||
+        !bytecode_fits(image, header->globals, header->global_count, sizeof(BytecodeGlobal)) ||
+        !bytecode_fits(image, header->functions, header->function_count, sizeof(BytecodeFunction)) ||
+        header->function_count == 0 || header->global_count > UINT16_COUNT)
+        return false;
+
+    BytecodeString *strings = (BytecodeString *)(image->base + header->strings);
+    for (uint32_t i = 0; i < header->string_count; i++)
+        if (strings[i].offset >= image->size || strings[i].length >= image->size - strings[i].offset ||
+            image->base[strings[i].offset + strings[i].length] != '\0')
+            return false;
+
+    BytecodeFunction *functions = (BytecodeFunction *)(image->base + header->functions);
+    for (uint32_t i = 0; i < header->function_count; i++)
+    {
+        BytecodeFunction *function = &functions[i];
+        if ((i == 0) != (function->name == BYTECODE_NONE) ||
+            (i != 0 && function->name >= header->string_count) ||
+            !bytecode_fits(image, function->constants, function->constant_count, sizeof(BytecodeConstant)) ||
+            !bytecode_fits(image, function->positions, function->position_count, sizeof(Position)) ||
+            !bytecode_fits(image, function->code, function->code_size, 1) ||
+            function->code_size == 0)
+            return false;
+        BytecodeConstant *constants = (BytecodeConstant *)(image->base + function->constants);
+        for (uint32_t j = 0; j < function->constant_count; j++)
+            if (constants[j].kind > BYTECODE_NULL ||
+                (constants[j].kind == BYTECODE_STRING && constants[j].string >= header->string_count))
+                return false;
+    }
+
+    // the natives are declared already, they have to be in the slots the cache was compiled against
+    size_t natives = array_size(compiler->declarations);
+    if (header->global_count < natives)
+        return false;
+    BytecodeGlobal *globals = (BytecodeGlobal *)(image->base + header->globals);
+    for (uint32_t i = 0; i < header->global_count; i++)
+    {
+        BytecodeGlobal *global = &globals[i];
+        if (global->name >= header->string_count || global->kind > BYTECODE_NATIVE ||
+            (global->kind == BYTECODE_FUNCTION && (global->function == 0 || global->function >= header->function_count)))
+            return false;
+        if (i < natives)
+        {
+            if (global->kind == BYTECODE_VARIABLE ||
+                strcmp(bytecode_chars(image, global->name), compiler_global_at(compiler, (int)i)->name->chars) != 0)
+                return false;
+        }
+        else if (global->kind == BYTECODE_NATIVE)
+            return false;
+    }
+    return true;
+}
+static ObjString *bytecode_intern(Compiler *compiler, char *chars, size_t length)
+{
+    ObjString *interned = table_find_string(compiler->strings, chars);
+    if (interned != NULL)
+        return interned;
+    ObjString *string = new_string(compiler->heap, chars, length);
+    table_set(compiler->strings, string, NULL_VAL);
+    return string;
+}
+/* the blob holds the headers and the constants, code and positions stay in the image */
+static void bytecode_install(ObjFunction *function, BytecodeImage *image, BytecodeFunction *record, Compiler *compiler)
+{
+    BytecodeHeader *header = (BytecodeHeader *)image->base;
+    BytecodeString *strings = (BytecodeString *)(image->base + header->strings);
+    size_t size = BYTECODE_ALIGN(sizeof(Chunk)) + BYTECODE_ALIGN(sizeof(Values)) + record->constant_count * sizeof(Value);
+    char *blob = malloc(size);
+    assert(blob != NULL && "cannot allocate memory");
+    Chunk *chunk = (Chunk *)blob;
+    Values *values = (Values *)(blob + BYTECODE_ALIGN(sizeof(Chunk)));
+
+    chunk->items = (byte *)image->base + record->code;
+    chunk->count = chunk->capacity = record->code_size;
+    chunk->positions.items = (Position *)(image->base + record->positions);
+    chunk->positions.count = chunk->positions.capacity = record->position_count;
+    chunk->row = chunk->col = 0;
+    values->items = (Value *)((char *)values + BYTECODE_ALIGN(sizeof(Values)));
+    values->count = values->capacity = record->constant_count;
+
+    BytecodeConstant *constants = (BytecodeConstant *)(image->base + record->constants);
+    for (uint32_t i = 0; i < record->constant_count; i++)
+    {
+        BytecodeConstant constant = constants[i];
+        switch (constant.kind)
+        {
+        case BYTECODE_NUMBER:
+            values->items[i] = NUMBER_VAL(constant.number);
+            break;
+        case BYTECODE_STRING:
+            values->items[i] = OBJ_VAL(bytecode_intern(compiler, bytecode_chars(image, constant.string),
+                                                       strings[constant.string].length));
+            break;
+        case BYTECODE_TRUE:
+        case BYTECODE_FALSE:
+            values->items[i] = BOOL_VAL(constant.kind == BYTECODE_TRUE);
+            break;
+        default:
+            values->items[i] = NULL_VAL;
+            break;
+        }
+    }
+    function->arity = record->arity;
+    function->chunk = chunk;
+    function->values = values;
+    function->blob = blob;
+}
+bool bytecode_load(Compiler *compiler, BytecodeImage *image, const char *path, uint64_t source_hash, uint32_t flags)
+{
+    if (!bytecode_map(image, path))
+        return false;
+    if (!bytecode_load_image(compiler, image, source_hash, flags))
+    {
+        bytecode_unload(image);
+        return false;
+    }
+    return true;
+}
+bool bytecode_load_image(Compiler *compiler, BytecodeImage *image, uint64_t source_hash, uint32_t flags)
+{
+    if (image->size < sizeof(BytecodeHeader) || !bytecode_check(image, compiler, source_hash, flags))
+        return false;
+    BytecodeHeader *header = (BytecodeHeader *)image->base;
+    BytecodeString *strings = (BytecodeString *)(image->base + header->strings);
+    BytecodeFunction *records = (BytecodeFunction *)(image->base + header->functions);
+    BytecodeGlobal *globals = (BytecodeGlobal *)(image->base + header->globals);
+
+    ObjFunction **functions = calloc(header->function_count, sizeof(ObjFunction *));
+    // the script takes over the function the compiler started with
+    functions[0] = compiler->function;
+    chunk_free(compiler->function->chunk);
+    values_free(compiler->function->values);
+    for (uint32_t i = 1; i < header->function_count; i++)
+        functions[i] = ALLOCATE_OBJ(compiler->heap, ObjFunction, OBJ_FUNCTION);
+    for (uint32_t i = 0; i < header->function_count; i++)
+        bytecode_install(functions[i], image, &records[i], compiler);
+
+    size_t natives = array_size(compiler->declarations);
+    for (uint32_t i = 0; i < header->global_count; i++)
+    {
+        BytecodeGlobal *global = &globals[i];
+        ObjFunction *function = global->kind == BYTECODE_FUNCTION ? functions[global->function] : NULL;
+        if (i < natives)
+        {
+            // a function that shadows a native keeps the native's name and slot
+            Declaration *declaration = compiler_global_at(compiler, (int)i);
+            if (function == NULL)
+                continue;
+            function->name = declaration->name;
+            declaration->value = OBJ_VAL(function);
+            declaration->row = global->row;
+            declaration->col = global->col;
+            continue;
+        }
+        ObjString *name = new_string(compiler->heap, bytecode_chars(image, global->name), strings[global->name].length);
+        if (function != NULL)
+            function->name = name;
+        compiler_declare_global(compiler, name, global->row, global->col, function != NULL ? OBJ_VAL(function) : NULL_VAL);
+    }
+    free(functions);
+    return true;
+}
@@ -60,6 +60,18 @@ const char *chunk_byte_to_str(byte instruction)
         return "OP_GET_LOCAL";
     case OP_JMP_IF_FALSE:
         return "OP_JMP_IF_FALSE";
+    case OP_JMP_IF_NOT_EQUAL:
+        return "OP_JMP_IF_NOT_EQUAL";
+    case OP_JMP_IF_NOT_NOT_EQUAL:
+        return "OP_JMP_IF_NOT_NOT_EQUAL";
+    case OP_JMP_IF_NOT_LT:
+        return "OP_JMP_IF_NOT_LT";
+    case OP_JMP_IF_NOT_LTE:
+        return "OP_JMP_IF_NOT_LTE";
+    case OP_JMP_IF_NOT_GT:
+        return "OP_JMP_IF_NOT_GT";
+    case OP_JMP_IF_NOT_GTE:
+        return "OP_JMP_IF_NOT_GTE";
     case OP_JMP:
         return "OP_JMP";
     case OP_LOOP:
@@ -72,6 +84,62 @@ const char *chunk_byte_to_str(byte instruction)
         return "OP_DUP";
     case OP_CALL:
         return "OP_CALL";
+    case OP_TAIL_CALL:
+        return "OP_TAIL_CALL";
+    case OP_CONSTANT_LONG:
+        return "OP_CONSTANT_LONG";
+    case OP_GET_LOCAL_LONG:
+        return "OP_GET_LOCAL_LONG";
+    case OP_SET_LOCAL_LONG:
+        return "OP_SET_LOCAL_LONG";
+    case OP_JMP_IF_FALSE_LONG:
+        return "OP_JMP_IF_FALSE_LONG";
+    case OP_JMP_IF_NOT_EQUAL_LONG:
+        return "OP_JMP_IF_NOT_EQUAL_LONG";
+    case OP_JMP_IF_NOT_NOT_EQUAL_LONG:
+        return "OP_JMP_IF_NOT_NOT_EQUAL_LONG";
+    case OP_JMP_IF_NOT_LT_LONG:
+        return "OP_JMP_IF_NOT_LT_LONG";
+    case OP_JMP_IF_NOT_LTE_LONG:
+        return "OP_JMP_IF_NOT_LTE_LONG";
+    case OP_JMP_IF_NOT_GT_LONG:
+        return "OP_JMP_IF_NOT_GT_LONG";
+    case OP_JMP_IF_NOT_GTE_LONG:
+        return "OP_JMP_IF_NOT_GTE_LONG";
+    case OP_JMP_LONG:
+        return "OP_JMP_LONG";
+    case OP_LOOP_LONG:
+        return "OP_LOOP_LONG";
+    case OP_INC_LOCAL:
+        return "OP_INC_LOCAL";
+    case OP_DEC_LOCAL:
+        return "OP_DEC_LOCAL";
+    case OP_ADD_CONST:
+        return "OP_ADD_CONST";
+    case OP_SUBTRACT_CONST:
+        return "OP_SUBTRACT_CONST";
+    case OP_ADD_NUM:
+        return "OP_ADD_NUM";
+    case OP_SUBTRACT_NUM:
+        return "OP_SUBTRACT_NUM";
+    case OP_MULTIPLY_NUM:
+        return "OP_MULTIPLY_NUM";
+    case OP_DIVIDE_NUM:
+        return "OP_DIVIDE_NUM";
+    case OP_MOD_NUM:
+        return "OP_MOD_NUM";
+    case OP_EQUAL_NUM:
+        return "OP_EQUAL_NUM";
+    case OP_NOT_EQUAL_NUM:
+        return "OP_NOT_EQUAL_NUM";
+    case OP_LT_NUM:
+        return "OP_LT_NUM";
+    case OP_LTE_NUM:
+        return "OP_LTE_NUM";
+    case OP_GT_NUM:
+        return "OP_GT_NUM";
+    case OP_GTE_NUM:
+        return "OP_GTE_NUM";
     default:
         return "UNKNOWN";
     }
@@ -80,13 +148,47 @@ Chunk *init_chunk()
 {
     Chunk *chunk = calloc(1, sizeof(Chunk));
     init_array(chunk);
+    init_array(&chunk->positions);
     return chunk;
 }
 size_t chunk_push(Chunk *chunk, byte instruction)
 {
+    Positions *positions = &chunk->positions;
+    if (array_size(positions) == 0 ||
+        array_at(positions, array_size(positions) - 1).row != chunk->row ||
+        array_at(positions, array_size(positions) - 1).col != chunk->col)
+    {
+        Position position = {array_size(chunk), chunk->row, chunk->col};
+        array_push(positions, position);
+    }
     array_push(chunk, instruction);
     return array_size(chunk) - 1;
 }
+void chunk_set_position(Chunk *chunk, uint32_t row, uint32_t col)
+{
+    chunk->row = row;
+    chunk->col = col;
+}
+Position chunk_position_at(Chunk *chunk, size_t offset)
+{
+    Positions *positions = &chunk->positions;
+    Position position = {0};
+    size_t low = 0;
+    size_t high = array_size(positions);
+    // last run starting at or before offset
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (array_at(positions, mid).offset <= offset)
+        {
+            position = array_at(positions, mid);
+            low = mid + 1;
+        }
+        else
+            high = mid;
+    }
+    return position;
+}
 byte chunk_pop(Chunk *chunk)
 {
     return array_pop(chunk);
@@ -107,13 +209,23 @@ char *chunk_operand_type_to_str(OperandType type)
         return "%";
     case OPERAND_MEMORY:
         return "#";
+    case OPERAND_GLOBAL:
+        return "$";
     default:
         NOTREACHABLE;
     }
 }
-void chunk_print_operand(OperandType type, byte index, FILE *stream)
+/* operands wider than a byte are stored big endian */
+static size_t chunk_read_operand(Chunk *chunk, size_t offset, size_t width)
+{
+    size_t operand = 0;
+    for (size_t i = 0; i < width; i++)
+        operand = (operand << 8) | chunk_instruction_at(chunk, offset + i);
+    return operand;
+}
+void chunk_print_operand(OperandType type, size_t index, FILE *stream)
 {
-    fprintf(stream, "%s%u", chunk_operand_type_to_str(type), index);
+    fprintf(stream, "%s%zu", chunk_operand_type_to_str(type), index);
 }
 size_t chunk_print_instruction(Chunk *chunk, size_t offset, FILE *stream)
 {
@@ -122,15 +234,21 @@ size_t chunk_print_instruction(Chunk *chunk, size_t offset, FILE *stream)
     chunk_print_opcode(instruction, stream);
     switch (instruction)
     {
+    case OP_SET_LOCAL:
     case OP_GET_LOCAL:
     {
         chunk_print_operand(OPERAND_IMMEDIATE, chunk_instruction_at(chunk, ++offset), stream);
-        chunk_print_operand(OPERAND_MEMORY, chunk_instruction_at(chunk, ++offset), stream);
         break;
     }
     case OP_LOOP:
     case OP_JMP:
     case OP_JMP_IF_FALSE:
+    case OP_JMP_IF_NOT_EQUAL:
+    case OP_JMP_IF_NOT_NOT_EQUAL:
+    case OP_JMP_IF_NOT_LT:
+    case OP_JMP_IF_NOT_LTE:
+    case OP_JMP_IF_NOT_GT:
+    case OP_JMP_IF_NOT_GTE:
     {
         byte high_byte = chunk_instruction_at(chunk, ++offset);
         byte low_byte = chunk_instruction_at(chunk, ++offset);
@@ -138,16 +256,59 @@ size_t chunk_print_instruction(Chunk *chunk, size_t offset, FILE *stream)
         fprintf(stream, "&%04u", jmpOffset);
         break;
     }
-    case OP_CALL:
-    case OP_SET_LOCAL:
+    case OP_LOOP_LONG:
+    case OP_JMP_LONG:
+    case OP_JMP_IF_FALSE_LONG:
+    case OP_JMP_IF_NOT_EQUAL_LONG:
+    case OP_JMP_IF_NOT_NOT_EQUAL_LONG:
+    case OP_JMP_IF_NOT_LT_LONG:
+    case OP_JMP_IF_NOT_LTE_LONG:
+    case OP_JMP_IF_NOT_GT_LONG:
+    case OP_JMP_IF_NOT_GTE_LONG:
+    {
+        fprintf(stream, "&%04u", (unsigned)chunk_read_operand(chunk, offset + 1, 4));
+        offset += 4;
+        break;
+    }
+    case OP_GET_LOCAL_LONG:
+    case OP_SET_LOCAL_LONG:
+    {
+        chunk_print_operand(OPERAND_IMMEDIATE, chunk_read_operand(chunk, offset + 1, 2), stream);
+        offset += 2;
+        break;
+    }
+    case OP_CONSTANT_LONG:
+    {
+        chunk_print_operand(OPERAND_MEMORY, chunk_read_operand(chunk, offset + 1, 3), stream);
+        offset += 3;
+        break;
+    }
     case OP_SET_GLOBAL:
     case OP_GET_GLOBAL:
     case OP_DEFINE_GLOBAL:
+    {
+        byte high_byte = chunk_instruction_at(chunk, ++offset);
+        byte low_byte = chunk_instruction_at(chunk, ++offset);
+        chunk_print_operand(OPERAND_GLOBAL, (size_t)((high_byte << 8) | low_byte), stream);
+        break;
+    }
+    case OP_CALL:
+    case OP_TAIL_CALL:
     case OP_CONSTANT:
+    case OP_ADD_CONST:
+    case OP_SUBTRACT_CONST:
     {
         chunk_print_operand(OPERAND_MEMORY, chunk_instruction_at(chunk, ++offset), stream);
         break;
     }
+    case OP_INC_LOCAL:
+    case OP_DEC_LOCAL:
+    {
+        chunk_print_operand(OPERAND_IMMEDIATE, chunk_instruction_at(chunk, ++offset), stream);
+        fprintf(stream, " ");
+        chunk_print_operand(OPERAND_MEMORY, chunk_instruction_at(chunk, ++offset), stream);
+        break;
+    }
     default:
         break;
     }
@@ -155,6 +316,124 @@ size_t chunk_print_instruction(Chunk *chunk, size_t offset, FILE *stream)
     return ++offset;
 }
 
+size_t chunk_instruction_length(byte instruction)
+{
+    switch (instruction)
+    {
+    case OP_SET_LOCAL:
+    case OP_GET_LOCAL:
+    case OP_CALL:
+    case OP_TAIL_CALL:
+    case OP_CONSTANT:
+    case OP_ADD_CONST:
+    case OP_SUBTRACT_CONST:
+        return 2;
+    case OP_LOOP:
+    case OP_JMP:
+    case OP_JMP_IF_FALSE:
+    case OP_JMP_IF_NOT_EQUAL:
+    case OP_JMP_IF_NOT_NOT_EQUAL:
+    case OP_JMP_IF_NOT_LT:
+    case OP_JMP_IF_NOT_LTE:
+    case OP_JMP_IF_NOT_GT:
+    case OP_JMP_IF_NOT_GTE:
+    case OP_SET_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_INC_LOCAL:
+    case OP_DEC_LOCAL:
+    case OP_GET_LOCAL_LONG:
+    case OP_SET_LOCAL_LONG:
+        return 3;
+    case OP_CONSTANT_LONG:
+        return 4;
+    case OP_LOOP_LONG:
+    case OP_JMP_LONG:
+    case OP_JMP_IF_FALSE_LONG:
+    case OP_JMP_IF_NOT_EQUAL_LONG:
+    case OP_JMP_IF_NOT_NOT_EQUAL_LONG:
+    case OP_JMP_IF_NOT_LT_LONG:
+    case OP_JMP_IF_NOT_LTE_LONG:
+    case OP_JMP_IF_NOT_GT_LONG:
+    case OP_JMP_IF_NOT_GTE_LONG:
+        return 5;
+    default:
+        return 1;
+    }
+}
+bool chunk_is_jump(byte instruction)
+{
+    switch (instruction)
+    {
+    case OP_LOOP:
+    case OP_JMP:
+    case OP_JMP_IF_FALSE:
+    case OP_JMP_IF_NOT_EQUAL:
+    case OP_JMP_IF_NOT_NOT_EQUAL:
+    case OP_JMP_IF_NOT_LT:
+    case OP_JMP_IF_NOT_LTE:
+    case OP_JMP_IF_NOT_GT:
+    case OP_JMP_IF_NOT_GTE:
+    case OP_LOOP_LONG:
+    case OP_JMP_LONG:
+    case OP_JMP_IF_FALSE_LONG:
+    case OP_JMP_IF_NOT_EQUAL_LONG:
+    case OP_JMP_IF_NOT_NOT_EQUAL_LONG:
+    case OP_JMP_IF_NOT_LT_LONG:
+    case OP_JMP_IF_NOT_LTE_LONG:
+    case OP_JMP_IF_NOT_GT_LONG:
+    case OP_JMP_IF_NOT_GTE_LONG:
+        return true;
+    default:
+        return false;
+    }
+}
+byte chunk_long_jump(byte instruction)
+{
+    switch (instruction)
+    {
+    case OP_LOOP:
+        return OP_LOOP_LONG;
+    case OP_JMP:
+        return OP_JMP_LONG;
+    case OP_JMP_IF_FALSE:
+        return OP_JMP_IF_FALSE_LONG;
+    case OP_JMP_IF_NOT_EQUAL:
+        return OP_JMP_IF_NOT_EQUAL_LONG;
+    case OP_JMP_IF_NOT_NOT_EQUAL:
+        return OP_JMP_IF_NOT_NOT_EQUAL_LONG;
+    case OP_JMP_IF_NOT_LT:
+        return OP_JMP_IF_NOT_LT_LONG;
+    case OP_JMP_IF_NOT_LTE:
+        return OP_JMP_IF_NOT_LTE_LONG;
+    case OP_JMP_IF_NOT_GT:
+        return OP_JMP_IF_NOT_GT_LONG;
+    case OP_JMP_IF_NOT_GTE:
+        return OP_JMP_IF_NOT_GTE_LONG;
+    default:
+        // already wide, or not a jump at all
+        return instruction;
+    }
+}
+/* loops jump backwards relative to the end of the instruction, every other jump is absolute */
+size_t chunk_jump_target(Chunk *chunk, size_t offset)
+{
+    byte instruction = array_at(chunk, offset);
+    size_t length = chunk_instruction_length(instruction);
+    size_t operand = chunk_read_operand(chunk, offset + 1, length - 1);
+    if (instruction == OP_LOOP || instruction == OP_LOOP_LONG)
+        return offset + length - operand;
+    return operand;
+}
+void chunk_patch_jump(Chunk *chunk, size_t offset, size_t target)
+{
+    byte instruction = array_at(chunk, offset);
+    size_t length = chunk_instruction_length(instruction);
+    size_t operand = instruction == OP_LOOP || instruction == OP_LOOP_LONG ? offset + length - target : target;
+    for (size_t i = length - 1; i > 0; i--, operand >>= 8)
+        array_at(chunk, offset + i) = operand & 0xff;
+}
+
 void chunk_dump(Chunk *chunk, FILE *stream)
 {
     for (size_t offset = 0; offset < array_size(chunk);)
@@ -165,6 +444,7 @@ void chunk_dump(Chunk *chunk, FILE *stream)
 
 void chunk_free(Chunk *chunk)
 {
+    array_free(&chunk->positions);
     array_free(chunk);
     free(chunk);
 }
\ No newline at end of file
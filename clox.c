@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "clox.h"
+#include "lexer.h"
+#include "parser.h"
+#include "AST.h"
+#include "compiler.h"
+#include "VM.h"
+#include "native.h"
+#include "optimizer.h"
+#include "gc.h"
+
+typedef struct
+{
+    char *name;
+    int arity;
+    CloxNative function;
+    void *data;
+} CloxNativeBinding;
+
+define_array(CloxNativeBindings, CloxNativeBinding);
+
+struct CloxProgram
+{
+    Compiler compiler;
+    bool compiled;
+    char *name;
+    CloxNativeBindings natives;
+    Heap *heap; /* frozen once compiled, VMs only read it */
+};
+
+struct CloxVM
+{
+    CloxProgram *program;
+    VM *vm;
+    Heap *heap;
+    char *error;
+    char *result; /* backs the last string result */
+};
+
+static char *clox_strdup(const char *chars)
+{
+    size_t length = strlen(chars);
+    char *copy = malloc(length + 1);
+    memcpy(copy, chars, length + 1);
+    return copy;
+}
+
+CloxValue clox_null(void)
+{
+    return (CloxValue){.type = CLOX_NULL};
+}
+CloxValue clox_bool(bool boolean)
+{
+    return (CloxValue){.type = CLOX_BOOL, .as.boolean = boolean};
+}
+CloxValue clox_number(double number)
+{
+    return (CloxValue){.type = CLOX_NUMBER, .as.number = number};
+}
+CloxValue clox_string(const char *string)
+{
+    return (CloxValue){.type = CLOX_STRING, .as.string = string};
+}
+
+/* the returned string points into the object, it lives as long as value is reachable */
+static CloxValue clox_from_value(Value value)
+{
+    if (IS_BOOL(value))
+        return clox_bool(AS_BOOL(value));
+    if (IS_NUMBER(value))
+        return clox_number(AS_NUMBER(value));
+    if (IS_STRING(value))
+        return clox_string(AS_CSTRING(value));
+    if (IS_FUNCTION(value) || IS_NATIVE(value))
+    {
+        ObjString *name = IS_FUNCTION(value) ? AS_FUNCTION(value)->name : AS_NATIVE(value)->name;
+        return (CloxValue){.type = CLOX_FUNCTION, .as.string = name == NULL ? "" : name->chars};
+    }
+    return clox_null();
+}
+/* strings become young objects, only call this where the VM cannot collect */
+static Value clox_to_value(Heap *heap, CloxValue value)
+{
+    switch (value.type)
+    {
+    case CLOX_BOOL:
+        return BOOL_VAL(value.as.boolean);
+    case CLOX_NUMBER:
+        return NUMBER_VAL(value.as.number);
+    case CLOX_STRING:
+        return OBJ_VAL(new_string(heap, (char *)value.as.string, strlen(value.as.string)));
+    default:
+        return NULL_VAL;
+    }
+}
+
+/* every embedder native shares this function, the binding hangs off the callee below args */
+static Value clox_native_call(VM *vm, Value *args)
+{
+    ObjNative *native = AS_NATIVE(args[-1]);
+    CloxNativeBinding *binding = native->data;
+    CloxValue converted[UINT8_COUNT];
+    for (int i = 0; i < binding->arity; i++)
+        converted[i] = clox_from_value(args[i]);
+    return clox_to_value(vm->heap, binding->function(binding->data, binding->arity, converted));
+}
+
+CloxProgram *clox_program_new(void)
+{
+    CloxProgram *program = calloc(1, sizeof(CloxProgram));
+    init_array(&program->natives);
+    return program;
+}
+bool clox_program_native(CloxProgram *program, const char *name, int arity, CloxNative function, void *data)
+{
+    if (program->compiled || arity < 0 || arity >= UINT8_COUNT)
+        return false;
+    for (size_t i = 0; i < array_size(&program->natives); i++)
+    {
+        if (strcmp(array_at(&program->natives, i).name, name) == 0)
+            return false;
+    }
+    CloxNativeBinding binding = {clox_strdup(name), arity, function, data};
+    array_push(&program->natives, binding);
+    return true;
+}
+CloxResult clox_program_compile(CloxProgram *program, const char *source, const char *name, bool optimize)
+{
+    if (program->compiled)
+        return CLOX_COMPILE_ERROR;
+    free(program->name);
+    program->name = clox_strdup(name);
+    char *copy = clox_strdup(source);
+
+    program->heap = init_heap();
+    Compiler *compiler = &program->compiler;
+    init_compiler(compiler, TYPE_SCRIPT, program->heap);
+    compiler->file_path = program->name;
+    compiler->optimize = optimize;
+    native_init(compiler);
+    // declared after the builtins, so a binding of the same name shadows one
+    for (size_t i = 0; i < array_size(&program->natives); i++)
+    {
+        CloxNativeBinding *binding = &array_at(&program->natives, i);
+        ObjNative *native = new_native(program->heap, clox_native_call, binding->arity);
+        native->name = new_string(program->heap, binding->name, strlen(binding->name));
+        native->data = binding;
+        compiler_declare_global(compiler, native->name, 0, 0, OBJ_VAL(native));
+    }
+
+    Lexer *lexer = init_lexer(copy, program->name);
+    Arena arena = {0};
+    Parser *parser = init_parser(lexer, &arena);
+    AST *ast = parser_parse(parser);
+    bool had_error = parser->had_error;
+    if (!had_error)
+    {
+        ast = optimizer_fold(ast);
+        ast_to_byte(ast, compiler);
+        had_error = compiler->had_error;
+    }
+    if (!had_error)
+        compiler_end(compiler);
+    arena_free(&arena);
+    parser_free(parser);
+    lexer_free(lexer);
+    free(copy);
+
+    if (had_error)
+    {
+        compiler_free(compiler);
+        heap_free(program->heap);
+        program->heap = NULL;
+        return CLOX_COMPILE_ERROR;
+    }
+    // shared by every VM from here on, their collections leave it alone
+    gc_freeze(program->heap);
+    program->compiled = true;
+    return CLOX_OK;
+}
+void clox_program_free(CloxProgram *program)
+{
+    if (program->compiled)
+    {
+        compiler_free(&program->compiler);
+        heap_free(program->heap);
+    }
+    for (size_t i = 0; i < array_size(&program->natives); i++)
+        free(array_at(&program->natives, i).name);
+    array_free(&program->natives);
+    free(program->name);
+    free(program);
+}
+
+CloxVM *clox_vm_new(CloxProgram *program)
+{
+    if (!program->compiled)
+        return NULL;
+    CloxVM *vm = calloc(1, sizeof(CloxVM));
+    vm->program = program;
+    vm->heap = init_heap();
+    vm->vm = init_vm(&program->compiler, vm->heap);
+    vm_own_code(vm->vm);
+    return vm;
+}
+static CloxResult clox_vm_finish(CloxVM *vm, VM_Error error)
+{
+    free(vm->error);
+    vm->error = NULL;
+    if (error == VM_OK)
+        return CLOX_OK;
+    int length = vm_format_error(vm->vm, error, NULL, 0);
+    vm->error = malloc((size_t)length + 1);
+    vm_format_error(vm->vm, error, vm->error, (size_t)length + 1);
+    return CLOX_RUNTIME_ERROR;
+}
+CloxResult clox_vm_run(CloxVM *vm)
+{
+    return clox_vm_finish(vm, vm_call(vm->vm, vm->vm->stack.items[0], 0, NULL));
+}
+CloxResult clox_vm_call(CloxVM *vm, const char *name, int arg_count, const CloxValue *args, CloxValue *result)
+{
+    if (arg_count < 0 || arg_count >= UINT8_COUNT)
+    {
+        vm->vm->row = vm->vm->col = 0;
+        vm->vm->message = "wrong number of arguments";
+        return clox_vm_finish(vm, VM_TOO_MANY_ARGUMENTS);
+    }
+    int slot = compiler_resolve_global(&vm->program->compiler, (char *)name);
+    Value callee = slot < 0 ? UNDEF_VAL : array_at(vm->vm->globals, slot);
+    if (IS_UNDEF(callee))
+    {
+        vm->vm->row = vm->vm->col = 0;
+        vm->vm->message = "global is not defined";
+        return clox_vm_finish(vm, VM_REFERENCE_ERROR);
+    }
+    Value values[UINT8_COUNT];
+    for (int i = 0; i < arg_count; i++)
+        values[i] = clox_to_value(vm->heap, args[i]);
+    CloxResult status = clox_vm_finish(vm, vm_call(vm->vm, callee, arg_count, values));
+    if (result != NULL)
+    {
+        *result = status == CLOX_OK ? clox_from_value(vm->vm->result) : clox_null();
+        // the object may be collected by the next call, keep a copy of its chars
+        if (result->type == CLOX_STRING || result->type == CLOX_FUNCTION)
+        {
+            free(vm->result);
+            vm->result = clox_strdup(result->as.string);
+            result->as.string = vm->result;
+        }
+    }
+    return status;
+}
+const char *clox_vm_error(CloxVM *vm)
+{
+    return vm->error == NULL ? "" : vm->error;
+}
+void clox_vm_free(CloxVM *vm)
+{
+    vm_free(vm->vm);
+    heap_free(vm->heap);
+    free(vm->error);
+    free(vm->result);
+    free(vm);
+}
@@ -1,43 +1,217 @@
 #include "compiler.h"
+#include "optimizer.h"
 #include <stdlib.h>
+#include <string.h>
 
+static void compiler_free_scopes(Compiler *compiler)
+{
+    array_free(&compiler->locals);
+    init_array(&compiler->locals);
+    array_free(&compiler->breaks);
+    init_array(&compiler->breaks);
+    array_free(&compiler->continues);
+    init_array(&compiler->continues);
+    array_free(&compiler->far_jumps);
+    init_array(&compiler->far_jumps);
+}
 void compiler_free(Compiler *compiler)
 {
     table_free(compiler->strings);
     table_free(compiler->globals);
-    table_free(compiler->variables);
+    array_free(compiler->declarations);
+    free(compiler->declarations);
+    array_free(&compiler->constants);
+    init_array(&compiler->constants);
+    compiler_free_scopes(compiler);
 }
-void init_compiler(Compiler *compiler, FunctionType type)
+void init_compiler(Compiler *compiler, FunctionType type, Heap *heap)
 {
-    compiler->function = new_function();
+    compiler->heap = heap;
+    compiler->function = new_function(heap);
     compiler->type = type;
-    compiler->local_count = 0;
+    init_array(&compiler->constants);
+    init_array(&compiler->locals);
+    init_array(&compiler->breaks);
+    init_array(&compiler->continues);
+    init_array(&compiler->far_jumps);
 
     if (type == TYPE_SCRIPT)
     {
         compiler->strings = init_table();
         compiler->globals = init_table();
-        compiler->variables = init_table();
+        compiler->declarations = calloc(1, sizeof(Declarations));
+        init_array(compiler->declarations);
     }
-    Local *local = &compiler->locals[compiler->local_count++];
-    local->depth = 0;
-    local->name.start = "";
-    local->name.length = 0;
+    Local local = {0};
+    local.name.start = "";
+    array_push(&compiler->locals, local);
+}
+/*
+ * rewrites every jump of the function into its wide form, jumps only grow so
+ * the targets are remapped the way the optimizer does it. the far jumps carry
+ * the targets their short operands could not hold.
+ */
+static void compiler_widen_jumps(Compiler *compiler)
+{
+    Chunk *chunk = compiler->function->chunk;
+    size_t count = array_size(chunk);
+    size_t *targets = calloc(count + 1, sizeof(size_t));
+    for (size_t offset = 0; offset < count; offset += chunk_instruction_length(array_at(chunk, offset)))
+        if (chunk_is_jump(array_at(chunk, offset)))
+            targets[offset] = chunk_jump_target(chunk, offset);
+    for (size_t i = 0; i < array_size(&compiler->far_jumps); i++)
+        targets[array_at(&compiler->far_jumps, i).offset] = array_at(&compiler->far_jumps, i).target;
+
+    Chunk *widened = init_chunk();
+    size_t *map = calloc(count + 1, sizeof(size_t)); /* old offset -> new offset */
+    for (size_t offset = 0; offset < count;)
+    {
+        map[offset] = array_size(widened);
+        byte instruction = array_at(chunk, offset);
+        size_t length = chunk_instruction_length(instruction);
+        Position position = chunk_position_at(chunk, offset);
+        chunk_set_position(widened, position.row, position.col);
+        if (chunk_is_jump(instruction))
+        {
+            byte wide = chunk_long_jump(instruction);
+            chunk_push(widened, wide);
+            for (size_t i = 1; i < chunk_instruction_length(wide); i++)
+                chunk_push(widened, 0);
+        }
+        else
+            for (size_t i = 0; i < length; i++)
+                chunk_push(widened, array_at(chunk, offset + i));
+        offset += length;
+    }
+    map[count] = array_size(widened);
+    for (size_t offset = 0; offset < count; offset += chunk_instruction_length(array_at(chunk, offset)))
+        if (chunk_is_jump(array_at(chunk, offset)))
+            chunk_patch_jump(widened, map[offset], map[targets[offset]]);
+
+    free(map);
+    free(targets);
+    chunk_free(chunk);
+    compiler->function->chunk = widened;
 }
 
 ObjFunction *compiler_end(Compiler *compiler)
 {
     chunk_push(compiler->function->chunk, OP_RETURN);
+    if (array_size(&compiler->far_jumps) > 0)
+        compiler_widen_jumps(compiler);
+    if (compiler->optimize && !compiler->had_error)
+        optimizer_optimize(compiler->function);
+    function_finalize(compiler->function);
+    array_free(&compiler->constants);
+    init_array(&compiler->constants);
+    compiler_free_scopes(compiler);
     ObjFunction *entry = compiler->function;
     return entry;
 }
 
+/* constants match bit for bit, 0 and -0 stay apart and a NaN matches itself */
+static bool compiler_same_constant(Value a, Value b)
+{
+    if (VALUE_TYPE(a) != VALUE_TYPE(b))
+        return false;
+    switch (VALUE_TYPE(a))
+    {
+    case VAL_NUMBER:
+    {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+    case VAL_BOOL:
+        return AS_BOOL(a) == AS_BOOL(b);
+    case VAL_OBJ:
+        // string literals are interned by the compiler
+        return AS_OBJ(a) == AS_OBJ(b);
+    default:
+        return true;
+    }
+}
+static uint32_t compiler_hash_constant(Value value)
+{
+    uint64_t bits = 0;
+    switch (VALUE_TYPE(value))
+    {
+    case VAL_NUMBER:
+    {
+        double number = AS_NUMBER(value);
+        memcpy(&bits, &number, sizeof(double));
+        break;
+    }
+    case VAL_BOOL:
+        bits = AS_BOOL(value) ? 2 : 1;
+        break;
+    case VAL_OBJ:
+        bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+        break;
+    default:
+        break;
+    }
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+static void compiler_index_constant(ConstantIndex *index, Value value, int32_t slot)
+{
+    size_t i = compiler_hash_constant(value) & (index->capacity - 1);
+    while (array_at(index, i) != -1)
+        i = (i + 1) & (index->capacity - 1);
+    array_at(index, i) = slot;
+    index->count++;
+}
+static void compiler_grow_constants(Compiler *compiler)
+{
+    ConstantIndex *index = &compiler->constants;
+    Values *values = compiler->function->values;
+    array_free(index);
+    index->capacity = index->capacity == 0 ? ARRAY_INITIAL_CAPACITY * 2 : index->capacity * 2;
+    index->items = malloc(index->capacity * sizeof(int32_t));
+    memset(index->items, -1, index->capacity * sizeof(int32_t));
+    index->count = 0;
+    for (size_t i = 0; i < array_size(values); i++)
+        compiler_index_constant(index, array_at(values, i), (int32_t)i);
+}
+uint32_t compiler_add_constant(Compiler *compiler, Value value)
+{
+    ConstantIndex *index = &compiler->constants;
+    Values *values = compiler->function->values;
+    if ((index->count + 1) * 2 > index->capacity)
+        compiler_grow_constants(compiler);
+
+    size_t i = compiler_hash_constant(value) & (index->capacity - 1);
+    while (array_at(index, i) != -1)
+    {
+        int32_t slot = array_at(index, i);
+        if (compiler_same_constant(array_at(values, slot), value))
+            return (uint32_t)slot;
+        i = (i + 1) & (index->capacity - 1);
+    }
+    if (array_size(values) >= UINT24_COUNT)
+    {
+        if (!compiler->had_error)
+        {
+            Chunk *chunk = compiler->function->chunk;
+            fprintf(stderr, "CompileError at %s:%u:%u Too many constants in one function.\n",
+                    compiler->file_path, chunk->row, chunk->col);
+        }
+        compiler->had_error = true;
+        return 0;
+    }
+    array_at(index, i) = (int32_t)array_size(values);
+    index->count++;
+    return (uint32_t)value_push(values, value);
+}
 int compiler_resolve_local(Compiler *compiler, Token token)
 {
-    int i = compiler->local_count - 1;
+    int i = (int)array_size(&compiler->locals) - 1;
     for (; i >= 0; i--)
     {
-        Local *local = &compiler->locals[i];
+        Local *local = &array_at(&compiler->locals, i);
         if (token_equal(token, local->name))
         {
             if (local->depth == -1)
@@ -49,11 +223,46 @@ int compiler_resolve_local(Compiler *compiler, Token token)
     }
     return i;
 }
+/* returns the slot of the new global, or -1 when the slots are exhausted */
+int compiler_declare_global(Compiler *compiler, ObjString *name, size_t row, size_t col, Value value)
+{
+    int slot = (int)array_size(compiler->declarations);
+    if (slot >= UINT16_COUNT)
+        return -1;
+    Declaration declaration = {name, row, col, value};
+    array_push(compiler->declarations, declaration);
+    table_set(compiler->globals, name, NUMBER_VAL(slot));
+    return slot;
+}
+int compiler_resolve_global(Compiler *compiler, char *name)
+{
+    ObjString *interned = table_find_string(compiler->globals, name);
+    Value slot;
+    if (interned == NULL || !table_get(compiler->globals, interned, &slot))
+        return -1;
+    return AS_INTEGRAL(slot);
+}
+Declaration *compiler_global_at(Compiler *compiler, int slot)
+{
+    return &array_at(compiler->declarations, slot);
+}
 void compiler_dump(Compiler *compiler, FILE *stream)
 {
+    fprintf(stream, "==== .globals ====\n");
+    for (size_t i = 0; i < array_size(compiler->declarations); i++)
+        fprintf(stream, "$%04zu  %s\n", i, array_at(compiler->declarations, i).name->chars);
     fprintf(stream, "==== .data ====\n");
     values_dump(compiler->function->values, stream);
     fprintf(stream, "==== .text ====\n");
     fprintf(stream, ".%s\n", compiler->function->name != NULL ? compiler->function->name->chars : "entry");
     chunk_dump(compiler->function->chunk, stream);
+    for (size_t i = 0; i < array_size(compiler->declarations); i++)
+    {
+        Value value = array_at(compiler->declarations, i).value;
+        if (!IS_FUNCTION(value))
+            continue;
+        ObjFunction *function = AS_FUNCTION(value);
+        fprintf(stream, ".%s\n", function->name->chars);
+        chunk_dump(function->chunk, stream);
+    }
 }
\ No newline at end of file
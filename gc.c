@@ -0,0 +1,501 @@
+#include "gc.h"
+#include "helper.h"
+#include "pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+static double gc_now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+static void gc_clear_marks(Obj *list);
+static void *gc_collector_run(void *arg);
+
+Heap *init_heap()
+{
+    Heap *heap = calloc(1, sizeof(Heap));
+    heap->next_gc = GC_INITIAL_THRESHOLD;
+    heap->growth_factor = GC_DEFAULT_GROWTH_FACTOR;
+    pthread_mutex_init(&heap->job_lock, NULL);
+    pthread_cond_init(&heap->job_ready, NULL);
+    atomic_init(&heap->job_done, false);
+    return heap;
+}
+void heap_free(Heap *heap)
+{
+    assert(heap->vm == NULL && "a heap is freed after its VM is detached");
+    objects_free(heap);
+    pool_release(&heap->pool);
+    array_free(&heap->pauses);
+    pthread_mutex_destroy(&heap->job_lock);
+    pthread_cond_destroy(&heap->job_ready);
+    free(heap);
+}
+
+void gc_set_growth_factor(Heap *heap, double factor)
+{
+    heap->growth_factor = factor;
+}
+void gc_set_concurrent(Heap *heap, bool enable)
+{
+    heap->concurrent = enable;
+}
+void gc_attach(Heap *heap, VM *vm)
+{
+    heap->vm = vm;
+    heap->nursery = malloc(GC_NURSERY_SIZE);
+    heap->nursery_top = heap->nursery;
+    heap->nursery_end = heap->nursery + GC_NURSERY_SIZE;
+    heap->remembered = calloc(array_size(heap->vm->globals) + 1, sizeof(bool));
+    if (heap->concurrent)
+        pthread_create(&heap->collector, NULL, gc_collector_run, heap);
+#ifdef DEBUG_STRESS_GC
+    heap->pending = true;
+#endif
+}
+static void gc_post_job(Heap *heap, GCJob next)
+{
+    atomic_store(&heap->job_done, false);
+    pthread_mutex_lock(&heap->job_lock);
+    heap->job = next;
+    pthread_cond_signal(&heap->job_ready);
+    pthread_mutex_unlock(&heap->job_lock);
+}
+static void gc_wait_job(Heap *heap)
+{
+    while (!atomic_load(&heap->job_done))
+        sched_yield();
+}
+static void gc_splice_swept(Heap *heap)
+{
+    if (heap->swept_list != NULL)
+    {
+        *heap->swept_tail = heap->objects;
+        heap->objects = heap->swept_list;
+    }
+    heap->bytes_allocated -= heap->swept_bytes;
+    while (heap->swept_dead != NULL)
+    {
+        Obj *next = heap->swept_dead->next;
+        object_free(heap, heap->swept_dead);
+        heap->swept_dead = next;
+    }
+    heap->swept_list = NULL;
+    heap->swept_tail = NULL;
+    heap->swept_bytes = 0;
+}
+void gc_detach(Heap *heap)
+{
+    if (heap->concurrent)
+    {
+        // let the collector finish what it holds, the VM's objects outlive it
+        if (heap->phase != GC_IDLE)
+            gc_wait_job(heap);
+        if (heap->phase == GC_MARKING)
+            gc_clear_marks(heap->objects);
+        if (heap->phase == GC_SWEEPING)
+            gc_splice_swept(heap);
+        heap->phase = GC_IDLE;
+        gc_post_job(heap, GC_JOB_EXIT);
+        pthread_join(heap->collector, NULL);
+        array_free(&heap->satb_buffer);
+        init_array(&heap->satb_buffer);
+    }
+    // the nursery goes with the VM, whatever is still young is unreachable from here on
+    heap->vm = NULL;
+    free(heap->nursery);
+    heap->nursery = heap->nursery_top = heap->nursery_end = NULL;
+    heap->nursery_full = false;
+    free(heap->remembered);
+    heap->remembered = NULL;
+    array_free(&heap->gray_stack);
+    init_array(&heap->gray_stack);
+    array_free(&heap->remembered_globals);
+    init_array(&heap->remembered_globals);
+    array_free(&heap->remembered_tables);
+    init_array(&heap->remembered_tables);
+    heap->pending = false;
+}
+static bool gc_is_marking(Heap *heap)
+{
+    return heap->phase == GC_MARKING;
+}
+static void gc_link(Heap *heap, Obj *object)
+{
+    object->next = heap->objects;
+    heap->objects = object;
+    if (gc_is_marking(heap))
+        object->is_marked = true;
+}
+Obj *gc_allocate_old(Heap *heap, size_t size)
+{
+    Obj *object = pool_allocate(&heap->pool, size);
+    gc_link(heap, object);
+    heap->bytes_allocated += size;
+    if (heap->vm != NULL && heap->bytes_allocated > heap->next_gc)
+        heap->pending = true;
+    return object;
+}
+Obj *gc_allocate_young(Heap *heap, size_t size)
+{
+    if (heap->vm == NULL)
+        return NULL;
+    size = (size + 7) & ~(size_t)7;
+    if (size > (size_t)(heap->nursery_end - heap->nursery_top))
+    {
+        heap->nursery_full = true;
+        heap->pending = true;
+        return NULL;
+    }
+    Obj *object = (Obj *)heap->nursery_top;
+    heap->nursery_top += size;
+    memset(object, 0, size);
+    return object;
+}
+void gc_freeze(Heap *heap)
+{
+    assert(heap->vm == NULL && "a heap is frozen while no VM is attached");
+    for (Obj *object = heap->objects; object != NULL; object = object->next)
+        object->is_marked = true;
+}
+bool gc_is_young(Heap *heap, Obj *object)
+{
+    return (char *)object >= heap->nursery && (char *)object < heap->nursery_end;
+}
+static bool gc_is_young_value(Heap *heap, Value value)
+{
+    return IS_OBJ(value) && gc_is_young(heap, AS_OBJ(value));
+}
+/*
+ * records the value being overwritten while marking. young objects are left
+ * out, the nursery was emptied when the cycle started so none of them are in
+ * the snapshot.
+ */
+static void gc_satb_barrier(Heap *heap, Value previous)
+{
+    if (gc_is_marking(heap) && IS_OBJ(previous) && !gc_is_young(heap, AS_OBJ(previous)))
+        array_push(&heap->satb_buffer, AS_OBJ(previous));
+}
+void gc_write_barrier_global(Heap *heap, uint16_t slot, Value previous, Value value)
+{
+    gc_satb_barrier(heap, previous);
+    if (!gc_is_young_value(heap, value) || heap->remembered[slot])
+        return;
+    heap->remembered[slot] = true;
+    array_push(&heap->remembered_globals, slot);
+}
+void gc_write_barrier_table(Heap *heap, Table *table, ObjString *key, Value previous, Value value)
+{
+    if (heap->vm == NULL)
+        return;
+    gc_satb_barrier(heap, previous);
+    if (!gc_is_young(heap, (Obj *)key) && !gc_is_young_value(heap, value))
+        return;
+    for (size_t i = 0; i < array_size(&heap->remembered_tables); i++)
+        if (array_at(&heap->remembered_tables, i) == table)
+            return;
+    array_push(&heap->remembered_tables, table);
+}
+/*
+ * copies a young object into the old space and leaves a forwarding pointer
+ * behind in `next`. only strings are allocated young, they reference
+ * nothing, so the copy never has to be scanned.
+ */
+static Obj *gc_promote(Heap *heap, Obj *object)
+{
+    if (object == NULL || !gc_is_young(heap, object))
+        return object;
+    if (object->is_marked)
+        return object->next;
+    size_t size = object_size(object);
+    Obj *copy = pool_allocate(&heap->pool, size);
+    memcpy(copy, object, size);
+    copy->is_marked = false;
+    gc_link(heap, copy);
+    heap->bytes_allocated += size;
+    object->is_marked = true;
+    object->next = copy;
+    return copy;
+}
+static void gc_promote_value(Heap *heap, Value *slot)
+{
+    if (IS_OBJ(*slot))
+        *slot = OBJ_VAL(gc_promote(heap, AS_OBJ(*slot)));
+}
+static void gc_minor(Heap *heap)
+{
+    for (Value *slot = heap->vm->stack.items; slot < heap->vm->sp; slot++)
+        gc_promote_value(heap, slot);
+    for (size_t i = 0; i < array_size(&heap->remembered_globals); i++)
+    {
+        uint16_t slot = array_at(&heap->remembered_globals, i);
+        gc_promote_value(heap, &array_at(heap->vm->globals, slot));
+        heap->remembered[slot] = false;
+    }
+    for (size_t i = 0; i < array_size(&heap->remembered_tables); i++)
+    {
+        Table *table = array_at(&heap->remembered_tables, i);
+        for (size_t j = 0; j < table->capacity; j++)
+        {
+            Entry *entry = &array_at(table, j);
+            entry->key = (ObjString *)gc_promote(heap, (Obj *)entry->key);
+            gc_promote_value(heap, &entry->value);
+        }
+    }
+    array_size(&heap->remembered_globals) = 0;
+    array_size(&heap->remembered_tables) = 0;
+    heap->nursery_top = heap->nursery;
+    heap->nursery_full = false;
+    heap->minor_count++;
+}
+void gc_mark_object(Heap *heap, Obj *object)
+{
+    if (object == NULL || object->is_marked)
+        return;
+    object->is_marked = true;
+    array_push(&heap->gray_stack, object);
+}
+void gc_mark_value(Heap *heap, Value value)
+{
+    if (IS_OBJ(value))
+        gc_mark_object(heap, AS_OBJ(value));
+}
+static void gc_mark_values(Heap *heap, Values *values)
+{
+    for (size_t i = 0; i < array_size(values); i++)
+        gc_mark_value(heap, array_at(values, i));
+}
+static void gc_mark_table(Heap *heap, Table *table)
+{
+    for (size_t i = 0; i < table->capacity; i++)
+    {
+        Entry *entry = &array_at(table, i);
+        gc_mark_object(heap, (Obj *)entry->key);
+        gc_mark_value(heap, entry->value);
+    }
+}
+static void gc_mark_roots(Heap *heap)
+{
+    for (Value *slot = heap->vm->stack.items; slot < heap->vm->sp; slot++)
+        gc_mark_value(heap, *slot);
+    for (int i = 0; i < heap->vm->frame_count; i++)
+        gc_mark_object(heap, (Obj *)heap->vm->frames[i].function);
+    gc_mark_values(heap, heap->vm->globals);
+    for (size_t i = 0; i < array_size(heap->vm->declarations); i++)
+    {
+        Declaration *declaration = &array_at(heap->vm->declarations, i);
+        gc_mark_object(heap, (Obj *)declaration->name);
+        gc_mark_value(heap, declaration->value);
+    }
+    gc_mark_table(heap, heap->vm->strings);
+}
+/* marks everything a gray object references, functions keep their constant pool alive */
+static void gc_blacken(Heap *heap, Obj *object)
+{
+    switch (object->type)
+    {
+    case OBJ_STRING:
+        break;
+    case OBJ_FUNCTION:
+    {
+        ObjFunction *function = (ObjFunction *)object;
+        gc_mark_object(heap, (Obj *)function->name);
+        gc_mark_values(heap, function->values);
+        break;
+    }
+    case OBJ_NATIVE:
+        gc_mark_object(heap, (Obj *)((ObjNative *)object)->name);
+        break;
+    default:
+        NOTREACHABLE;
+    }
+}
+static void gc_trace(Heap *heap)
+{
+    while (array_size(&heap->gray_stack) > 0)
+        gc_blacken(heap, array_pop(&heap->gray_stack));
+}
+static void gc_clear_marks(Obj *list)
+{
+    for (Obj *object = list; object != NULL; object = object->next)
+        object->is_marked = false;
+}
+/*
+ * frees the unmarked objects of list, or chains them into dead when it is
+ * given, and returns the survivors with their marks cleared.
+ */
+static Obj *gc_sweep(Heap *heap, Obj *list, Obj ***tail, Obj **dead, size_t *freed)
+{
+    Obj **link = &list;
+    while (*link != NULL)
+    {
+        Obj *object = *link;
+        if (object->is_marked)
+        {
+            object->is_marked = false;
+            link = &object->next;
+            continue;
+        }
+        *link = object->next;
+        *freed += object_size(object);
+        if (dead != NULL)
+        {
+            object->next = *dead;
+            *dead = object;
+        }
+        else
+            object_free(heap, object);
+    }
+    if (tail != NULL)
+        *tail = link;
+    return list;
+}
+static void gc_update_threshold(Heap *heap)
+{
+    heap->next_gc = (size_t)(heap->bytes_allocated * heap->growth_factor);
+    if (heap->next_gc < GC_INITIAL_THRESHOLD)
+        heap->next_gc = GC_INITIAL_THRESHOLD;
+}
+static void gc_major(Heap *heap)
+{
+    gc_mark_roots(heap);
+    gc_trace(heap);
+    size_t freed = 0;
+    heap->objects = gc_sweep(heap, heap->objects, NULL, NULL, &freed);
+    heap->bytes_allocated -= freed;
+    gc_update_threshold(heap);
+    heap->major_count++;
+}
+static void *gc_collector_run(void *arg)
+{
+    Heap *heap = arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&heap->job_lock);
+        while (heap->job == GC_JOB_NONE)
+            pthread_cond_wait(&heap->job_ready, &heap->job_lock);
+        GCJob current = heap->job;
+        heap->job = GC_JOB_NONE;
+        pthread_mutex_unlock(&heap->job_lock);
+
+        switch (current)
+        {
+        case GC_JOB_MARK:
+            gc_trace(heap);
+            break;
+        case GC_JOB_SWEEP:
+            heap->swept_list = gc_sweep(heap, heap->sweep_list, &heap->swept_tail, &heap->swept_dead, &heap->swept_bytes);
+            heap->sweep_list = NULL;
+            break;
+        case GC_JOB_EXIT:
+            return NULL;
+        default:
+            break;
+        }
+        atomic_store(&heap->job_done, true);
+    }
+}
+/*
+ * advances the concurrent cycle, each step is one short pause of the mutator.
+ * false when there was nothing to do yet, the collector thread is still busy.
+ */
+static bool gc_concurrent_step(Heap *heap)
+{
+    switch (heap->phase)
+    {
+    case GC_IDLE:
+    {
+#ifndef DEBUG_STRESS_GC
+        if (heap->bytes_allocated <= heap->next_gc)
+            return false;
+#endif
+        // initial mark: empty the nursery and gray the roots, the collector thread traces from them
+        if (heap->nursery_top != heap->nursery)
+            gc_minor(heap);
+        gc_mark_roots(heap);
+        heap->phase = GC_MARKING;
+        gc_post_job(heap, GC_JOB_MARK);
+        return true;
+    }
+    case GC_MARKING:
+    {
+        if (!atomic_load(&heap->job_done))
+            return false;
+        // remark: whatever the barrier saw overwritten was reachable at the snapshot
+        for (size_t i = 0; i < array_size(&heap->satb_buffer); i++)
+            gc_mark_object(heap, array_at(&heap->satb_buffer, i));
+        array_size(&heap->satb_buffer) = 0;
+        gc_trace(heap);
+        heap->phase = GC_SWEEPING;
+        heap->sweep_list = heap->objects;
+        heap->objects = NULL;
+        gc_post_job(heap, GC_JOB_SWEEP);
+        return true;
+    }
+    case GC_SWEEPING:
+    {
+        if (!atomic_load(&heap->job_done))
+            return false;
+        gc_splice_swept(heap);
+        gc_update_threshold(heap);
+        heap->phase = GC_IDLE;
+        heap->major_count++;
+        return true;
+    }
+    }
+    return false;
+}
+void gc_collect(Heap *heap)
+{
+    if (heap->vm == NULL)
+        return;
+    double start = gc_now_us();
+#ifdef DEBUG_STRESS_GC
+    gc_minor(heap);
+    if (heap->concurrent)
+        gc_concurrent_step(heap);
+    else
+        gc_major(heap);
+#else
+    // survivors are promoted first, a major collection then only sees the old space
+    bool worked = heap->nursery_full || !heap->concurrent;
+    if (worked)
+        gc_minor(heap);
+    if (heap->concurrent)
+        worked = gc_concurrent_step(heap) || worked;
+    else if (heap->bytes_allocated > heap->next_gc)
+        gc_major(heap);
+    // a running cycle keeps the safepoints polling until it is done
+    heap->pending = heap->phase != GC_IDLE;
+    // a poll that only found the collector thread still busy did not pause anything
+    if (!worked)
+        return;
+#endif
+    array_push(&heap->pauses, gc_now_us() - start);
+}
+static int gc_compare_pause(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+static double gc_percentile(Heap *heap, double percentile)
+{
+    size_t index = (size_t)(percentile / 100 * (array_size(&heap->pauses) - 1) + 0.5);
+    return array_at(&heap->pauses, index);
+}
+void gc_report(Heap *heap, FILE *stream)
+{
+    fprintf(stream, "gc: %s, %zu minor, %zu major collections, %zu pauses\n",
+            heap->concurrent ? "concurrent" : "stop-the-world", heap->minor_count, heap->major_count, array_size(&heap->pauses));
+    if (array_size(&heap->pauses) == 0)
+        return;
+    qsort(heap->pauses.items, array_size(&heap->pauses), sizeof(double), gc_compare_pause);
+    fprintf(stream, "gc: pause p50 %.1fus p90 %.1fus p99 %.1fus max %.1fus\n",
+            gc_percentile(heap, 50), gc_percentile(heap, 90), gc_percentile(heap, 99), gc_percentile(heap, 100));
+}
@@ -2,6 +2,7 @@
 #define AST_H
 #include "token.h"
 #include "array.h"
+#include "arena.h"
 #include "VM.h"
 
 typedef enum
@@ -29,26 +30,50 @@ typedef enum
     AST_FUNCTION_DECL,
 } AST_Type;
 typedef struct AST_STRUCT AST;
+/* the parts of a Token a node needs, the text still points into the source */
+typedef struct
+{
+    char *start;
+    uint32_t length;
+    uint32_t row;
+    uint32_t col;
+    TokenType type;
+} ASTToken;
+/*
+ * nodes live in an arena. which member of the union is in use follows from
+ * the node type: NUMBER keeps its number, list nodes (see ast_has_childs)
+ * their children and every other node its left and right operands.
+ */
 struct AST_STRUCT
 {
     char *name;
-    AST_Type type;
-    double number;
     AST *value;
-    AST *left;
-    AST *right;
-    Token token;
-    struct
+    ASTToken token;
+    AST_Type type;
+    union
     {
-        AST **items;
-        size_t count;
-        size_t capacity;
-    } childs;
+        double number;
+        struct
+        {
+            AST *left;
+            AST *right;
+        };
+        struct
+        {
+            AST **items;
+            uint32_t count;
+            uint32_t capacity;
+        } childs;
+    };
 };
-AST *init_ast(AST_Type type);
+AST *init_ast(Arena *arena, AST_Type type);
+void ast_set_token(AST *ast, Token token);
+Token ast_token(AST *ast);
+bool ast_has_childs(AST *ast);
 char *ast_type_to_str(int type);
 void ast_print(AST *root);
-size_t ast_push(AST *ast, AST *child);
-void ast_free(AST *ast);
+size_t ast_push(Arena *arena, AST *ast, AST *child);
 void ast_to_byte(AST *ast, Compiler *compiler);
+bool ast_is_literal(AST *ast);
+bool ast_literal_truthy(AST *ast);
 #endif
\ No newline at end of file
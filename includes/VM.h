@@ -2,10 +2,13 @@
 #define VM_H
 #include "compiler.h"
 #include "table.h"
+#include "helper.h"
 
 #define FRAMES_MAX 64
 #define STACK_SIZE (FRAMES_MAX * UINT8_COUNT)
 
+typedef struct Jit Jit;
+
 typedef struct
 {
     Value items[STACK_SIZE];
@@ -26,12 +29,17 @@ struct VM
     int row;
     int col;
     char *message;
+    Heap *heap; /* allocates everything the VM creates, collected while attached */
     Table *strings;
-    Table *globals;
-    Table *variables;
+    Values *globals; /* indexed by the slots the compiler resolved */
+    Declarations *declarations;
     char *file_path;
+    FILE *out; /* where print writes */
+    char *input; /* what input() returns, NULL outside batch runs */
     CallFrame frames[FRAMES_MAX];
     int frame_count;
+    Value result; /* what the outermost frame returned */
+    Jit *jit; /* compiles hot functions, NULL when they stay interpreted */
 };
 
 typedef enum
@@ -47,7 +55,40 @@ typedef enum
 } VM_Error;
 typedef struct VM VM;
 
-VM *init_vm(Compiler *compiler);
+/* result = a op b the way the comparison instructions see it, numbers by value and objects by identity */
+#define VM_COMPARE(result, a, b, op)                 \
+    do                                               \
+    {                                                \
+        if (IS_NUMBER(a) && IS_NUMBER(b))            \
+            result = AS_NUMBER(a) op AS_NUMBER(b);   \
+        else if (VALUE_TYPE(b) != VALUE_TYPE(a))     \
+            result = false;                          \
+        else                                         \
+            switch (VALUE_TYPE(b))                   \
+            {                                        \
+            case VAL_BOOL:                           \
+                result = AS_BOOL(a) op AS_BOOL(b);   \
+                break;                               \
+            case VAL_NULL:                           \
+                result = true;                       \
+                break;                               \
+            case VAL_OBJ:                            \
+                result = AS_OBJ(a) op AS_OBJ(b);     \
+                break;                               \
+            default:                                 \
+                NOTREACHABLE;                        \
+            }                                        \
+    } while (0)
+
+VM *init_vm(Compiler *compiler, Heap *heap); /* attaches heap, vm_free detaches it */
 void vm_free(VM *vm);
+void vm_own_code(VM *vm);
 VM_Error vm_interpret(VM *vm);
+VM_Error vm_run(VM *vm, int base); /* interprets until the frame at index base returns */
+VM_Error vm_invoke(VM *vm, CallFrame *frame, int arg_count); /* OP_CALL made from outside the interpreter loop */
+VM_Error vm_call(VM *vm, Value callee, int arg_count, Value *args);
+void vm_disable_jit(VM *vm);
+bool is_falsey(Value value);
+int vm_format_error(VM *vm, VM_Error error, char *buffer, size_t size);
+void vm_report_error(VM *vm, VM_Error error, FILE *stream); /* nothing for VM_OK */
 #endif
\ No newline at end of file
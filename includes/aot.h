@@ -0,0 +1,225 @@
+#ifndef AOT_H
+#define AOT_H
+#include <stdio.h>
+#include <stdint.h>
+#include "VM.h"
+#include "jit.h"
+#include "gc.h"
+
+/*
+ * ahead of time compilation of a script to C. every function's chunk is
+ * translated one instruction at a time into a C function made of the
+ * templates below, and written out with the script's bytecode image and a
+ * main that runs it. built against the runtime library it is a standalone
+ * program:
+ *
+ *     fu.out --emit-c=script.c script.p
+ *     cc -O2 -Iincludes script.c compiled/libclox.a -pthread
+ *
+ * the generated functions are installed as the functions' native code and
+ * follow the jit's contract (see jit.h), so calls, returns and tail calls
+ * go through the same runtime. their numeric fast paths are guarded like
+ * the jit's, and anything else that would raise an error hands the call to
+ * the interpreter at that instruction, which then reports it as it always
+ * does. the image keeps the positions, names and constants for that.
+ *
+ * the runtime has to be built with the same options as the fu.out that
+ * generated the file, NaN boxing changes what a Value is.
+ */
+typedef struct
+{
+    char *path; /* of the script, as errors name it */
+    uint64_t *image; /* bytecode image, its code is quickened in place once interpreted */
+    size_t size;
+    uint64_t source_hash;
+    uint32_t flags;
+    JitCode *functions; /* in image order: the script, then each function in slot order */
+    size_t function_count;
+} AotProgram;
+
+/* writes the finished script compiler as a C program, false when it could not */
+bool aot_emit(Compiler *compiler, uint64_t source_hash, uint32_t flags, FILE *out);
+/* the generated main, runs the program and returns its exit status */
+int aot_main(AotProgram *program);
+/* OP_CALL, a function with native code is called straight away instead of through vm_invoke */
+int aot_call(VM *vm, CallFrame *frame, int arg_count);
+/* a + b for two strings below sp, false when they are not */
+bool aot_concat(VM *vm, Value *sp);
+
+/* the templates, sp is kept in a local and only written back when something else looks at the stack */
+#define AOT_PROLOGUE()                                 \
+    byte *code = frame->function->chunk->items;        \
+    Value *constants = frame->function->values->items; \
+    Value *globals = vm->globals->items;               \
+    Value *slots = frame->slots;                       \
+    Value *sp = vm->sp;                                \
+    (void)constants;                                   \
+    (void)globals;                                     \
+    (void)slots
+
+#define AOT_SYNC()                                        \
+    do                                                    \
+    {                                                     \
+        vm->sp = sp;                                      \
+        vm->stack.count = (size_t)(sp - vm->stack.items); \
+    } while (0)
+
+/* the interpreter goes on with the instruction at offset */
+#define AOT_BAIL(offset)             \
+    do                               \
+    {                                \
+        frame->ip = code + (offset); \
+        AOT_SYNC();                  \
+        return JIT_BAIL;             \
+    } while (0)
+
+#define AOT_FALSEY(value) (IS_BOOL(value) ? !AS_BOOL(value) : IS_NUMBER(value) ? AS_NUMBER(value) == 0 \
+                                                                               : is_falsey(value))
+
+#define AOT_CONSTANT(index) (*sp++ = constants[(index)])
+#define AOT_NUMBER(number) (*sp++ = NUMBER_VAL(number))
+#define AOT_GET_LOCAL(slot) (*sp++ = slots[(slot)])
+#define AOT_SET_LOCAL(slot) (slots[(slot)] = sp[-1])
+#define AOT_POP() (sp--)
+#define AOT_DUP() (*sp = sp[-1], sp++)
+#define AOT_NOT() (sp[-1] = BOOL_VAL(AOT_FALSEY(sp[-1])))
+#define AOT_PRINT() value_print(*--sp, 1, vm->out)
+
+#define AOT_GET_GLOBAL(slot, offset)   \
+    do                                 \
+    {                                  \
+        if (IS_UNDEF(globals[(slot)])) \
+            AOT_BAIL(offset);          \
+        *sp++ = globals[(slot)];       \
+    } while (0)
+
+#define AOT_SET_GLOBAL(slot, offset)                                          \
+    do                                                                        \
+    {                                                                         \
+        Value previous = globals[(slot)];                                     \
+        if (IS_UNDEF(previous))                                               \
+            AOT_BAIL(offset);                                                 \
+        globals[(slot)] = sp[-1];                                             \
+        gc_write_barrier_global(vm->heap, (slot), previous, globals[(slot)]); \
+    } while (0)
+
+#define AOT_DEFINE_GLOBAL(slot)                                               \
+    do                                                                        \
+    {                                                                         \
+        Value previous = globals[(slot)];                                     \
+        globals[(slot)] = *--sp;                                              \
+        gc_write_barrier_global(vm->heap, (slot), previous, globals[(slot)]); \
+    } while (0)
+
+#define AOT_ADD(offset)                                       \
+    do                                                        \
+    {                                                         \
+        Value b = sp[-1];                                     \
+        Value a = sp[-2];                                     \
+        if (IS_NUMBER(a) && IS_NUMBER(b))                     \
+            sp[-2] = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)); \
+        else if (!aot_concat(vm, sp))                         \
+            AOT_BAIL(offset);                                 \
+        sp--;                                                 \
+    } while (0)
+
+/* AS is AS_NUMBER, or AS_INTEGRAL for %, the bitwise operators and the shifts */
+#define AOT_ARITHMETIC(op, AS, offset)       \
+    do                                       \
+    {                                        \
+        Value b = sp[-1];                    \
+        Value a = sp[-2];                    \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b))  \
+            AOT_BAIL(offset);                \
+        sp[-2] = NUMBER_VAL(AS(a) op AS(b)); \
+        sp--;                                \
+    } while (0)
+
+#define AOT_UNARY(op, AS, offset)           \
+    do                                      \
+    {                                       \
+        if (!IS_NUMBER(sp[-1]))             \
+            AOT_BAIL(offset);               \
+        sp[-1] = NUMBER_VAL(op AS(sp[-1])); \
+    } while (0)
+
+#define AOT_COMPARE(op)               \
+    do                                \
+    {                                 \
+        Value b = sp[-1];             \
+        Value a = sp[-2];             \
+        bool result = false;          \
+        VM_COMPARE(result, a, b, op); \
+        sp[-2] = BOOL_VAL(result);    \
+        sp--;                         \
+    } while (0)
+
+/* pops both operands and jumps when the comparison is false */
+#define AOT_JUMP_IF_NOT(op, label)    \
+    do                                \
+    {                                 \
+        Value b = sp[-1];             \
+        Value a = sp[-2];             \
+        bool result = false;          \
+        VM_COMPARE(result, a, b, op); \
+        sp -= 2;                      \
+        if (!result)                  \
+            goto label;               \
+    } while (0)
+
+#define AOT_JUMP_IF_FALSE(label) \
+    do                           \
+    {                            \
+        if (AOT_FALSEY(sp[-1]))  \
+            goto label;          \
+    } while (0)
+
+/* local op= number, behind ++, -- and i = i + k */
+#define AOT_LOCAL_CONSTANT(op, slot, number, offset)                      \
+    do                                                                    \
+    {                                                                     \
+        if (!IS_NUMBER(slots[(slot)]))                                    \
+            AOT_BAIL(offset);                                             \
+        slots[(slot)] = NUMBER_VAL(AS_NUMBER(slots[(slot)]) op (number)); \
+    } while (0)
+
+#define AOT_CONSTANT_OP(op, number, offset)                 \
+    do                                                      \
+    {                                                       \
+        if (!IS_NUMBER(sp[-1]))                             \
+            AOT_BAIL(offset);                               \
+        sp[-1] = NUMBER_VAL(AS_NUMBER(sp[-1]) op (number)); \
+    } while (0)
+
+/* next is the offset past the instruction, where the frame goes on */
+#define AOT_CALL(arg_count, next)                      \
+    do                                                 \
+    {                                                  \
+        frame->ip = code + (next);                     \
+        AOT_SYNC();                                    \
+        int status = aot_call(vm, frame, (arg_count)); \
+        if (status != VM_OK)                           \
+            return status;                             \
+        sp = vm->sp;                                   \
+    } while (0)
+
+#define AOT_TAIL_CALL(arg_count, next)                                     \
+    do                                                                     \
+    {                                                                      \
+        AOT_SYNC();                                                        \
+        int status = jit_tail_call(vm, frame, (arg_count), code + (next)); \
+        if (status != VM_OK)                                               \
+            return status;                                                 \
+        sp = vm->sp;                                                       \
+    } while (0)
+
+#define AOT_RETURN()       \
+    do                     \
+    {                      \
+        slots[0] = sp[-1]; \
+        sp = slots + 1;    \
+        AOT_SYNC();        \
+        vm->frame_count--; \
+        return VM_OK;      \
+    } while (0)
+#endif
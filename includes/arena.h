@@ -0,0 +1,23 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/*
+ * bump allocator for memory that dies all at once, like the AST and its
+ * names once they are compiled. nothing is freed on its own, arena_free
+ * releases every block in one go and leaves the arena ready for reuse.
+ */
+typedef struct ArenaBlock ArenaBlock;
+typedef struct
+{
+    ArenaBlock *blocks;
+    char *top;
+    char *end;
+} Arena;
+
+void *arena_allocate(Arena *arena, size_t size); /* zeroed, 8 byte aligned */
+char *arena_strndup(Arena *arena, const char *chars, size_t length);
+void arena_free(Arena *arena);
+#endif
@@ -3,6 +3,14 @@
 #include <stddef.h>
 #include <assert.h>
 
+#define ARRAY_INITIAL_CAPACITY 8
+#define ARRAY_DOUBLING_LIMIT 4096
+/* doubles while small, past the limit grows by half so big arrays waste less */
+#define array_grow_capacity(capacity)                              \
+    ((capacity) < ARRAY_INITIAL_CAPACITY ? ARRAY_INITIAL_CAPACITY   \
+     : (capacity) < ARRAY_DOUBLING_LIMIT ? (capacity) * 2           \
+                                         : (capacity) + (capacity) / 2)
+
 #define define_array(name, type) \
     typedef struct               \
     {                            \
@@ -22,7 +30,7 @@
     {                                                                                              \
         if ((array)->count >= (array)->capacity)                                                   \
         {                                                                                          \
-            (array)->capacity = (array)->capacity == 0 ? 256 : (array)->capacity * 2;              \
+            (array)->capacity = array_grow_capacity((array)->capacity);                            \
             (array)->items = realloc((array)->items, (array)->capacity * sizeof(*(array)->items)); \
             assert((array)->items != NULL && "cannot allocate memory");                            \
         }                                                                                          \
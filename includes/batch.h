@@ -0,0 +1,28 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * runs many scripts, or one script once per input set, on worker threads.
+ * every script is compiled once on the calling thread into a heap that is
+ * then frozen and shared read only; each run gets its own VM, globals,
+ * heap and copy of the code. outputs are printed in run order once all
+ * runs are done, followed by each run's latency and the throughput on
+ * stderr.
+ */
+typedef struct
+{
+    int workers;
+    bool optimize;
+    double gc_growth; /* 0 keeps the default */
+    bool gc_concurrent;
+    bool jit; /* compile hot functions to native code */
+} BatchOptions;
+
+/*
+ * with inputs, the one script runs once per line of it and input() returns
+ * the line. returns 0 when every run finished without an error.
+ */
+int batch_run(char **paths, char **sources, size_t count, char *inputs, BatchOptions options);
+#endif
@@ -0,0 +1,42 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "compiler.h"
+
+/*
+ * compiled scripts cached on disk as .pbc files next to their source. the
+ * file is one image: a header, then fixed size records for the strings,
+ * globals and functions, then the data they point at by file offset. code
+ * and position runs are used straight from the mapped image, only the
+ * constants and names become objects when it is loaded. the header keeps a
+ * hash of the rest, so a file changed after it was written is compiled anew.
+ *
+ * bump BYTECODE_VERSION whenever the instruction set or the layout changes.
+ */
+#define BYTECODE_VERSION 3
+#define BYTECODE_OPTIMIZED 1 /* header flag, compiled with -O */
+
+typedef struct
+{
+    char *base;
+    size_t size;
+    bool mapped; /* mmap'ed, otherwise read into a malloc'ed buffer */
+} BytecodeImage;
+
+uint64_t bytecode_hash(const char *source, size_t length);
+char *bytecode_cache_path(const char *source_path); /* caller frees */
+/* the image of a finished script compiler, NULL when a constant cannot be saved. caller frees */
+char *bytecode_image(Compiler *compiler, uint64_t source_hash, uint32_t flags, size_t *size);
+/* writes the finished script compiler to path, returns false when it could not */
+bool bytecode_write(Compiler *compiler, const char *path, uint64_t source_hash, uint32_t flags);
+/*
+ * loads a cache written for the same source hash and flags into a script
+ * compiler that only has its natives declared. the image has to outlive
+ * every loaded function, free it with bytecode_unload after objects_free.
+ */
+bool bytecode_load(Compiler *compiler, BytecodeImage *image, const char *path, uint64_t source_hash, uint32_t flags);
+/* the same for an image already in memory, e.g. one compiled into a program. it is written to */
+bool bytecode_load_image(Compiler *compiler, BytecodeImage *image, uint64_t source_hash, uint32_t flags);
+void bytecode_unload(BytecodeImage *image);
+#endif
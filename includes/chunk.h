@@ -9,11 +9,24 @@
 
 typedef uint8_t byte;
 
+/* one run of the position table, every byte from offset up to the next run shares row/col */
+typedef struct
+{
+    size_t offset;
+    uint32_t row;
+    uint32_t col;
+} Position;
+
+define_array(Positions, Position);
+
 typedef struct
 {
     byte *items;
     size_t count;
     size_t capacity;
+    Positions positions;
+    uint32_t row; /* position stamped on the next pushed byte */
+    uint32_t col;
 } Chunk;
 
 typedef enum
@@ -44,26 +57,71 @@ typedef enum
     OP_POP,
     OP_GET_LOCAL,
     OP_JMP_IF_FALSE,
+    OP_JMP_IF_NOT_EQUAL,
+    OP_JMP_IF_NOT_NOT_EQUAL,
+    OP_JMP_IF_NOT_LT,
+    OP_JMP_IF_NOT_LTE,
+    OP_JMP_IF_NOT_GT,
+    OP_JMP_IF_NOT_GTE,
     OP_JMP,
     OP_LOOP,
     OP_LEFT_SHIFT,
     OP_RIGHT_SHIFT,
     OP_DUP,
     OP_CALL,
+    OP_TAIL_CALL,
+    // wide forms, the compiler switches to them once an operand outgrows the short one
+    OP_CONSTANT_LONG,
+    OP_GET_LOCAL_LONG,
+    OP_SET_LOCAL_LONG,
+    OP_JMP_IF_FALSE_LONG,
+    OP_JMP_IF_NOT_EQUAL_LONG,
+    OP_JMP_IF_NOT_NOT_EQUAL_LONG,
+    OP_JMP_IF_NOT_LT_LONG,
+    OP_JMP_IF_NOT_LTE_LONG,
+    OP_JMP_IF_NOT_GT_LONG,
+    OP_JMP_IF_NOT_GTE_LONG,
+    OP_JMP_LONG,
+    OP_LOOP_LONG,
+    // superinstructions, only emitted by the peephole optimizer
+    OP_INC_LOCAL,
+    OP_DEC_LOCAL,
+    OP_ADD_CONST,
+    OP_SUBTRACT_CONST,
+    // quickened forms, only ever written by the VM over their generic opcode
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_MOD_NUM,
+    OP_EQUAL_NUM,
+    OP_NOT_EQUAL_NUM,
+    OP_LT_NUM,
+    OP_LTE_NUM,
+    OP_GT_NUM,
+    OP_GTE_NUM,
 } OpCode;
 
 typedef enum
 {
     OPERAND_IMMEDIATE,
     OPERAND_MEMORY,
+    OPERAND_GLOBAL,
 } OperandType;
 
 char *chunk_operand_type_to_str();
 Chunk *init_chunk();
 size_t chunk_push(Chunk *chunk, byte insturction); /*returns index of the instruction */
+void chunk_set_position(Chunk *chunk, uint32_t row, uint32_t col);
+Position chunk_position_at(Chunk *chunk, size_t offset);
 byte chunk_pop(Chunk *chunk);
 const char *chunk_byte_to_str(byte insturction);
 void chunk_dump(Chunk *chunk, FILE *stream);
 void chunk_free(Chunk *chunk);
 size_t chunk_print_instruction(Chunk *chunk, size_t offset, FILE *stream);
+size_t chunk_instruction_length(byte instruction); /* opcode plus its operands, in bytes */
+bool chunk_is_jump(byte instruction);
+byte chunk_long_jump(byte instruction); /* the wide form of a jump */
+size_t chunk_jump_target(Chunk *chunk, size_t offset); /* where the jump at offset lands */
+void chunk_patch_jump(Chunk *chunk, size_t offset, size_t target);
 #endif
\ No newline at end of file
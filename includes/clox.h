@@ -0,0 +1,68 @@
+#ifndef CLOX_H
+#define CLOX_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * embedding interface, built into compiled/libclox.a and libclox.so by
+ * `make lib`. a program is compiled once and stays read only, any number of
+ * VMs are then created from it, each with its own globals and heap, to run
+ * the script or call its global functions.
+ *
+ * a VM is used by one thread at a time, VMs run in parallel on separate
+ * threads. compile errors go to stderr the way the interpreter reports them.
+ */
+typedef struct CloxProgram CloxProgram;
+typedef struct CloxVM CloxVM;
+
+typedef enum
+{
+    CLOX_NULL,
+    CLOX_BOOL,
+    CLOX_NUMBER,
+    CLOX_STRING,
+    CLOX_FUNCTION,
+} CloxType;
+
+typedef struct
+{
+    CloxType type;
+    union
+    {
+        bool boolean;
+        double number;
+        const char *string; /* CLOX_STRING, and the name of a CLOX_FUNCTION */
+    } as;
+} CloxValue;
+
+typedef enum
+{
+    CLOX_OK,
+    CLOX_COMPILE_ERROR,
+    CLOX_RUNTIME_ERROR,
+} CloxResult;
+
+/* string arguments are only valid during the call, a returned string is copied */
+typedef CloxValue (*CloxNative)(void *data, int arg_count, const CloxValue *args);
+
+CloxValue clox_null(void);
+CloxValue clox_bool(bool boolean);
+CloxValue clox_number(double number);
+CloxValue clox_string(const char *string);
+
+CloxProgram *clox_program_new(void);
+/* binds a global native, before the program is compiled */
+bool clox_program_native(CloxProgram *program, const char *name, int arity, CloxNative function, void *data);
+/* name is what errors report the script as */
+CloxResult clox_program_compile(CloxProgram *program, const char *source, const char *name, bool optimize);
+void clox_program_free(CloxProgram *program); /* after its VMs */
+
+/* NULL when the program did not compile */
+CloxVM *clox_vm_new(CloxProgram *program);
+/* runs the script's top level, which defines its global variables */
+CloxResult clox_vm_run(CloxVM *vm);
+/* calls a global function, a string result stays valid until the next call on vm */
+CloxResult clox_vm_call(CloxVM *vm, const char *name, int arg_count, const CloxValue *args, CloxValue *result);
+const char *clox_vm_error(CloxVM *vm); /* the last runtime error, "" when there was none */
+void clox_vm_free(CloxVM *vm);
+#endif
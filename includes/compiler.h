@@ -12,6 +12,41 @@ typedef struct
     int depth;
 } Local;
 
+define_array(Locals, Local);
+
+#define UINT16_COUNT (UINT16_MAX + 1)
+#define UINT24_COUNT (1 << 24)
+
+/* offsets of jump operands waiting for their target */
+define_array(JumpOffsets, size_t);
+
+/* a jump whose target outgrew its 16 bit operand, widened once the function is done */
+typedef struct
+{
+    size_t offset;
+    size_t target;
+} FarJump;
+
+define_array(FarJumps, FarJump);
+
+/*
+ * a global resolved at compile time, its index in the declarations is the
+ * slot the VM stores it in. value is what the compiler knows about it:
+ * undefined while its initializer compiles, null once declared, or the
+ * function/native bound to the name.
+ */
+typedef struct
+{
+    ObjString *name;
+    size_t row;
+    size_t col;
+    Value value;
+} Declaration;
+
+define_array(Declarations, Declaration);
+/* open addressed index over the function's constant pool, slots hold pool indices or -1 */
+define_array(ConstantIndex, int32_t);
+
 typedef enum
 {
     TYPE_FUNCTION,
@@ -23,22 +58,27 @@ typedef struct
     ObjFunction *function;
     FunctionType type;
     bool had_error;
+    bool optimize; /* run the peephole optimizer on each finished function */
     char *file_path;
+    Heap *heap; /* what the program's objects are allocated from */
     int scope_depth;
-    int local_count;
-    Local locals[UINT8_COUNT];
-    uint8_t break_stack[UINT8_COUNT];
-    uint8_t break_stack_count;
-    uint8_t continue_stack[UINT8_COUNT];
-    uint8_t continue_stack_count;
+    Locals locals;
+    JumpOffsets breaks;
+    JumpOffsets continues;
+    FarJumps far_jumps;
     Table *strings;
-    Table *globals;
-    Table *variables;
+    Table *globals; /* name -> slot */
+    Declarations *declarations;
+    ConstantIndex constants; /* dedupes the constants of the function being compiled */
 } Compiler;
 
-void init_compiler(Compiler *compiler, FunctionType type);
+void init_compiler(Compiler *compiler, FunctionType type, Heap *heap);
 ObjFunction *compiler_end(Compiler *);
 int compiler_resolve_local(Compiler *compiler, Token token);
+uint32_t compiler_add_constant(Compiler *compiler, Value value); /* index of value in the function's pool */
+int compiler_declare_global(Compiler *compiler, ObjString *name, size_t row, size_t col, Value value);
+int compiler_resolve_global(Compiler *compiler, char *name);
+Declaration *compiler_global_at(Compiler *compiler, int slot);
 void compiler_dump(Compiler *compiler, FILE *stream);
 void compiler_free(Compiler *compiler);
 #endif
\ No newline at end of file
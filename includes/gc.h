@@ -0,0 +1,131 @@
+#ifndef GC_H
+#define GC_H
+#include <pthread.h>
+#include <stdatomic.h>
+#include "VM.h"
+#include "pool.h"
+
+#define GC_INITIAL_THRESHOLD (1024 * 1024)
+#define GC_DEFAULT_GROWTH_FACTOR 2.0
+#define GC_NURSERY_SIZE (256 * 1024)
+
+define_array(GrayStack, Obj *);
+define_array(RememberedSlots, uint16_t);
+define_array(RememberedTables, Table *);
+define_array(Pauses, double);
+
+typedef enum
+{
+    GC_IDLE,
+    GC_MARKING,
+    GC_SWEEPING,
+} GCPhase;
+
+/* work handed to the collector thread */
+typedef enum
+{
+    GC_JOB_NONE,
+    GC_JOB_MARK,
+    GC_JOB_SWEEP,
+    GC_JOB_EXIT,
+} GCJob;
+
+/*
+ * everything one interpreter allocates from. a heap is used by one thread
+ * at a time, heaps share nothing, so VMs on separate heaps run in parallel.
+ *
+ * collections only run while a VM is attached, its stack, frames, globals,
+ * declarations and interned strings are the roots.
+ *
+ * strings are bump allocated in a nursery, a minor collection copies the
+ * ones still reachable into the old space, which a mark-and-sweep major
+ * collection manages. since objects move, collecting never happens inside
+ * an allocation: allocating only sets pending and the VM collects at a
+ * safepoint where it holds no object pointers outside its stack.
+ *
+ * in concurrent mode major collections are traced and swept by a collector
+ * thread, the VM only pauses to gray its roots and to remark.
+ */
+struct Heap
+{
+    Obj *objects; /* every old object, walked by the sweep */
+    Pool pool;
+    VM *vm;
+    bool pending; /* a collection is due at the next safepoint */
+    size_t bytes_allocated;
+    size_t next_gc;
+    double growth_factor;
+    GrayStack gray_stack;
+
+    /* bump allocated young space, emptied by every minor collection */
+    char *nursery;
+    char *nursery_top;
+    char *nursery_end;
+    bool nursery_full;
+
+    /*
+     * old locations that may point into the nursery, filled by the write
+     * barriers and cleared by every minor collection. global slots are
+     * deduplicated through a bit per slot.
+     */
+    RememberedSlots remembered_globals;
+    bool *remembered;
+    RememberedTables remembered_tables;
+
+    /*
+     * concurrent mode: the mutator grays the roots in a short pause, the
+     * collector thread traces while the VM keeps running, and a second pause
+     * drains the snapshot barrier buffer before the thread sweeps. heap
+     * objects never change their fields at runtime, so only globals and
+     * tables need the snapshot-at-the-beginning barrier; the stack is
+     * scanned inside the pauses. objects promoted or allocated while marking
+     * are allocated black.
+     */
+    bool concurrent;
+    GCPhase phase;
+    GrayStack satb_buffer;
+    pthread_t collector;
+    pthread_mutex_t job_lock;
+    pthread_cond_t job_ready;
+    GCJob job;
+    atomic_bool job_done;
+    Obj *sweep_list; /* old space detached for the collector thread to sweep */
+    Obj *swept_list; /* what survived it, spliced back at a safepoint */
+    Obj **swept_tail;
+    Obj *swept_dead; /* the pool is single threaded, the VM frees these when splicing */
+    size_t swept_bytes;
+
+    Pauses pauses;
+    size_t minor_count;
+    size_t major_count;
+};
+
+Heap *init_heap();
+void heap_free(Heap *heap); /* frees every object left, after the VM is detached */
+
+void gc_attach(Heap *heap, VM *vm);
+void gc_detach(Heap *heap);
+void gc_set_growth_factor(Heap *heap, double factor);
+void gc_set_concurrent(Heap *heap, bool enable); /* before gc_attach */
+Obj *gc_allocate_old(Heap *heap, size_t size); /* zeroed and linked into objects */
+Obj *gc_allocate_young(Heap *heap, size_t size); /* zeroed nursery memory, NULL when full or no VM is attached */
+bool gc_is_young(Heap *heap, Obj *object);
+/*
+ * marks every object of a heap no VM will run on for good. other heaps'
+ * collections then neither trace through nor write to them, so VMs on
+ * other heaps, in other threads too, may reference them.
+ */
+void gc_freeze(Heap *heap);
+/*
+ * write barriers, called after a store a VM makes into an old location,
+ * with the value it replaced. they remember old locations that start
+ * pointing into the nursery and, while marking, keep the replaced value
+ * alive.
+ */
+void gc_write_barrier_global(Heap *heap, uint16_t slot, Value previous, Value value);
+void gc_write_barrier_table(Heap *heap, Table *table, ObjString *key, Value previous, Value value);
+void gc_collect(Heap *heap);
+void gc_report(Heap *heap, FILE *stream); /* collection counts and pause time percentiles */
+void gc_mark_object(Heap *heap, Obj *object);
+void gc_mark_value(Heap *heap, Value value);
+#endif
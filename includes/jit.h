@@ -0,0 +1,88 @@
+#ifndef JIT_H
+#define JIT_H
+#include "VM.h"
+
+/* calls after which a function is compiled to native code */
+#define JIT_HOT_CALLS 100
+/* executable memory one VM compiles into, functions that no longer fit stay interpreted */
+#define JIT_CACHE_SIZE (4 * 1024 * 1024)
+/* back-edges after which an interpreted loop is recorded */
+#define JIT_HOT_LOOPS 50
+/* instructions a recorded iteration may take */
+#define JIT_TRACE_MAX 512
+/* recordings of a loop that may fail before it is left to the interpreter */
+#define JIT_TRACE_TRIES 4
+/* loop headers counted at once, a colliding loop starts over */
+#define JIT_LOOP_SLOTS 64
+/* exits after which native code is thrown away and its function or loop stays bytecode */
+#define JIT_DEOPT_EXITS 64
+
+/*
+ * baseline compiler for linux x86-64. a hot function's chunk is translated
+ * one instruction at a time by stitching together a machine code template
+ * per opcode into the VM's code cache. the native code works on the VM's
+ * own stack and frames, so the interpreter can take over at any
+ * instruction: numeric fast paths are guarded by the operand types and a
+ * failing guard hands the rest of the call to the interpreter, which then
+ * does what it always does. functions using an opcode without a template
+ * are never compiled.
+ *
+ * loops the interpreter runs, like the top level ones of a script which
+ * are never part of a call, are traced instead. their back-edges are
+ * counted and a hot one has its next iteration recorded: the instructions
+ * its frame executes with the types of the values they saw. the recording
+ * is translated with the same templates into straight line code that
+ * jumps back to its own start. what the recording saw is guarded once and
+ * then assumed along the trace, and a branch that goes the other way, or
+ * any failing guard, leaves the trace for the interpreter at that
+ * instruction.
+ *
+ * a loop that does not trace, or an interpreted call of a function that got
+ * compiled meanwhile, moves into the function's native code at a back-edge:
+ * compiled functions have an entry at every loop header, and as the frame
+ * is shared nothing else has to be carried over. the other way, native code
+ * that keeps handing control back to the interpreter is dropped, a function
+ * or loop that exits too often is deoptimized for good and runs as bytecode
+ * from then on.
+ *
+ * elsewhere, and in builds tracing execution, init_jit returns NULL and
+ * everything stays interpreted.
+ */
+typedef struct Jit Jit;
+
+/* what native code returns besides a VM_Error */
+typedef enum
+{
+    JIT_BAIL = -1, /* frame->ip is where the interpreter continues */
+    JIT_RESTART = -2, /* a tail call replaced the frame's function */
+    JIT_RETURN = -3, /* the frame returned natively, its value is on top of the stack */
+} JitStatus;
+
+typedef int (*JitCode)(VM *vm, CallFrame *frame);
+
+Jit *init_jit();
+void jit_free(Jit *jit);
+bool jit_compile(Jit *jit, ObjFunction *function); /* false when it has no template or the cache is full */
+VM_Error jit_run(VM *vm, CallFrame *frame); /* runs the frame on top until it returns */
+/* OP_TAIL_CALL from native code with ip past it, JIT_RESTART when the callee took over the frame */
+int jit_tail_call(VM *vm, CallFrame *frame, int arg_count, byte *ip);
+void jit_report(Jit *jit, FILE *stream);
+
+/*
+ * at a back-edge with frame->ip on the loop header, runs its trace or the
+ * function's native code. VM_OK when the interpreter goes on at frame->ip,
+ * JIT_RETURN or an error otherwise.
+ */
+int jit_loop(VM *vm, CallFrame *frame);
+bool jit_recording(Jit *jit);
+/* before each instruction while recording, false once the recording ended */
+bool jit_record(VM *vm, CallFrame *frame);
+
+/* counts a call and compiles the function once it gets hot, true when it has native code */
+static inline bool jit_hot(Jit *jit, ObjFunction *function)
+{
+    if (function->code != NULL)
+        return true;
+    return jit != NULL && ++function->calls == JIT_HOT_CALLS && jit_compile(jit, function);
+}
+#endif
@@ -17,6 +17,7 @@ Value clock_native(VM *vm, Value *args);
 Value typeof_native(VM *vm, Value *args);
 Value to_string_native(VM *vm, Value *args);
 Value len_native(VM *vm, Value *args);
-void native_init(Table *globals);
+Value input_native(VM *vm, Value *args);
+void native_init(Compiler *compiler);
 
 #endif
\ No newline at end of file
@@ -14,16 +14,20 @@ typedef enum
 struct Obj
 {
     ObjType type;
+    bool is_marked;
     Obj *next;
 };
 
+/* owns the objects allocated from it, see gc.h */
+typedef struct Heap Heap;
+
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
-#define ALLOCATE_OBJ(type, objectType) \
-    (type *)object_allocate(sizeof(type), objectType)
+#define ALLOCATE_OBJ(heap, type, objectType) \
+    (type *)object_allocate(heap, sizeof(type), objectType)
 
-Obj *object_allocate(size_t size, ObjType type);
+Obj *object_allocate(Heap *heap, size_t size, ObjType type);
 bool is_obj_type(Value value, ObjType type);
-void object_print(Value value);
+void object_print(Value value, FILE *stream);
 
 typedef struct VM x;
 typedef Value (*NativeFn)(x *vm, Value *args);
@@ -43,6 +47,10 @@ typedef struct
     Chunk *chunk;
     Values *values;
     ObjString *name;
+    void *blob; /* set once finalized, holds chunk and values */
+    uint32_t calls; /* counted until it gets hot, see jit.h */
+    void *code; /* native code once compiled */
+    uint32_t bails; /* calls its native code handed to the interpreter */
 } ObjFunction;
 
 typedef struct
@@ -51,6 +59,7 @@ typedef struct
     NativeFn function;
     int arity;
     ObjString *name;
+    void *data; /* an embedder's callback, found through args[-1] by the function */
 } ObjNative;
 
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
@@ -62,14 +71,19 @@ typedef struct
 #define IS_FUNCTION(value) is_obj_type(value, OBJ_FUNCTION)
 #define IS_NATIVE(value) is_obj_type(value, OBJ_NATIVE)
 
-ObjString *cstr_to_objstr(char *chars);
-ObjString *new_string(char *chars, size_t length);
-ObjString *allocate_string(size_t length, uint32_t hash);
+ObjString *cstr_to_objstr(Heap *heap, char *chars);
+ObjString *new_string(Heap *heap, char *chars, size_t length);
+ObjString *allocate_string(Heap *heap, size_t length, uint32_t hash);
+ObjString *string_concat(Heap *heap, ObjString *a, ObjString *b);
 
-ObjFunction *new_function();
+ObjFunction *new_function(Heap *heap);
+void function_finalize(ObjFunction *function);
+ObjFunction *function_copy(Heap *heap, ObjFunction *function); /* finished functions only */
 
-void objects_free();
+size_t object_size(Obj *object);
+void object_free(Heap *heap, Obj *object);
+void objects_free(Heap *heap);
 
 char *value_typeof(Value value);
-ObjNative *new_native(NativeFn function, int arity);
+ObjNative *new_native(Heap *heap, NativeFn function, int arity);
 #endif
\ No newline at end of file
@@ -0,0 +1,12 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "object.h"
+#include "AST.h"
+
+/* peephole pass over a finished function, rewrites its chunk in place */
+void optimizer_optimize(ObjFunction *function);
+/* folds constant subexpressions of the tree in place, returns the node replacing ast */
+AST *optimizer_fold(AST *ast);
+
+#endif
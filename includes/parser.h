@@ -12,6 +12,7 @@ typedef struct
     bool parsing_call;
     int is_looping;
     Lexer *lexer;
+    Arena *arena; /* owns the tree being built */
 } Parser;
 
 typedef enum
@@ -34,7 +35,7 @@ typedef enum
     PREC_POSTIFX,     // . () ++ -- []
 } Precedence;
 char *parser_prec_to_str(Precedence prec);
-Parser *init_parser(Lexer *lexer);
+Parser *init_parser(Lexer *lexer, Arena *arena);
 Token parser_advance(Parser *parser);
 AST *parser_parse(Parser *parser);
 AST *parser_parse_decl(Parser *parser);
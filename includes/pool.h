@@ -0,0 +1,32 @@
+#ifndef POOL_H
+#define POOL_H
+#include <stddef.h>
+
+#define POOL_PAGE_SIZE (64 * 1024)
+#define POOL_GRANULE 16
+#define POOL_SMALL_MAX 256 /* anything larger goes straight to calloc */
+#define POOL_SIZE_CLASSES (POOL_SMALL_MAX / POOL_GRANULE)
+#define POOL_CACHED_PAGES 8 /* empty pages kept around for any size class */
+
+/*
+ * size class slab allocator for heap objects. every class carves page
+ * aligned slabs into equal slots, each page keeps its own free list, and a
+ * page whose slots are all free goes back to the pool's cache so another
+ * class can reuse it.
+ *
+ * frees are sized, callers pass the size they allocated, and go to the pool
+ * the slot came from. a pool is not thread safe, each heap owns one.
+ */
+typedef struct Page Page;
+
+typedef struct
+{
+    Page *available[POOL_SIZE_CLASSES]; /* pages with free slots, by size class */
+    Page *cached; /* empty pages */
+    size_t cached_count;
+} Pool;
+
+void *pool_allocate(Pool *pool, size_t size); /* zeroed */
+void pool_free(Pool *pool, void *pointer, size_t size);
+void pool_release(Pool *pool); /* returns the cached empty pages to the system */
+#endif
@@ -4,6 +4,7 @@
 #include "object.h"
 
 #define TABLE_MAX_LOAD 0.75
+#define TABLE_INITIAL_CAPACITY 8
 
 typedef struct
 {
@@ -5,7 +5,6 @@
 #include <stdint.h>
 #include "array.h"
 
-typedef struct Value Value;
 typedef struct Obj Obj;
 typedef uint8_t byte;
 
@@ -18,6 +17,67 @@ typedef enum
     VAL_UNDEF,
 } ValueType;
 
+#ifdef NAN_BOXING
+/*
+ * every value is a single 64 bit word. numbers are stored as plain doubles,
+ * everything else lives inside the unused payload of a quiet NaN:
+ * objects set the sign bit and keep the pointer in the low 48 bits,
+ * singletons (null, false, true, undefined) use a small tag in the low bits.
+ */
+#include <string.h>
+
+typedef uint64_t Value;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NULL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+#define TAG_UNDEF 4
+
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+static inline double value_to_num(Value value)
+{
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+static inline Value num_to_value(double num)
+{
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+#define BOOL_VAL(value) ((value) ? TRUE_VAL : FALSE_VAL)
+#define NULL_VAL ((Value)(uint64_t)(QNAN | TAG_NULL))
+#define NUMBER_VAL(value) num_to_value(value)
+#define OBJ_VAL(object) (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(object))
+#define UNDEF_VAL ((Value)(uint64_t)(QNAN | TAG_UNDEF))
+
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) value_to_num(value)
+#define AS_INTEGRAL(value) ((int)value_to_num(value))
+#define AS_OBJ(value) ((Obj *)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NULL(value) ((value) == NULL_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_UNDEF(value) ((value) == UNDEF_VAL)
+
+#define VALUE_TYPE(value) (IS_NUMBER(value) ? VAL_NUMBER : IS_OBJ(value) ? VAL_OBJ \
+                                            : IS_BOOL(value)    ? VAL_BOOL       \
+                                            : IS_NULL(value)    ? VAL_NULL       \
+                                                                : VAL_UNDEF)
+
+#else
+
+typedef struct Value Value;
+
 struct Value
 {
     ValueType type;
@@ -27,16 +87,13 @@ struct Value
         double number;
         Obj *obj;
     } as;
-
-    uint32_t row;
-    uint32_t col;
 };
 
-#define BOOL_VAL(value, row, col) ((Value){VAL_BOOL, {.boolean = value}, row, col})
-#define NULL_VAL(row, col) ((Value){VAL_NULL, {.number = 0}, row, col})
-#define NUMBER_VAL(value, row, col) ((Value){VAL_NUMBER, {.number = value}, row, col})
-#define OBJ_VAL(object, row, col) ((Value){VAL_OBJ, {.obj = (Obj *)object}, row, col})
-#define UNDEF_VAL(row, col) ((Value){VAL_UNDEF, {.number = 0}, row, col})
+#define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = value}})
+#define NULL_VAL ((Value){VAL_NULL, {.number = 0}})
+#define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj *)object}})
+#define UNDEF_VAL ((Value){VAL_UNDEF, {.number = 0}})
 
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
@@ -49,6 +106,9 @@ struct Value
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
 #define IS_UNDEF(value) ((value).type == VAL_UNDEF)
 
+#define VALUE_TYPE(value) ((value).type)
+#endif
+
 typedef struct
 {
     Value *items;
@@ -57,9 +117,9 @@ typedef struct
 } Values;
 
 Values *init_values();
-byte value_push(Values *values, Value data); /*returns index of the data */
+size_t value_push(Values *values, Value data); /*returns index of the data */
 Value value_pop(Values *values);
 void values_dump(Values *values, FILE *stream);
 void values_free(Values *values);
-void value_print(Value value,uint8_t new_ln);
+void value_print(Value value, uint8_t new_ln, FILE *stream);
 #endif
\ No newline at end of file
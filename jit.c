@@ -0,0 +1,1516 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "jit.h"
+#include "gc.h"
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(DEBUG_TRACE_EXECUTION)
+#define JIT_X86_64
+#endif
+
+/*
+ * running native code, whether this file compiled it or it was compiled
+ * ahead of time (see aot.h), works the same in every build
+ */
+static void jit_bailed(Jit *jit, ObjFunction *function);
+
+static int jit_call(VM *vm, CallFrame *frame, int arg_count, byte *ip)
+{
+    frame->ip = ip;
+    return vm_invoke(vm, frame, arg_count);
+}
+int jit_tail_call(VM *vm, CallFrame *frame, int arg_count, byte *ip)
+{
+    Value callee = vm->sp[-1 - arg_count];
+    if (!IS_FUNCTION(callee) || AS_FUNCTION(callee)->arity != arg_count)
+        return jit_call(vm, frame, arg_count, ip);
+    Value *args = vm->sp - arg_count - 1;
+    for (int i = 0; i <= arg_count; i++)
+        frame->slots[i] = args[i];
+    vm->sp = frame->slots + arg_count + 1;
+    vm->stack.count = (size_t)(vm->sp - vm->stack.items);
+    frame->function = AS_FUNCTION(callee);
+    frame->ip = frame->function->chunk->items;
+    jit_hot(vm->jit, frame->function);
+    return JIT_RESTART;
+}
+/* runs the frame natively from frame->ip, JIT_BAIL when the interpreter has to go on with it */
+static int jit_enter(VM *vm, CallFrame *frame)
+{
+    for (;;)
+    {
+        ObjFunction *function = frame->function;
+        JitCode code = (JitCode)function->code;
+        int status = code != NULL ? code(vm, frame) : JIT_BAIL;
+        if (status == JIT_RESTART)
+            continue;
+        if (status == JIT_BAIL && code != NULL)
+            jit_bailed(vm->jit, function);
+        return status;
+    }
+}
+VM_Error jit_run(VM *vm, CallFrame *frame)
+{
+    int base = (int)(frame - vm->frames);
+    int status = jit_enter(vm, frame);
+    if (status == JIT_BAIL)
+        return vm_run(vm, base);
+    // the outermost frame returned natively, its value is what the interpreter would have kept
+    if (status == VM_OK && vm->frame_count == 0)
+    {
+        vm->result = *--vm->sp;
+        vm->stack.count--;
+    }
+    return (VM_Error)status;
+}
+/* on-stack replacement, the interpreted frame goes on in its function's native code */
+static int jit_replace(VM *vm, CallFrame *frame)
+{
+    int status = jit_enter(vm, frame);
+    if (status == JIT_BAIL)
+        return VM_OK;
+    return status == VM_OK ? JIT_RETURN : status;
+}
+
+#ifdef JIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* a loop header the interpreter came back to */
+typedef struct
+{
+    byte *header;
+    byte *end; /* its back-edge, exits up to here are in the middle of an iteration */
+    JitCode trace;
+    uint32_t count; /* back-edges since it was last recorded */
+    uint32_t aborts; /* recordings that did not make a trace */
+    uint32_t exits; /* of its trace in the middle of an iteration */
+} JitLoop;
+
+/* an instruction of a recorded iteration and the types it saw, JIT_UNKNOWN where there is no value */
+typedef struct
+{
+    byte *ip;
+    byte top[2]; /* the value on top and the one below it */
+    byte operand; /* the local or global it reads */
+} JitRecord;
+
+#define JIT_UNKNOWN 0xff
+
+define_array(JitRecords, JitRecord);
+
+struct Jit
+{
+    byte *cache; /* mapped on the first compile */
+    size_t used;
+    size_t compiled;
+    size_t rejected; /* hot functions with an opcode that has no template, or a jump it cannot follow */
+    size_t full; /* hot functions the cache had no room for */
+    JitLoop loops[JIT_LOOP_SLOTS];
+    JitLoop *recording; /* NULL unless a loop is being recorded */
+    int recording_frame;
+    ObjFunction *recording_function;
+    JitRecords records;
+    size_t traces;
+    size_t aborted; /* recordings given up on */
+    size_t replaced; /* interpreted frames moved into native code at a back-edge */
+    size_t deoptimized;
+};
+
+define_array(JitBuffer, byte);
+
+/* a rel32 waiting for where it jumps: a bytecode offset, or for a guard the instruction it bails on */
+typedef struct
+{
+    size_t at;
+    size_t offset;
+} JitFixup;
+
+define_array(JitFixups, JitFixup);
+
+typedef struct
+{
+    JitBuffer code;
+    size_t *labels; /* native offset of every instruction, by bytecode offset */
+    JitFixups jumps;
+    JitFixups bails;
+    size_t offset; /* of the instruction being translated */
+    size_t resume; /* where its guards hand over, the instruction itself unless it already had an effect */
+    size_t leave; /* restores the callee saved registers and returns eax */
+    size_t bail; /* stores rax into frame->ip and returns JIT_BAIL */
+
+    // traces only, what is known about the values at the instruction being translated
+    JitRecord *records; /* NULL when compiling a whole function */
+    size_t record_count;
+    size_t record;
+    byte *chunk;
+    size_t loop; /* native offset the trace jumps back to */
+    byte stack[JIT_TRACE_MAX]; /* types of the values pushed since the loop header */
+    int depth;
+    byte locals[UINT8_COUNT];
+    byte *globals;
+    size_t global_count;
+    bool failed; /* the recording does something the trace cannot follow */
+} JitEmitter;
+
+/*
+ * register use of the generated code, everything else is scratch:
+ * rbx the VM, r12 the stack top, r13 the frame's slots, r14 the frame and
+ * r15 the function's constants. r12 is written back to vm->sp before
+ * anything that looks at the stack from C.
+ */
+typedef enum
+{
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+} JitRegister;
+
+typedef enum
+{
+    CC_B = 0x2,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_A = 0x7,
+    CC_P = 0xa,
+    CC_NP = 0xb,
+    // what ucomisd needs two jumps for, negated by flipping the low bit like the others
+    CC_UNEQUAL = 0x10, /* unordered or not equal */
+    CC_ORDERED_EQUAL = 0x11,
+} JitCondition;
+
+#define JIT_SP R12
+#define JIT_SLOTS R13
+#define JIT_FRAME R14
+#define JIT_CONSTANTS R15
+
+#define VALUE_SIZE ((int32_t)sizeof(Value))
+#ifdef NAN_BOXING
+#define VALUE_DATA 0
+#define VALUE_SHIFT 3
+#else
+#define VALUE_DATA ((int32_t)offsetof(Value, as))
+#define VALUE_SHIFT 4
+#endif
+
+static void emit_byte(JitEmitter *emitter, byte data)
+{
+    array_push(&emitter->code, data);
+}
+static void emit_u32(JitEmitter *emitter, uint32_t data)
+{
+    for (int i = 0; i < 4; i++)
+        emit_byte(emitter, (byte)(data >> (8 * i)));
+}
+static void emit_u64(JitEmitter *emitter, uint64_t data)
+{
+    for (int i = 0; i < 8; i++)
+        emit_byte(emitter, (byte)(data >> (8 * i)));
+}
+static void emit_rex(JitEmitter *emitter, bool wide, int reg, int base)
+{
+    byte rex = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((base & 8) ? 0x01 : 0);
+    if (rex != 0x40)
+        emit_byte(emitter, rex);
+}
+/* [base + disp32] operand */
+static void emit_memory(JitEmitter *emitter, int reg, int base, int32_t disp)
+{
+    emit_byte(emitter, 0x80 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == RSP)
+        emit_byte(emitter, 0x24);
+    emit_u32(emitter, (uint32_t)disp);
+}
+static void emit_direct(JitEmitter *emitter, int reg, int rm)
+{
+    emit_byte(emitter, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void emit_load(JitEmitter *emitter, JitRegister dst, JitRegister base, int32_t disp)
+{
+    emit_rex(emitter, true, dst, base);
+    emit_byte(emitter, 0x8b);
+    emit_memory(emitter, dst, base, disp);
+}
+static void emit_store(JitEmitter *emitter, JitRegister base, int32_t disp, JitRegister src)
+{
+    emit_rex(emitter, true, src, base);
+    emit_byte(emitter, 0x89);
+    emit_memory(emitter, src, base, disp);
+}
+#ifndef NAN_BOXING
+/* the tagged layout's type word */
+static void emit_store_imm32(JitEmitter *emitter, JitRegister base, int32_t disp, uint32_t imm)
+{
+    emit_rex(emitter, false, 0, base);
+    emit_byte(emitter, 0xc7);
+    emit_memory(emitter, 0, base, disp);
+    emit_u32(emitter, imm);
+}
+static void emit_cmp_imm8(JitEmitter *emitter, JitRegister base, int32_t disp, int8_t imm)
+{
+    emit_rex(emitter, false, 0, base);
+    emit_byte(emitter, 0x83);
+    emit_memory(emitter, 7, base, disp);
+    emit_byte(emitter, (byte)imm);
+}
+static void emit_cmp_byte_zero(JitEmitter *emitter, JitRegister base, int32_t disp)
+{
+    emit_rex(emitter, false, 0, base);
+    emit_byte(emitter, 0x80);
+    emit_memory(emitter, 7, base, disp);
+    emit_byte(emitter, 0);
+}
+#endif
+static void emit_lea(JitEmitter *emitter, JitRegister dst, JitRegister base, int32_t disp)
+{
+    emit_rex(emitter, true, dst, base);
+    emit_byte(emitter, 0x8d);
+    emit_memory(emitter, dst, base, disp);
+}
+static void emit_mov_imm(JitEmitter *emitter, JitRegister dst, uint64_t imm)
+{
+    emit_rex(emitter, true, 0, dst);
+    emit_byte(emitter, 0xb8 + (dst & 7));
+    emit_u64(emitter, imm);
+}
+/* dst op= src for the two operand ALU forms, 0x89 is mov */
+static void emit_alu(JitEmitter *emitter, byte op, JitRegister dst, JitRegister src)
+{
+    emit_rex(emitter, true, src, dst);
+    emit_byte(emitter, op);
+    emit_direct(emitter, src, dst);
+}
+#define ALU_ADD 0x01
+#define ALU_AND 0x21
+#define ALU_SUB 0x29
+#define ALU_CMP 0x39
+#define ALU_MOV 0x89
+
+/* scalar double op with a memory operand: 0x10 load, 0x11 store, 0x58 add, 0x59 mul, 0x5c sub, 0x5e div */
+static void emit_sd_memory(JitEmitter *emitter, byte op, int xmm, JitRegister base, int32_t disp)
+{
+    emit_byte(emitter, 0xf2);
+    emit_rex(emitter, false, xmm, base);
+    emit_byte(emitter, 0x0f);
+    emit_byte(emitter, op);
+    emit_memory(emitter, xmm, base, disp);
+}
+static void emit_ucomisd(JitEmitter *emitter, int a, int b)
+{
+    emit_byte(emitter, 0x66);
+    emit_byte(emitter, 0x0f);
+    emit_byte(emitter, 0x2e);
+    emit_direct(emitter, a, b);
+}
+static void emit_call(JitEmitter *emitter, void *function)
+{
+    emit_mov_imm(emitter, RAX, (uint64_t)(uintptr_t)function);
+    emit_byte(emitter, 0xff);
+    emit_direct(emitter, 2, RAX);
+}
+static void emit_push(JitEmitter *emitter, JitRegister reg)
+{
+    emit_rex(emitter, false, 0, reg);
+    emit_byte(emitter, 0x50 + (reg & 7));
+}
+static void emit_pop(JitEmitter *emitter, JitRegister reg)
+{
+    emit_rex(emitter, false, 0, reg);
+    emit_byte(emitter, 0x58 + (reg & 7));
+}
+/* jumps backwards to code already emitted */
+static void emit_jump_to(JitEmitter *emitter, int condition, size_t target)
+{
+    if (condition < 0)
+        emit_byte(emitter, 0xe9);
+    else
+    {
+        emit_byte(emitter, 0x0f);
+        emit_byte(emitter, 0x80 | condition);
+    }
+    emit_u32(emitter, (uint32_t)(target - (array_size(&emitter->code) + 4)));
+}
+/* a forward jump for the fixups to patch, bytecode offset and all */
+static void emit_fixup(JitEmitter *emitter, int condition, size_t offset, JitFixups *fixups)
+{
+    if (condition == CC_UNEQUAL)
+    {
+        emit_fixup(emitter, CC_P, offset, fixups);
+        emit_fixup(emitter, CC_NE, offset, fixups);
+        return;
+    }
+    if (condition == CC_ORDERED_EQUAL)
+    {
+        emit_byte(emitter, 0x7a); // jp over the je
+        emit_byte(emitter, 6);
+        condition = CC_E;
+    }
+    emit_jump_to(emitter, condition, array_size(&emitter->code));
+    JitFixup fixup = {array_size(&emitter->code) - 4, offset};
+    array_push(fixups, fixup);
+}
+/* jumps to an instruction of the chunk, patched once they are all emitted */
+static void emit_jump(JitEmitter *emitter, int condition, size_t offset)
+{
+    emit_fixup(emitter, condition, offset, &emitter->jumps);
+}
+/* hands the interpreter the instruction at offset when condition holds */
+static void emit_exit(JitEmitter *emitter, int condition, size_t offset)
+{
+    emit_fixup(emitter, condition, offset, &emitter->bails);
+}
+/* hands the current instruction to the interpreter when condition holds */
+static void emit_bail(JitEmitter *emitter, int condition)
+{
+    emit_exit(emitter, condition, emitter->resume);
+}
+static void emit_patch(JitEmitter *emitter, size_t at, size_t target)
+{
+    uint32_t rel = (uint32_t)(target - (at + 4));
+    memcpy(&emitter->code.items[at], &rel, sizeof(rel));
+}
+
+/* vm->sp and vm->stack.count from r12 */
+static void emit_sync_stack(JitEmitter *emitter)
+{
+    emit_store(emitter, RBX, offsetof(VM, sp), JIT_SP);
+    emit_alu(emitter, ALU_MOV, RAX, JIT_SP);
+    emit_lea(emitter, RCX, RBX, offsetof(VM, stack.items));
+    emit_alu(emitter, ALU_SUB, RAX, RCX);
+    emit_rex(emitter, true, 0, RAX);
+    emit_byte(emitter, 0xc1); // sar rax, imm8
+    emit_direct(emitter, 7, RAX);
+    emit_byte(emitter, VALUE_SHIFT);
+    emit_store(emitter, RBX, offsetof(VM, stack.count), RAX);
+}
+static void emit_reload_stack(JitEmitter *emitter)
+{
+    emit_load(emitter, JIT_SP, RBX, offsetof(VM, sp));
+}
+
+/*
+ * what a trace knows about types, a ValueType or JIT_UNKNOWN. a function is
+ * compiled knowing nothing, so there all of this is a no-op.
+ */
+static bool jit_tracing(JitEmitter *emitter)
+{
+    return emitter->records != NULL;
+}
+/* the type the recording saw for the instruction's local or global */
+static byte jit_observed(JitEmitter *emitter)
+{
+    return jit_tracing(emitter) ? emitter->records[emitter->record].operand : JIT_UNKNOWN;
+}
+/* of the value n from the top, 1 being the top */
+static byte jit_type(JitEmitter *emitter, int n)
+{
+    if (!jit_tracing(emitter) || emitter->depth < n)
+        return JIT_UNKNOWN;
+    return emitter->stack[emitter->depth - n];
+}
+static void jit_pop_types(JitEmitter *emitter, int count)
+{
+    if (!jit_tracing(emitter))
+        return;
+    // below the header are values the loop does not own
+    if (emitter->depth < count)
+        emitter->failed = true;
+    emitter->depth = emitter->depth < count ? 0 : emitter->depth - count;
+}
+static void jit_push_type(JitEmitter *emitter, byte type)
+{
+    if (!jit_tracing(emitter))
+        return;
+    if (emitter->depth == JIT_TRACE_MAX)
+    {
+        emitter->failed = true;
+        return;
+    }
+    emitter->stack[emitter->depth++] = type;
+}
+static byte jit_local_type(JitEmitter *emitter, uint32_t slot)
+{
+    return jit_tracing(emitter) && slot < UINT8_COUNT ? emitter->locals[slot] : JIT_UNKNOWN;
+}
+static void jit_set_local_type(JitEmitter *emitter, uint32_t slot, byte type)
+{
+    if (jit_tracing(emitter) && slot < UINT8_COUNT)
+        emitter->locals[slot] = type;
+}
+static byte jit_global_type(JitEmitter *emitter, uint32_t slot)
+{
+    return jit_tracing(emitter) && slot < emitter->global_count ? emitter->globals[slot] : JIT_UNKNOWN;
+}
+static void jit_set_global_type(JitEmitter *emitter, uint32_t slot, byte type)
+{
+    if (jit_tracing(emitter) && slot < emitter->global_count)
+        emitter->globals[slot] = type;
+}
+/* true when the recording went on at target after the current instruction */
+static bool jit_recorded_at(JitEmitter *emitter, size_t target)
+{
+    return emitter->record + 1 < emitter->record_count && emitter->records[emitter->record + 1].ip == emitter->chunk + target;
+}
+
+/* value templates, the only code that knows how a Value is laid out */
+static void emit_copy_value(JitEmitter *emitter, JitRegister dst, int32_t dst_disp, JitRegister src, int32_t src_disp)
+{
+    emit_load(emitter, RCX, src, src_disp);
+    emit_store(emitter, dst, dst_disp, RCX);
+#ifndef NAN_BOXING
+    emit_load(emitter, RDX, src, src_disp + 8);
+    emit_store(emitter, dst, dst_disp + 8, RDX);
+#endif
+}
+static void emit_guard_number(JitEmitter *emitter, JitRegister base, int32_t disp)
+{
+#ifdef NAN_BOXING
+    emit_load(emitter, RCX, base, disp);
+    emit_mov_imm(emitter, RDX, QNAN);
+    emit_alu(emitter, ALU_AND, RCX, RDX);
+    emit_alu(emitter, ALU_CMP, RCX, RDX);
+    emit_bail(emitter, CC_E);
+#else
+    emit_cmp_imm8(emitter, base, disp + (int32_t)offsetof(Value, type), VAL_NUMBER);
+    emit_bail(emitter, CC_NE);
+#endif
+}
+static void emit_guard_defined(JitEmitter *emitter, JitRegister base, int32_t disp)
+{
+#ifdef NAN_BOXING
+    emit_load(emitter, RCX, base, disp);
+    emit_mov_imm(emitter, RDX, UNDEF_VAL);
+    emit_alu(emitter, ALU_CMP, RCX, RDX);
+#else
+    emit_cmp_imm8(emitter, base, disp + (int32_t)offsetof(Value, type), VAL_UNDEF);
+#endif
+    emit_bail(emitter, CC_E);
+}
+static void emit_store_number(JitEmitter *emitter, JitRegister base, int32_t disp, int xmm)
+{
+#ifndef NAN_BOXING
+    emit_store_imm32(emitter, base, disp + (int32_t)offsetof(Value, type), VAL_NUMBER);
+#endif
+    emit_sd_memory(emitter, 0x11, xmm, base, disp + VALUE_DATA);
+}
+/* from al, zero or one */
+static void emit_store_bool(JitEmitter *emitter, JitRegister base, int32_t disp)
+{
+    emit_byte(emitter, 0x0f); // movzx eax, al
+    emit_byte(emitter, 0xb6);
+    emit_direct(emitter, RAX, RAX);
+#ifdef NAN_BOXING
+    emit_mov_imm(emitter, RCX, FALSE_VAL);
+    emit_alu(emitter, ALU_ADD, RAX, RCX);
+    emit_store(emitter, base, disp, RAX);
+#else
+    emit_store_imm32(emitter, base, disp + (int32_t)offsetof(Value, type), VAL_BOOL);
+    emit_store(emitter, base, disp + VALUE_DATA, RAX);
+#endif
+}
+/* a guard unless the trace already knows it is a number */
+static void emit_check_number(JitEmitter *emitter, JitRegister base, int32_t disp, byte known)
+{
+    if (known != VAL_NUMBER)
+        emit_guard_number(emitter, base, disp);
+}
+static void emit_push_value(JitEmitter *emitter, JitRegister base, int32_t disp)
+{
+    emit_copy_value(emitter, JIT_SP, 0, base, disp);
+    emit_lea(emitter, JIT_SP, JIT_SP, VALUE_SIZE);
+}
+static void emit_drop(JitEmitter *emitter, int count)
+{
+    emit_lea(emitter, JIT_SP, JIT_SP, -count * VALUE_SIZE);
+}
+static void emit_check_operands(JitEmitter *emitter)
+{
+    emit_check_number(emitter, JIT_SP, -2 * VALUE_SIZE, jit_type(emitter, 2));
+    emit_check_number(emitter, JIT_SP, -VALUE_SIZE, jit_type(emitter, 1));
+}
+/* xmm0 and xmm1 from the two topmost values, both guarded to be numbers */
+static void emit_number_operands(JitEmitter *emitter)
+{
+    emit_check_operands(emitter);
+    emit_sd_memory(emitter, 0x10, 0, JIT_SP, -2 * VALUE_SIZE + VALUE_DATA);
+    emit_sd_memory(emitter, 0x10, 1, JIT_SP, -VALUE_SIZE + VALUE_DATA);
+}
+static void emit_arithmetic(JitEmitter *emitter, byte op)
+{
+    emit_check_operands(emitter);
+    emit_sd_memory(emitter, 0x10, 0, JIT_SP, -2 * VALUE_SIZE + VALUE_DATA);
+    emit_sd_memory(emitter, op, 0, JIT_SP, -VALUE_SIZE + VALUE_DATA);
+    emit_store_number(emitter, JIT_SP, -2 * VALUE_SIZE, 0);
+    emit_drop(emitter, 1);
+}
+/* (int)a % (int)b, a zero or minus one divisor is left to the interpreter */
+static void emit_mod(JitEmitter *emitter)
+{
+    emit_check_operands(emitter);
+    emit_sd_memory(emitter, 0x2c, RAX, JIT_SP, -2 * VALUE_SIZE + VALUE_DATA); // cvttsd2si eax
+    emit_sd_memory(emitter, 0x2c, RCX, JIT_SP, -VALUE_SIZE + VALUE_DATA); // cvttsd2si ecx
+    const byte divide[] = {
+        0x85, 0xc9, // test ecx, ecx
+    };
+    for (size_t i = 0; i < sizeof(divide); i++)
+        emit_byte(emitter, divide[i]);
+    emit_bail(emitter, CC_E);
+    emit_byte(emitter, 0x83); // cmp ecx, -1
+    emit_byte(emitter, 0xf9);
+    emit_byte(emitter, 0xff);
+    emit_bail(emitter, CC_E);
+    emit_byte(emitter, 0x99); // cdq
+    emit_byte(emitter, 0xf7); // idiv ecx
+    emit_byte(emitter, 0xf9);
+    emit_byte(emitter, 0xf2); // cvtsi2sd xmm0, edx
+    emit_byte(emitter, 0x0f);
+    emit_byte(emitter, 0x2a);
+    emit_direct(emitter, 0, RDX);
+    emit_store_number(emitter, JIT_SP, -2 * VALUE_SIZE, 0);
+    emit_drop(emitter, 1);
+}
+/*
+ * flags for a op b on xmm0 and xmm1, returns the condition that holds when
+ * it is true. an unordered compare sets ZF, PF and CF so NaN is never less
+ * or greater, equality has to look at PF itself.
+ */
+static JitCondition emit_compare(JitEmitter *emitter, byte instruction)
+{
+    switch (instruction)
+    {
+    case OP_LT:
+        emit_ucomisd(emitter, 1, 0);
+        return CC_A;
+    case OP_LTE:
+        emit_ucomisd(emitter, 1, 0);
+        return CC_AE;
+    case OP_GT:
+        emit_ucomisd(emitter, 0, 1);
+        return CC_A;
+    case OP_GTE:
+        emit_ucomisd(emitter, 0, 1);
+        return CC_AE;
+    default:
+        emit_ucomisd(emitter, 0, 1);
+        return CC_E;
+    }
+}
+static void emit_setcc(JitEmitter *emitter, JitCondition condition, JitRegister reg)
+{
+    emit_byte(emitter, 0x0f);
+    emit_byte(emitter, 0x90 | condition);
+    emit_direct(emitter, 0, reg);
+}
+static void emit_relational(JitEmitter *emitter, byte instruction)
+{
+    emit_number_operands(emitter);
+    JitCondition condition = emit_compare(emitter, instruction);
+    if (instruction == OP_EQUAL || instruction == OP_NOT_EQUAL)
+    {
+        bool equal = instruction == OP_EQUAL;
+        emit_setcc(emitter, equal ? CC_E : CC_NE, RAX);
+        emit_setcc(emitter, equal ? CC_NP : CC_P, RCX);
+        emit_byte(emitter, equal ? 0x20 : 0x08); // and/or al, cl
+        emit_direct(emitter, RCX, RAX);
+    }
+    else
+        emit_setcc(emitter, condition, RAX);
+    emit_store_bool(emitter, JIT_SP, -2 * VALUE_SIZE);
+    emit_drop(emitter, 1);
+}
+/*
+ * a conditional jump of the chunk to target, next being the instruction
+ * after it. a trace only follows the way the recording went, going the
+ * other way leaves it.
+ */
+static void emit_branch(JitEmitter *emitter, int condition, size_t target, size_t next)
+{
+    if (!jit_tracing(emitter))
+        emit_jump(emitter, condition, target);
+    else if (jit_recorded_at(emitter, target))
+        emit_exit(emitter, condition ^ 1, next);
+    else
+        emit_exit(emitter, condition, target);
+}
+/* compare-and-branch, pops both operands and jumps to target when the comparison is false */
+static void emit_compare_jump(JitEmitter *emitter, byte instruction, size_t target, size_t next)
+{
+    emit_number_operands(emitter);
+    emit_drop(emitter, 2);
+    JitCondition condition = emit_compare(emitter, instruction);
+    switch (instruction)
+    {
+    case OP_EQUAL:
+        emit_branch(emitter, CC_UNEQUAL, target, next);
+        break;
+    case OP_NOT_EQUAL:
+        emit_branch(emitter, CC_ORDERED_EQUAL, target, next);
+        break;
+    default:
+        emit_branch(emitter, condition ^ 1, target, next);
+        break;
+    }
+}
+/* the condition that holds when the top value is falsey, for a trace that knows its type */
+static JitCondition emit_test_falsey(JitEmitter *emitter, byte known)
+{
+    if (known == VAL_NUMBER)
+    {
+        emit_sd_memory(emitter, 0x10, 0, JIT_SP, -VALUE_SIZE + VALUE_DATA);
+        emit_byte(emitter, 0x0f); // xorps xmm1, xmm1
+        emit_byte(emitter, 0x57);
+        emit_direct(emitter, 1, 1);
+        emit_ucomisd(emitter, 0, 1);
+        return CC_ORDERED_EQUAL;
+    }
+#ifdef NAN_BOXING
+    emit_load(emitter, RCX, JIT_SP, -VALUE_SIZE);
+    emit_mov_imm(emitter, RDX, FALSE_VAL);
+    emit_alu(emitter, ALU_CMP, RCX, RDX);
+#else
+    emit_cmp_byte_zero(emitter, JIT_SP, -VALUE_SIZE + VALUE_DATA);
+#endif
+    return CC_E;
+}
+/* the plain opcode a quickened or fused one computes */
+static byte jit_relation(byte instruction)
+{
+    switch (instruction)
+    {
+    case OP_JMP_IF_NOT_EQUAL:
+    case OP_JMP_IF_NOT_EQUAL_LONG:
+    case OP_EQUAL_NUM:
+        return OP_EQUAL;
+    case OP_JMP_IF_NOT_NOT_EQUAL:
+    case OP_JMP_IF_NOT_NOT_EQUAL_LONG:
+    case OP_NOT_EQUAL_NUM:
+        return OP_NOT_EQUAL;
+    case OP_JMP_IF_NOT_LT:
+    case OP_JMP_IF_NOT_LT_LONG:
+    case OP_LT_NUM:
+        return OP_LT;
+    case OP_JMP_IF_NOT_LTE:
+    case OP_JMP_IF_NOT_LTE_LONG:
+    case OP_LTE_NUM:
+        return OP_LTE;
+    case OP_JMP_IF_NOT_GT:
+    case OP_JMP_IF_NOT_GT_LONG:
+    case OP_GT_NUM:
+        return OP_GT;
+    case OP_JMP_IF_NOT_GTE:
+    case OP_JMP_IF_NOT_GTE_LONG:
+    case OP_GTE_NUM:
+        return OP_GTE;
+    default:
+        return instruction;
+    }
+}
+
+/* helpers the generated code calls, the stack is synced before each */
+static bool jit_falsey(Value *value)
+{
+    return is_falsey(*value);
+}
+static void jit_print(VM *vm)
+{
+    vm->sp--;
+    value_print(*vm->sp, 1, vm->out);
+}
+static void jit_define_global(VM *vm, uint32_t slot)
+{
+    Value *global = &array_at(vm->globals, slot);
+    Value previous = *global;
+    vm->sp--;
+    *global = *vm->sp;
+    gc_write_barrier_global(vm->heap, (uint16_t)slot, previous, *global);
+}
+/* false when the global is not defined yet, the interpreter reports it */
+static bool jit_set_global(VM *vm, uint32_t slot)
+{
+    Value *global = &array_at(vm->globals, slot);
+    if (IS_UNDEF(*global))
+        return false;
+    Value previous = *global;
+    *global = vm->sp[-1];
+    gc_write_barrier_global(vm->heap, (uint16_t)slot, previous, *global);
+    return true;
+}
+
+static void emit_helper_args(JitEmitter *emitter, int arg_count, uint64_t second, uint64_t third)
+{
+    emit_alu(emitter, ALU_MOV, RDI, RBX);
+    if (arg_count > 1)
+        emit_mov_imm(emitter, RSI, second);
+    if (arg_count > 2)
+        emit_mov_imm(emitter, RDX, third);
+}
+/* jit_call and jit_tail_call, any status but VM_OK leaves the function */
+static void emit_call_helper(JitEmitter *emitter, void *helper, int arg_count, byte *next)
+{
+    emit_store(emitter, RBX, offsetof(VM, sp), JIT_SP);
+    emit_alu(emitter, ALU_MOV, RDI, RBX);
+    emit_alu(emitter, ALU_MOV, RSI, JIT_FRAME);
+    emit_mov_imm(emitter, RDX, (uint64_t)arg_count);
+    emit_mov_imm(emitter, RCX, (uint64_t)(uintptr_t)next);
+    emit_call(emitter, helper);
+    emit_byte(emitter, 0x85); // test eax, eax
+    emit_byte(emitter, 0xc0);
+    emit_jump_to(emitter, CC_NE, emitter->leave);
+    emit_reload_stack(emitter);
+}
+
+static uint16_t jit_read_short(byte *code)
+{
+    return (uint16_t)(code[0] << 8 | code[1]);
+}
+
+static void emit_get_local(JitEmitter *emitter, uint32_t slot)
+{
+    int32_t disp = (int32_t)slot * VALUE_SIZE;
+    byte type = jit_local_type(emitter, slot);
+    if (type == JIT_UNKNOWN && jit_observed(emitter) == VAL_NUMBER)
+    {
+        emit_guard_number(emitter, JIT_SLOTS, disp);
+        type = VAL_NUMBER;
+        jit_set_local_type(emitter, slot, type);
+    }
+    emit_push_value(emitter, JIT_SLOTS, disp);
+    jit_push_type(emitter, type);
+}
+static void emit_set_local(JitEmitter *emitter, uint32_t slot)
+{
+    emit_copy_value(emitter, JIT_SLOTS, (int32_t)slot * VALUE_SIZE, JIT_SP, -VALUE_SIZE);
+    jit_set_local_type(emitter, slot, jit_type(emitter, 1));
+}
+static void emit_load_globals(JitEmitter *emitter)
+{
+    emit_load(emitter, RAX, RBX, offsetof(VM, globals));
+    emit_load(emitter, RAX, RAX, offsetof(Values, items));
+}
+static void emit_get_global(JitEmitter *emitter, uint32_t slot)
+{
+    int32_t disp = (int32_t)slot * VALUE_SIZE;
+    byte type = jit_global_type(emitter, slot);
+    emit_load_globals(emitter);
+    if (type == JIT_UNKNOWN && jit_observed(emitter) == VAL_NUMBER)
+    {
+        emit_guard_number(emitter, RAX, disp);
+        type = VAL_NUMBER;
+        jit_set_global_type(emitter, slot, type);
+    }
+    else if (type == JIT_UNKNOWN)
+        emit_guard_defined(emitter, RAX, disp);
+    emit_push_value(emitter, RAX, disp);
+    jit_push_type(emitter, type);
+}
+static void emit_set_global(JitEmitter *emitter, uint32_t slot)
+{
+    int32_t disp = (int32_t)slot * VALUE_SIZE;
+    byte type = jit_global_type(emitter, slot);
+    // a number over a number needs no write barrier, a trace stores it itself
+    if (jit_type(emitter, 1) == VAL_NUMBER && (type == VAL_NUMBER || jit_observed(emitter) == VAL_NUMBER))
+    {
+        emit_load_globals(emitter);
+        emit_check_number(emitter, RAX, disp, type);
+        emit_copy_value(emitter, RAX, disp, JIT_SP, -VALUE_SIZE);
+        jit_set_global_type(emitter, slot, VAL_NUMBER);
+        return;
+    }
+    emit_store(emitter, RBX, offsetof(VM, sp), JIT_SP);
+    emit_helper_args(emitter, 2, slot, 0);
+    emit_call(emitter, jit_set_global);
+    emit_byte(emitter, 0x84); // test al, al
+    emit_byte(emitter, 0xc0);
+    emit_bail(emitter, CC_E);
+    jit_set_global_type(emitter, slot, jit_type(emitter, 1));
+}
+static void emit_call_value(JitEmitter *emitter, int arg_count, size_t next)
+{
+    emit_call_helper(emitter, jit_call, arg_count, emitter->chunk + next);
+    jit_pop_types(emitter, arg_count + 1);
+    if (jit_tracing(emitter))
+        memset(emitter->globals, JIT_UNKNOWN, emitter->global_count);
+    // the call is done, a result of another type than recorded continues after it
+    byte type = JIT_UNKNOWN;
+    if (jit_tracing(emitter) && emitter->record + 1 < emitter->record_count && emitter->records[emitter->record + 1].top[0] == VAL_NUMBER)
+    {
+        emitter->resume = next;
+        emit_guard_number(emitter, JIT_SP, -VALUE_SIZE);
+        emitter->resume = emitter->offset;
+        type = VAL_NUMBER;
+    }
+    jit_push_type(emitter, type);
+}
+
+/* translates one instruction, false when it has no template */
+static bool jit_emit_instruction(JitEmitter *emitter, ObjFunction *function, size_t offset)
+{
+    Chunk *chunk = function->chunk;
+    byte *code = chunk->items + offset;
+    byte instruction = code[0];
+    size_t next = offset + chunk_instruction_length(instruction);
+    switch (instruction)
+    {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+    {
+        uint32_t index = instruction == OP_CONSTANT ? code[1] : (uint32_t)(code[1] << 16 | code[2] << 8 | code[3]);
+        byte type = VALUE_TYPE(function->values->items[index]);
+        emit_push_value(emitter, JIT_CONSTANTS, (int32_t)index * VALUE_SIZE);
+        jit_push_type(emitter, type == VAL_NUMBER || type == VAL_BOOL ? type : JIT_UNKNOWN);
+        return true;
+    }
+    case OP_GET_LOCAL:
+        emit_get_local(emitter, code[1]);
+        return true;
+    case OP_GET_LOCAL_LONG:
+        emit_get_local(emitter, jit_read_short(code + 1));
+        return true;
+    case OP_SET_LOCAL:
+        emit_set_local(emitter, code[1]);
+        return true;
+    case OP_SET_LOCAL_LONG:
+        emit_set_local(emitter, jit_read_short(code + 1));
+        return true;
+    case OP_POP:
+        emit_drop(emitter, 1);
+        jit_pop_types(emitter, 1);
+        return true;
+    case OP_DUP:
+        emit_push_value(emitter, JIT_SP, -VALUE_SIZE);
+        jit_push_type(emitter, jit_type(emitter, 1));
+        return true;
+    case OP_GET_GLOBAL:
+        emit_get_global(emitter, jit_read_short(code + 1));
+        return true;
+    case OP_SET_GLOBAL:
+        emit_set_global(emitter, jit_read_short(code + 1));
+        return true;
+    case OP_DEFINE_GLOBAL:
+        emit_store(emitter, RBX, offsetof(VM, sp), JIT_SP);
+        emit_helper_args(emitter, 2, jit_read_short(code + 1), 0);
+        emit_call(emitter, jit_define_global);
+        emit_reload_stack(emitter);
+        jit_set_global_type(emitter, jit_read_short(code + 1), jit_type(emitter, 1));
+        jit_pop_types(emitter, 1);
+        return true;
+    case OP_PRINT:
+        emit_store(emitter, RBX, offsetof(VM, sp), JIT_SP);
+        emit_helper_args(emitter, 1, 0, 0);
+        emit_call(emitter, jit_print);
+        emit_reload_stack(emitter);
+        jit_pop_types(emitter, 1);
+        return true;
+    case OP_ADD:
+    case OP_ADD_NUM:
+        emit_arithmetic(emitter, 0x58);
+        break;
+    case OP_SUBTRACT:
+    case OP_SUBTRACT_NUM:
+        emit_arithmetic(emitter, 0x5c);
+        break;
+    case OP_MULTIPLY:
+    case OP_MULTIPLY_NUM:
+        emit_arithmetic(emitter, 0x59);
+        break;
+    case OP_DIVIDE:
+    case OP_DIVIDE_NUM:
+        emit_arithmetic(emitter, 0x5e);
+        break;
+    case OP_MOD:
+    case OP_MOD_NUM:
+        emit_mod(emitter);
+        break;
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+    case OP_LT:
+    case OP_LTE:
+    case OP_GT:
+    case OP_GTE:
+    case OP_EQUAL_NUM:
+    case OP_NOT_EQUAL_NUM:
+    case OP_LT_NUM:
+    case OP_LTE_NUM:
+    case OP_GT_NUM:
+    case OP_GTE_NUM:
+        emit_relational(emitter, jit_relation(instruction));
+        jit_pop_types(emitter, 2);
+        jit_push_type(emitter, VAL_BOOL);
+        return true;
+    case OP_NEGATE:
+        emit_check_number(emitter, JIT_SP, -VALUE_SIZE, jit_type(emitter, 1));
+        emit_load(emitter, RAX, JIT_SP, -VALUE_SIZE + VALUE_DATA);
+        emit_byte(emitter, 0x48); // btc rax, 63
+        emit_byte(emitter, 0x0f);
+        emit_byte(emitter, 0xba);
+        emit_direct(emitter, 7, RAX);
+        emit_byte(emitter, 63);
+        emit_store(emitter, JIT_SP, -VALUE_SIZE + VALUE_DATA, RAX);
+        jit_pop_types(emitter, 1);
+        jit_push_type(emitter, VAL_NUMBER);
+        return true;
+    case OP_NOT:
+        emit_lea(emitter, RDI, JIT_SP, -VALUE_SIZE);
+        emit_call(emitter, jit_falsey);
+        emit_store_bool(emitter, JIT_SP, -VALUE_SIZE);
+        jit_pop_types(emitter, 1);
+        jit_push_type(emitter, VAL_BOOL);
+        return true;
+    case OP_INC_LOCAL:
+    case OP_DEC_LOCAL:
+    {
+        int32_t disp = code[1] * VALUE_SIZE;
+        emit_check_number(emitter, JIT_SLOTS, disp, jit_local_type(emitter, code[1]));
+        emit_sd_memory(emitter, 0x10, 0, JIT_SLOTS, disp + VALUE_DATA);
+        emit_sd_memory(emitter, instruction == OP_INC_LOCAL ? 0x58 : 0x5c, 0, JIT_CONSTANTS, code[2] * VALUE_SIZE + VALUE_DATA);
+        emit_store_number(emitter, JIT_SLOTS, disp, 0);
+        jit_set_local_type(emitter, code[1], VAL_NUMBER);
+        return true;
+    }
+    case OP_ADD_CONST:
+    case OP_SUBTRACT_CONST:
+        emit_check_number(emitter, JIT_SP, -VALUE_SIZE, jit_type(emitter, 1));
+        emit_sd_memory(emitter, 0x10, 0, JIT_SP, -VALUE_SIZE + VALUE_DATA);
+        emit_sd_memory(emitter, instruction == OP_ADD_CONST ? 0x58 : 0x5c, 0, JIT_CONSTANTS, code[1] * VALUE_SIZE + VALUE_DATA);
+        emit_store_number(emitter, JIT_SP, -VALUE_SIZE, 0);
+        jit_pop_types(emitter, 1);
+        jit_push_type(emitter, VAL_NUMBER);
+        return true;
+    case OP_JMP:
+    case OP_JMP_LONG:
+        // a trace just goes on with what was recorded there
+        if (!jit_tracing(emitter))
+            emit_jump(emitter, -1, chunk_jump_target(chunk, offset));
+        return true;
+    case OP_LOOP:
+    case OP_LOOP_LONG:
+        if (!jit_tracing(emitter))
+            emit_jump(emitter, -1, chunk_jump_target(chunk, offset));
+        else if (emitter->record + 1 == emitter->record_count)
+            emit_jump_to(emitter, -1, emitter->loop);
+        else
+            emitter->failed = true;
+        return true;
+    case OP_JMP_IF_FALSE:
+    case OP_JMP_IF_FALSE_LONG:
+    {
+        byte type = jit_type(emitter, 1);
+        if (type == VAL_NUMBER || type == VAL_BOOL)
+        {
+            emit_branch(emitter, emit_test_falsey(emitter, type), chunk_jump_target(chunk, offset), next);
+            return true;
+        }
+        emit_lea(emitter, RDI, JIT_SP, -VALUE_SIZE);
+        emit_call(emitter, jit_falsey);
+        emit_byte(emitter, 0x84); // test al, al
+        emit_byte(emitter, 0xc0);
+        emit_branch(emitter, CC_NE, chunk_jump_target(chunk, offset), next);
+        return true;
+    }
+    case OP_JMP_IF_NOT_EQUAL:
+    case OP_JMP_IF_NOT_NOT_EQUAL:
+    case OP_JMP_IF_NOT_LT:
+    case OP_JMP_IF_NOT_LTE:
+    case OP_JMP_IF_NOT_GT:
+    case OP_JMP_IF_NOT_GTE:
+    case OP_JMP_IF_NOT_EQUAL_LONG:
+    case OP_JMP_IF_NOT_NOT_EQUAL_LONG:
+    case OP_JMP_IF_NOT_LT_LONG:
+    case OP_JMP_IF_NOT_LTE_LONG:
+    case OP_JMP_IF_NOT_GT_LONG:
+    case OP_JMP_IF_NOT_GTE_LONG:
+        emit_compare_jump(emitter, jit_relation(instruction), chunk_jump_target(chunk, offset), next);
+        jit_pop_types(emitter, 2);
+        return true;
+    case OP_CALL:
+        emit_call_value(emitter, code[1], next);
+        return true;
+    case OP_TAIL_CALL:
+        if (jit_tracing(emitter))
+            return false;
+        emit_call_helper(emitter, jit_tail_call, code[1], chunk->items + next);
+        return true;
+    case OP_RETURN:
+        if (jit_tracing(emitter))
+            return false;
+        emit_copy_value(emitter, JIT_SLOTS, 0, JIT_SP, -VALUE_SIZE);
+        emit_lea(emitter, JIT_SP, JIT_SLOTS, VALUE_SIZE);
+        emit_rex(emitter, false, 0, RBX);
+        emit_byte(emitter, 0x83); // sub dword [rbx + frame_count], 1
+        emit_memory(emitter, 5, RBX, offsetof(VM, frame_count));
+        emit_byte(emitter, 1);
+        emit_sync_stack(emitter);
+        emit_byte(emitter, 0xb8); // mov eax, VM_OK
+        emit_u32(emitter, VM_OK);
+        emit_jump_to(emitter, -1, emitter->leave);
+        return true;
+    default:
+        return false;
+    }
+    // the arithmetic ones
+    jit_pop_types(emitter, 2);
+    jit_push_type(emitter, VAL_NUMBER);
+    return true;
+}
+
+static void emit_prologue(JitEmitter *emitter, ObjFunction *function)
+{
+    static const JitRegister saved[] = {RBX, R12, R13, R14, R15};
+    for (size_t i = 0; i < 5; i++)
+        emit_push(emitter, saved[i]);
+    emit_alu(emitter, ALU_MOV, RBX, RDI);
+    emit_alu(emitter, ALU_MOV, JIT_FRAME, RSI);
+    emit_load(emitter, JIT_SLOTS, JIT_FRAME, offsetof(CallFrame, slots));
+    emit_reload_stack(emitter);
+    emit_mov_imm(emitter, JIT_CONSTANTS, (uint64_t)(uintptr_t)function->values->items);
+    emit_byte(emitter, 0xe9); // jmp over the exits to the body
+    size_t body = array_size(&emitter->code);
+    emit_u32(emitter, 0);
+
+    // the exits come first so every instruction reaches them with a backward jump
+    emitter->leave = array_size(&emitter->code);
+    for (size_t i = 5; i > 0; i--)
+        emit_pop(emitter, saved[i - 1]);
+    emit_byte(emitter, 0xc3);
+
+    emitter->bail = array_size(&emitter->code);
+    emit_store(emitter, JIT_FRAME, offsetof(CallFrame, ip), RAX);
+    emit_sync_stack(emitter);
+    emit_byte(emitter, 0xb8); // mov eax, JIT_BAIL
+    emit_u32(emitter, (uint32_t)JIT_BAIL);
+    emit_jump_to(emitter, -1, emitter->leave);
+    emit_patch(emitter, body, array_size(&emitter->code));
+}
+
+static void jit_emitter_free(JitEmitter *emitter)
+{
+    array_free(&emitter->code);
+    array_free(&emitter->jumps);
+    array_free(&emitter->bails);
+    free(emitter->labels);
+    free(emitter->globals);
+}
+/* a stub per guard and side exit, loads where the interpreter resumes */
+static void emit_exit_stubs(JitEmitter *emitter)
+{
+    for (size_t i = 0; i < array_size(&emitter->bails); i++)
+    {
+        JitFixup *fixup = &array_at(&emitter->bails, i);
+        emit_patch(emitter, fixup->at, array_size(&emitter->code));
+        emit_mov_imm(emitter, RAX, (uint64_t)(uintptr_t)(emitter->chunk + fixup->offset));
+        emit_jump_to(emitter, -1, emitter->bail);
+    }
+}
+
+/* copies finished code into the cache, the pages it touches are only writable meanwhile */
+static void *jit_install(Jit *jit, JitBuffer *code)
+{
+    if (jit->cache == NULL)
+    {
+        void *cache = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (cache == MAP_FAILED)
+            return NULL;
+        jit->cache = cache;
+    }
+    size_t start = (jit->used + 15) & ~(size_t)15;
+    size_t size = array_size(code);
+    if (start + size > JIT_CACHE_SIZE)
+        return NULL;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t first = start & ~(page - 1);
+    size_t length = ((start + size + page - 1) & ~(page - 1)) - first;
+    if (mprotect(jit->cache + first, length, PROT_READ | PROT_WRITE) != 0)
+        return NULL;
+    memcpy(jit->cache + start, code->items, size);
+    mprotect(jit->cache + first, length, PROT_READ | PROT_EXEC);
+    jit->used = start + size;
+    return jit->cache + start;
+}
+
+Jit *init_jit()
+{
+    Jit *jit = calloc(1, sizeof(Jit));
+    init_array(&jit->records);
+    return jit;
+}
+void jit_free(Jit *jit)
+{
+    if (jit == NULL)
+        return;
+    if (jit->cache != NULL)
+        munmap(jit->cache, JIT_CACHE_SIZE);
+    array_free(&jit->records);
+    free(jit);
+}
+/*
+ * native code starts wherever frame->ip is, which is the first instruction
+ * on a call and a loop header when an interpreted frame moves over
+ */
+static void emit_loop_entries(JitEmitter *emitter, Chunk *chunk)
+{
+    bool loaded = false;
+    for (size_t offset = 0; offset < array_size(chunk); offset += chunk_instruction_length(chunk->items[offset]))
+    {
+        byte instruction = chunk->items[offset];
+        if (instruction != OP_LOOP && instruction != OP_LOOP_LONG)
+            continue;
+        if (!loaded)
+            emit_load(emitter, RAX, JIT_FRAME, offsetof(CallFrame, ip));
+        loaded = true;
+        size_t header = chunk_jump_target(chunk, offset);
+        emit_mov_imm(emitter, RCX, (uint64_t)(uintptr_t)(chunk->items + header));
+        emit_alu(emitter, ALU_CMP, RAX, RCX);
+        emit_jump(emitter, CC_E, header);
+    }
+}
+bool jit_compile(Jit *jit, ObjFunction *function)
+{
+    // deoptimized, it stays bytecode
+    if (function->bails >= JIT_DEOPT_EXITS)
+        return false;
+    Chunk *chunk = function->chunk;
+    JitEmitter emitter = {0};
+    init_array(&emitter.code);
+    init_array(&emitter.jumps);
+    init_array(&emitter.bails);
+    emitter.labels = malloc((array_size(chunk) + 1) * sizeof(size_t));
+    memset(emitter.labels, 0xff, (array_size(chunk) + 1) * sizeof(size_t));
+    emitter.chunk = chunk->items;
+    emit_prologue(&emitter, function);
+    emit_loop_entries(&emitter, chunk);
+
+    bool translated = true;
+    for (size_t offset = 0; translated && offset < array_size(chunk); offset += chunk_instruction_length(chunk->items[offset]))
+    {
+        emitter.labels[offset] = array_size(&emitter.code);
+        emitter.offset = emitter.resume = offset;
+        translated = jit_emit_instruction(&emitter, function, offset);
+    }
+    for (size_t i = 0; translated && i < array_size(&emitter.jumps); i++)
+    {
+        JitFixup *fixup = &array_at(&emitter.jumps, i);
+        translated = fixup->offset < array_size(chunk) && emitter.labels[fixup->offset] != SIZE_MAX;
+        if (translated)
+            emit_patch(&emitter, fixup->at, emitter.labels[fixup->offset]);
+    }
+    if (!translated)
+    {
+        jit->rejected++;
+        jit_emitter_free(&emitter);
+        return false;
+    }
+    emit_exit_stubs(&emitter);
+
+    void *code = jit_install(jit, &emitter.code);
+    jit_emitter_free(&emitter);
+    if (code == NULL)
+    {
+        jit->full++;
+        return false;
+    }
+    function->code = code;
+    jit->compiled++;
+    return true;
+}
+/* native code that keeps handing back to the interpreter is dropped, the function is not compiled again */
+static void jit_bailed(Jit *jit, ObjFunction *function)
+{
+    if (jit == NULL || ++function->bails < JIT_DEOPT_EXITS)
+        return;
+    function->code = NULL;
+    jit->deoptimized++;
+}
+void jit_report(Jit *jit, FILE *stream)
+{
+    if (jit == NULL)
+    {
+        fprintf(stream, "jit: disabled\n");
+        return;
+    }
+    fprintf(stream, "jit: %zu functions compiled, %zu bytes of code, %zu without a template, %zu over the cache\n",
+            jit->compiled, jit->used, jit->rejected, jit->full);
+    fprintf(stream, "jit: %zu loops traced, %zu recordings aborted, %zu frames replaced on stack, %zu deoptimized\n",
+            jit->traces, jit->aborted, jit->replaced, jit->deoptimized);
+}
+
+/* the recording as straight line code looping back to its start, NULL when it cannot be */
+static JitCode jit_trace_compile(Jit *jit, VM *vm, ObjFunction *function)
+{
+    Chunk *chunk = function->chunk;
+    JitEmitter emitter = {0};
+    init_array(&emitter.code);
+    init_array(&emitter.jumps);
+    init_array(&emitter.bails);
+    emitter.chunk = chunk->items;
+    emitter.records = jit->records.items;
+    emitter.record_count = array_size(&jit->records);
+    // nothing is known at the header, each iteration guards what it assumes again
+    memset(emitter.locals, JIT_UNKNOWN, sizeof(emitter.locals));
+    emitter.global_count = array_size(vm->globals);
+    emitter.globals = malloc(emitter.global_count + 1);
+    memset(emitter.globals, JIT_UNKNOWN, emitter.global_count);
+    emit_prologue(&emitter, function);
+    emitter.loop = array_size(&emitter.code);
+
+    bool translated = true;
+    for (size_t i = 0; translated && !emitter.failed && i < emitter.record_count; i++)
+    {
+        emitter.record = i;
+        emitter.offset = emitter.resume = (size_t)(emitter.records[i].ip - chunk->items);
+        translated = jit_emit_instruction(&emitter, function, emitter.offset);
+    }
+    if (!translated || emitter.failed || emitter.depth != 0)
+    {
+        jit_emitter_free(&emitter);
+        return NULL;
+    }
+    emit_exit_stubs(&emitter);
+    void *code = jit_install(jit, &emitter.code);
+    jit_emitter_free(&emitter);
+    if (code == NULL)
+        jit->full++;
+    return (JitCode)code;
+}
+
+static void jit_abort(Jit *jit)
+{
+    jit->recording->aborts++;
+    jit->recording = NULL;
+    jit->aborted++;
+}
+static size_t jit_loop_slot(byte *header)
+{
+    uintptr_t key = (uintptr_t)header;
+    return (key ^ key >> 6 ^ key >> 12) & (JIT_LOOP_SLOTS - 1);
+}
+int jit_loop(VM *vm, CallFrame *frame)
+{
+    Jit *jit = vm->jit;
+    // a recording only ends on its own back-edge, reaching another one means it was left
+    if (jit != NULL && jit->recording != NULL)
+        jit_abort(jit);
+    ObjFunction *function = frame->function;
+    if (function->code != NULL)
+    {
+        if (jit != NULL)
+            jit->replaced++;
+        return jit_replace(vm, frame);
+    }
+    if (jit == NULL)
+        return VM_OK;
+    JitLoop *loop = &jit->loops[jit_loop_slot(frame->ip)];
+    if (loop->header != frame->ip)
+        *loop = (JitLoop){.header = frame->ip};
+    if (loop->trace != NULL)
+    {
+        int status = loop->trace(vm, frame);
+        if (status != JIT_BAIL)
+            return status;
+        // leaving the loop is what a trace does, leaving it halfway through an iteration is not
+        if (frame->ip >= loop->header && frame->ip <= loop->end && ++loop->exits == JIT_DEOPT_EXITS)
+        {
+            loop->trace = NULL;
+            loop->aborts = JIT_TRACE_TRIES;
+            jit->deoptimized++;
+        }
+        return VM_OK;
+    }
+    if (loop->aborts > JIT_TRACE_TRIES || ++loop->count < JIT_HOT_LOOPS)
+        return VM_OK;
+    loop->count = 0;
+    if (loop->aborts == JIT_TRACE_TRIES)
+    {
+        // it does not trace, the whole function might still compile
+        loop->aborts++;
+        if (jit_compile(jit, function))
+            return jit_replace(vm, frame);
+        return VM_OK;
+    }
+    jit->recording = loop;
+    jit->recording_frame = (int)(frame - vm->frames);
+    jit->recording_function = frame->function;
+    jit->records.count = 0;
+    return VM_OK;
+}
+bool jit_recording(Jit *jit)
+{
+    return jit != NULL && jit->recording != NULL;
+}
+
+/* how many of the topmost values the instruction's template needs to be numbers */
+static int jit_number_operands(byte instruction)
+{
+    switch (instruction)
+    {
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_MOD:
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+    case OP_LT:
+    case OP_LTE:
+    case OP_GT:
+    case OP_GTE:
+    case OP_JMP_IF_NOT_EQUAL:
+    case OP_JMP_IF_NOT_NOT_EQUAL:
+    case OP_JMP_IF_NOT_LT:
+    case OP_JMP_IF_NOT_LTE:
+    case OP_JMP_IF_NOT_GT:
+    case OP_JMP_IF_NOT_GTE:
+    case OP_JMP_IF_NOT_EQUAL_LONG:
+    case OP_JMP_IF_NOT_NOT_EQUAL_LONG:
+    case OP_JMP_IF_NOT_LT_LONG:
+    case OP_JMP_IF_NOT_LTE_LONG:
+    case OP_JMP_IF_NOT_GT_LONG:
+    case OP_JMP_IF_NOT_GTE_LONG:
+        return 2;
+    case OP_NEGATE:
+    case OP_ADD_CONST:
+    case OP_SUBTRACT_CONST:
+        return 1;
+    default:
+        return 0;
+    }
+}
+/* the type of the local or global the instruction reads */
+static byte jit_operand_type(VM *vm, CallFrame *frame, byte *ip)
+{
+    switch (*ip)
+    {
+    case OP_GET_LOCAL:
+    case OP_INC_LOCAL:
+    case OP_DEC_LOCAL:
+        return VALUE_TYPE(frame->slots[ip[1]]);
+    case OP_GET_LOCAL_LONG:
+        return VALUE_TYPE(frame->slots[jit_read_short(ip + 1)]);
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    {
+        uint16_t slot = jit_read_short(ip + 1);
+        return slot < array_size(vm->globals) ? VALUE_TYPE(array_at(vm->globals, slot)) : JIT_UNKNOWN;
+    }
+    default:
+        return JIT_UNKNOWN;
+    }
+}
+bool jit_record(VM *vm, CallFrame *frame)
+{
+    Jit *jit = vm->jit;
+    if (jit == NULL || jit->recording == NULL)
+        return false;
+    int index = (int)(frame - vm->frames);
+    // whatever a call made from the loop does is not part of the trace
+    if (index > jit->recording_frame)
+        return true;
+    byte *ip = frame->ip - 1;
+    byte instruction = *ip;
+    Chunk *chunk = frame->function->chunk;
+    if (index < jit->recording_frame || frame->function != jit->recording_function ||
+        (array_size(&jit->records) == 0 && ip != jit->recording->header) ||
+        array_size(&jit->records) == JIT_TRACE_MAX ||
+        instruction == OP_RETURN || instruction == OP_TAIL_CALL)
+    {
+        jit_abort(jit);
+        return false;
+    }
+
+    size_t depth = (size_t)(vm->sp - vm->stack.items);
+    JitRecord record = {
+        .ip = ip,
+        .top = {depth > 0 ? VALUE_TYPE(vm->sp[-1]) : JIT_UNKNOWN, depth > 1 ? VALUE_TYPE(vm->sp[-2]) : JIT_UNKNOWN},
+        .operand = jit_operand_type(vm, frame, ip),
+    };
+    // an iteration that would always leave the trace is not worth compiling
+    int numbers = jit_number_operands(instruction);
+    if ((numbers > 0 && record.top[0] != VAL_NUMBER) || (numbers > 1 && record.top[1] != VAL_NUMBER) ||
+        ((instruction == OP_INC_LOCAL || instruction == OP_DEC_LOCAL) && record.operand != VAL_NUMBER))
+    {
+        jit_abort(jit);
+        return false;
+    }
+    array_push(&jit->records, record);
+    if (instruction != OP_LOOP && instruction != OP_LOOP_LONG)
+        return true;
+
+    // an inner loop's back-edge, the outer loop is left to the inner one's trace
+    if (chunk->items + chunk_jump_target(chunk, (size_t)(ip - chunk->items)) != jit->recording->header)
+    {
+        jit_abort(jit);
+        return false;
+    }
+    JitLoop *loop = jit->recording;
+    jit->recording = NULL;
+    loop->end = ip;
+    loop->trace = jit_trace_compile(jit, vm, frame->function);
+    if (loop->trace == NULL)
+    {
+        loop->aborts++;
+        jit->aborted++;
+        return false;
+    }
+    jit->traces++;
+    return false;
+}
+#else
+Jit *init_jit()
+{
+    return NULL;
+}
+void jit_free(Jit *jit)
+{
+    (void)jit;
+}
+bool jit_compile(Jit *jit, ObjFunction *function)
+{
+    (void)jit;
+    (void)function;
+    return false;
+}
+static void jit_bailed(Jit *jit, ObjFunction *function)
+{
+    (void)jit;
+    (void)function;
+}
+void jit_report(Jit *jit, FILE *stream)
+{
+    (void)jit;
+    fprintf(stream, "jit: not available in this build\n");
+}
+int jit_loop(VM *vm, CallFrame *frame)
+{
+    if (frame->function->code != NULL)
+        return jit_replace(vm, frame);
+    return VM_OK;
+}
+bool jit_recording(Jit *jit)
+{
+    (void)jit;
+    return false;
+}
+bool jit_record(VM *vm, CallFrame *frame)
+{
+    (void)vm;
+    (void)frame;
+    return false;
+}
+#endif
@@ -2,6 +2,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 #include "helper.h"
 
@@ -17,6 +20,12 @@
 #include "compiler.h"
 #include "VM.h"
 #include "native.h"
+#include "optimizer.h"
+#include "gc.h"
+#include "bytecode.h"
+#include "batch.h"
+#include "jit.h"
+#include "aot.h"
 
 #define ERROR_PREFIX "Error: "
 
@@ -110,7 +119,59 @@ OutputType parse_output_flag(char *arg)
 }
 void usage(char *argv[])
 {
-    fprintf(stderr, ERROR_PREFIX "%s [--out=TOK|AST|IR] <filename>\n", argv[0]);
+    fprintf(stderr, ERROR_PREFIX "%s [--out=TOK|AST|IR] [-O] [--no-cache] [--gc-growth=<factor>] [--gc-concurrent] [--gc-stats] [--no-jit] [--jit-stats] [--emit-c=<file>] <filename>\n", argv[0]);
+    fprintf(stderr, ERROR_PREFIX "%s [--jobs=<workers>] [--inputs=<file>] [-O] [--gc-growth=<factor>] [--gc-concurrent] [--no-jit] <filename>...\n", argv[0]);
+}
+/* many files, or one with --inputs, run on worker threads */
+static int run_batch(char **paths, size_t count, char *inputs_path, BatchOptions options)
+{
+    char **sources = calloc(count, sizeof(char *));
+    for (size_t i = 0; i < count; i++)
+        sources[i] = readFile(paths[i]);
+    char *inputs = inputs_path != NULL ? readFile(inputs_path) : NULL;
+    int status = batch_run(paths, sources, count, inputs, options);
+    for (size_t i = 0; i < count; i++)
+        free(sources[i]);
+    free(sources);
+    free(inputs);
+    return status;
+}
+/* runs a finished script compiler and reports its error, frees the compiler and the heap */
+static void run(Compiler *compiler, Heap *heap, bool gc_stats, bool jit, bool jit_stats)
+{
+    log_info("starting interpreting...");
+    VM *vm = init_vm(compiler, heap);
+    if (!jit)
+        vm_disable_jit(vm);
+    VM_Error error = vm_interpret(vm);
+    vm_report_error(vm, error, stderr);
+    if (jit_stats)
+        jit_report(vm->jit, stderr);
+    compiler_free(compiler);
+    vm_free(vm);
+    if (gc_stats)
+        gc_report(heap, stderr);
+    heap_free(heap);
+}
+/* writes a finished script compiler as a C program, frees the compiler and the heap */
+static void emit_c(Compiler *compiler, Heap *heap, const char *path, uint64_t source_hash, uint32_t flags)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, ERROR_PREFIX "failed to open file \"%s\".\nMessage: %s.\n", path, strerror(errno));
+        exit(1);
+    }
+    bool ok = aot_emit(compiler, source_hash, flags, file);
+    ok = fclose(file) == 0 && ok;
+    compiler_free(compiler);
+    heap_free(heap);
+    if (!ok)
+    {
+        fprintf(stderr, ERROR_PREFIX "failed to write \"%s\".\n", path);
+        remove(path);
+        exit(1);
+    }
 }
 int main(int argc, char *argv[])
 {
@@ -121,14 +182,89 @@ int main(int argc, char *argv[])
     }
     char *output_flag = NULL;
     char *source_file = NULL;
+    char **source_files = calloc((size_t)argc, sizeof(char *));
+    size_t source_count = 0;
+    char *inputs_path = NULL;
+    char *emit_path = NULL;
+    bool batch = false;
+    BatchOptions batch_options = {0};
+#ifdef _WIN32
+    batch_options.workers = 1;
+#else
+    batch_options.workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    bool optimize = false;
+    bool gc_stats = false;
+    bool use_cache = true;
+    bool jit = true;
+    bool jit_stats = false;
+    Heap *heap = init_heap();
 
     for (int i = 1; i < argc; i++)
     {
         if (strncmp(argv[i], "--out=", 4) == 0)
             output_flag = argv[i];
+        else if (strcmp(argv[i], "-O") == 0)
+            optimize = true;
+        else if (strncmp(argv[i], "--gc-growth=", 12) == 0)
+        {
+            double factor = atof(argv[i] + 12);
+            if (factor <= 1)
+            {
+                fprintf(stderr, ERROR_PREFIX "--gc-growth expects a factor greater than 1: %s\n", argv[i]);
+                return 1;
+            }
+            gc_set_growth_factor(heap, factor);
+            batch_options.gc_growth = factor;
+        }
+        else if (strncmp(argv[i], "--jobs=", 7) == 0)
+        {
+            batch_options.workers = atoi(argv[i] + 7);
+            if (batch_options.workers < 1)
+            {
+                fprintf(stderr, ERROR_PREFIX "--jobs expects at least one worker: %s\n", argv[i]);
+                return 1;
+            }
+            batch = true;
+        }
+        else if (strncmp(argv[i], "--inputs=", 9) == 0)
+        {
+            inputs_path = argv[i] + 9;
+            batch = true;
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0)
+            use_cache = false;
+        else if (strcmp(argv[i], "--gc-concurrent") == 0)
+        {
+            gc_set_concurrent(heap, true);
+            batch_options.gc_concurrent = true;
+        }
+        else if (strcmp(argv[i], "--gc-stats") == 0)
+            gc_stats = true;
+        else if (strcmp(argv[i], "--no-jit") == 0)
+            jit = false;
+        else if (strcmp(argv[i], "--jit-stats") == 0)
+            jit_stats = true;
+        else if (strncmp(argv[i], "--emit-c=", 9) == 0)
+            emit_path = argv[i] + 9;
         else
-            source_file = argv[i];
+            source_files[source_count++] = source_file = argv[i];
+    }
+    if (batch || source_count > 1)
+    {
+        if (source_count == 0 || (inputs_path != NULL && source_count != 1))
+        {
+            usage(argv);
+            return 1;
+        }
+        batch_options.optimize = optimize;
+        batch_options.jit = jit;
+        int status = run_batch(source_files, source_count, inputs_path, batch_options);
+        free(source_files);
+        heap_free(heap);
+        return status;
     }
+    free(source_files);
     OutputType type = OUTPUT_NONE;
     if (output_flag)
     {
@@ -143,11 +279,34 @@ int main(int argc, char *argv[])
     log_info("reading %s", path);
     char *source = readFile(path);
 
-    if (strlen(source) == 0)
+    size_t source_length = strlen(source);
+    if (source_length == 0)
     {
         free(source);
         return 0;
     }
+    // a script that has not changed since its last run skips straight to the VM
+    uint64_t source_hash = bytecode_hash(source, source_length);
+    uint32_t cache_flags = optimize ? BYTECODE_OPTIMIZED : 0;
+    char *cache_path = use_cache && type == OUTPUT_NONE && emit_path == NULL ? bytecode_cache_path(path) : NULL;
+    if (cache_path != NULL)
+    {
+        Compiler compiler = {0};
+        init_compiler(&compiler, TYPE_SCRIPT, heap);
+        compiler.file_path = path;
+        native_init(&compiler);
+        BytecodeImage image = {0};
+        if (bytecode_load(&compiler, &image, cache_path, source_hash, cache_flags))
+        {
+            log_info("loaded %s", cache_path);
+            free(source);
+            free(cache_path);
+            run(&compiler, heap, gc_stats, jit, jit_stats);
+            bytecode_unload(&image);
+            return 0;
+        }
+        compiler_free(&compiler);
+    }
     log_info("initializing lexer");
     Lexer *lexer = init_lexer(source, path);
     if (type == OUTPUT_TOKEN)
@@ -161,7 +320,8 @@ int main(int argc, char *argv[])
         exit(1);
     }
     log_info("initializing parser");
-    Parser *parser = init_parser(lexer);
+    Arena arena = {0};
+    Parser *parser = init_parser(lexer, &arena);
     log_info("starting parsing...");
     AST *ast = parser_parse(parser);
     if (type == OUTPUT_AST)
@@ -176,12 +336,17 @@ int main(int argc, char *argv[])
     else if (parser->had_error == 0)
     {
         Compiler compiler = {0};
-        init_compiler(&compiler, TYPE_SCRIPT);
+        init_compiler(&compiler, TYPE_SCRIPT, heap);
         compiler.file_path = lexer->file_path;
+        compiler.optimize = optimize;
         log_info("setting up native's");
-        native_init(compiler.globals);
+        native_init(&compiler);
+        log_info("folding constants");
+        ast = optimizer_fold(ast);
         log_info("converting AST to bytecode");
         ast_to_byte(ast, &compiler);
+        // the tree and its names are not needed past this point
+        arena_free(&arena);
         free(source);
 
         if (compiler.had_error == false)
@@ -203,54 +368,23 @@ int main(int argc, char *argv[])
                 }
                 exit(1);
             }
-            log_info("starting interpreting...");
-            VM *vm = init_vm(&compiler);
-            VM_Error error = vm_interpret(vm);
-            if (error != VM_OK)
+            if (emit_path != NULL)
             {
-                for (int i = vm->frame_count - 1; i >= 0; --i)
-                {
-                    CallFrame *frame = &vm->frames[i];
-                    ObjFunction *function = frame->function;
-                    fprintf(stderr, "#%d ", i);
-                    if (function->name == NULL)
-                    {
-                        fprintf(stderr, "%s\n", vm->file_path);
-                    }
-                    else
-                    {
-                        fprintf(stderr, "%s()\n", function->name->chars);
-                    }
-                }
+                emit_c(&compiler, heap, emit_path, source_hash, cache_flags);
             }
-            switch (error)
+            else
             {
-            case VM_TYPE_ERROR:
-                fprintf(stderr, "TypeError at %s:%d:%d %s\n", vm->file_path, vm->row, vm->col, vm->message);
-                break;
-            case VM_STACK_OVERFLOW:
-            case VM_STACK_UNDERFLOW:
-                fprintf(stderr, "%s InternalError %s\n", vm->file_path, vm->message);
-                break;
-            case VM_REFERENCE_ERROR:
-                fprintf(stderr, "ReferenceError at %s:%d:%d %s\n", vm->file_path, vm->row, vm->col, vm->message);
-                break;
-            case VM_TOO_FEW_ARGUMENTS:
-                fprintf(stderr, "TooFewArguments at %s:%d:%d %s\n", vm->file_path, vm->row, vm->col, vm->message);
-                break;
-            case VM_TOO_MANY_ARGUMENTS:
-                fprintf(stderr, "TooManyArguments at %s:%d:%d %s\n", vm->file_path, vm->row, vm->col, vm->message);
-                break;
-            default:
-                break;
+                if (cache_path != NULL && !bytecode_write(&compiler, cache_path, source_hash, cache_flags))
+                {
+                    log_info("could not write %s", cache_path);
+                }
+                run(&compiler, heap, gc_stats, jit, jit_stats);
             }
-            compiler_free(&compiler);
-            vm_free(vm);
-            objects_free();
         }
         log_info("finished interpreting");
     }
-    ast_free(ast);
+    free(cache_path);
+    arena_free(&arena);
     parser_free(parser);
     lexer_free(lexer);
 }
\ No newline at end of file
@@ -1,13 +1,15 @@
 #include "table.h"
 #include "helper.h"
-Obj *objects = {0};
+#include "gc.h"
+#include "pool.h"
 
-Obj *object_allocate(size_t size, ObjType type)
+Obj *object_allocate(Heap *heap, size_t size, ObjType type)
 {
-    Obj *object = calloc(1, size);
+    // strings start young, functions and natives live as long as the program anyway
+    Obj *object = type == OBJ_STRING ? gc_allocate_young(heap, size) : NULL;
+    if (object == NULL)
+        object = gc_allocate_old(heap, size);
     object->type = type;
-    object->next = objects;
-    objects = object;
     return object;
 }
 
@@ -15,78 +17,171 @@ bool is_obj_type(Value value, ObjType type)
 {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
-void object_print(Value value)
+void object_print(Value value, FILE *stream)
 {
     switch (OBJ_TYPE(value))
     {
     case OBJ_STRING:
-        fprintf(stdout, "%s", AS_CSTRING(value));
+        fprintf(stream, "%s", AS_CSTRING(value));
         break;
     case OBJ_FUNCTION:
-        fprintf(stdout, "<fn .%s>", AS_FUNCTION(value)->name == NULL ? "entry" : AS_FUNCTION(value)->name->chars);
+        fprintf(stream, "<fn .%s>", AS_FUNCTION(value)->name == NULL ? "entry" : AS_FUNCTION(value)->name->chars);
         break;
     case OBJ_NATIVE:
-        fprintf(stdout, "<native fn>");
+        fprintf(stream, "<native fn>");
         break;
     default:
         NOTREACHABLE;
     }
 }
-ObjString *allocate_string(size_t length, uint32_t hash)
+ObjString *allocate_string(Heap *heap, size_t length, uint32_t hash)
 {
-    ObjString *string = (ObjString *)object_allocate(sizeof(ObjString) + (length + 1) * sizeof(char), OBJ_STRING);
+    ObjString *string = (ObjString *)object_allocate(heap, sizeof(ObjString) + (length + 1) * sizeof(char), OBJ_STRING);
     string->length = length;
     string->hash = hash;
     return string;
 }
-ObjString *new_string(char *chars, size_t length)
+ObjString *new_string(Heap *heap, char *chars, size_t length)
 {
     uint32_t hash = 0;
     if (chars != NULL)
         hash = table_hash_string(chars, length);
 
-    ObjString *string = allocate_string(length, hash);
+    ObjString *string = allocate_string(heap, length, hash);
     string->length = length;
     if (chars)
         strcpy(string->chars, chars);
     return string;
 }
+/* a + b as OP_ADD makes it, a new young string */
+ObjString *string_concat(Heap *heap, ObjString *a, ObjString *b)
+{
+    ObjString *result = new_string(heap, NULL, a->length + b->length);
+    strcpy(result->chars, a->chars);
+    strcat(result->chars, b->chars);
+    result->hash = table_hash_string(result->chars, result->length);
+    return result;
+}
 
-ObjString *cstr_to_objstr(char *chars)
+ObjString *cstr_to_objstr(Heap *heap, char *chars)
 {
     size_t chars_len = strlen(chars);
-    ObjString *string = new_string(chars, chars_len);
+    ObjString *string = new_string(heap, chars, chars_len);
     return string;
 }
 
-ObjFunction *new_function()
+ObjFunction *new_function(Heap *heap)
 {
-    ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
+    ObjFunction *function = ALLOCATE_OBJ(heap, ObjFunction, OBJ_FUNCTION);
     function->chunk = init_chunk();
     function->values = init_values();
     return function;
 }
-void object_free(Obj *object)
+#define BLOB_ALIGN(size) (((size) + 7) & ~(size_t)7)
+/*
+ * moves the finished chunk and constant pool into one exactly sized block:
+ * both headers, the constants, the position runs and then the code. nothing
+ * is pushed to a function after compiler_end, so capacity can equal count.
+ */
+void function_finalize(ObjFunction *function)
+{
+    if (function->blob != NULL)
+        return;
+    Chunk *chunk = function->chunk;
+    Values *values = function->values;
+    size_t values_size = array_size(values) * sizeof(Value);
+    size_t positions_size = array_size(&chunk->positions) * sizeof(Position);
+    size_t size = BLOB_ALIGN(sizeof(Chunk)) + BLOB_ALIGN(sizeof(Values)) +
+                  values_size + positions_size + array_size(chunk);
+    char *blob = malloc(size);
+    assert(blob != NULL && "cannot allocate memory");
+
+    Chunk *final_chunk = (Chunk *)blob;
+    Values *final_values = (Values *)(blob + BLOB_ALIGN(sizeof(Chunk)));
+    *final_chunk = *chunk;
+    *final_values = *values;
+    final_values->items = (Value *)((char *)final_values + BLOB_ALIGN(sizeof(Values)));
+    final_chunk->positions.items = (Position *)((char *)final_values->items + values_size);
+    final_chunk->items = (byte *)final_chunk->positions.items + positions_size;
+    if (values_size != 0)
+        memcpy(final_values->items, values->items, values_size);
+    if (positions_size != 0)
+        memcpy(final_chunk->positions.items, chunk->positions.items, positions_size);
+    if (array_size(chunk) != 0)
+        memcpy(final_chunk->items, chunk->items, array_size(chunk));
+    final_values->capacity = final_values->count;
+    final_chunk->positions.capacity = final_chunk->positions.count;
+    final_chunk->capacity = final_chunk->count;
+
+    values_free(values);
+    chunk_free(chunk);
+    function->chunk = final_chunk;
+    function->values = final_values;
+    function->blob = blob;
+}
+/*
+ * a finished function with its own copy of the code, for a VM that quickens
+ * while others run the original. the constants and positions stay shared,
+ * the blob only holds the chunk header and the code.
+ */
+ObjFunction *function_copy(Heap *heap, ObjFunction *function)
+{
+    Chunk *chunk = function->chunk;
+    char *blob = malloc(BLOB_ALIGN(sizeof(Chunk)) + array_size(chunk));
+    assert(blob != NULL && "cannot allocate memory");
+    Chunk *copy_chunk = (Chunk *)blob;
+    *copy_chunk = *chunk;
+    copy_chunk->items = (byte *)blob + BLOB_ALIGN(sizeof(Chunk));
+    if (array_size(chunk) != 0)
+        memcpy(copy_chunk->items, chunk->items, array_size(chunk));
+
+    ObjFunction *copy = ALLOCATE_OBJ(heap, ObjFunction, OBJ_FUNCTION);
+    copy->arity = function->arity;
+    copy->name = function->name;
+    copy->chunk = copy_chunk;
+    copy->values = function->values;
+    copy->blob = blob;
+    return copy;
+}
+size_t object_size(Obj *object)
+{
+    switch (object->type)
+    {
+    case OBJ_STRING:
+        return sizeof(ObjString) + (((ObjString *)object)->length + 1) * sizeof(char);
+    case OBJ_FUNCTION:
+        return sizeof(ObjFunction);
+    case OBJ_NATIVE:
+        return sizeof(ObjNative);
+    default:
+        NOTREACHABLE;
+    }
+}
+void object_free(Heap *heap, Obj *object)
 {
     switch (object->type)
     {
     case OBJ_STRING:
     {
-        ObjString *string = (ObjString *)object;
-        free(string);
+        pool_free(&heap->pool, object, object_size(object));
         break;
     }
     case OBJ_FUNCTION:
     {
         ObjFunction *function = (ObjFunction *)object;
-        values_free(function->values);
-        chunk_free(function->chunk);
-        free(function);
+        if (function->blob != NULL)
+            free(function->blob);
+        else
+        {
+            values_free(function->values);
+            chunk_free(function->chunk);
+        }
+        pool_free(&heap->pool, function, sizeof(ObjFunction));
         break;
     }
     case OBJ_NATIVE:
     {
-        free(object);
+        pool_free(&heap->pool, object, sizeof(ObjNative));
         break;
     }
     default:
@@ -94,20 +189,21 @@ void object_free(Obj *object)
     }
 }
 
-void objects_free()
+void objects_free(Heap *heap)
 {
-    Obj *temp = objects;
+    Obj *temp = heap->objects;
     while (temp != NULL)
     {
         Obj *next = temp->next;
-        object_free(temp);
+        object_free(heap, temp);
         temp = next;
     }
+    heap->objects = NULL;
 }
 
-ObjNative *new_native(NativeFn function, int arity)
+ObjNative *new_native(Heap *heap, NativeFn function, int arity)
 {
-    ObjNative *native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
+    ObjNative *native = ALLOCATE_OBJ(heap, ObjNative, OBJ_NATIVE);
     native->function = function;
     native->arity = arity;
     return native;
@@ -115,7 +211,7 @@ ObjNative *new_native(NativeFn function, int arity)
 
 char *value_typeof(Value value)
 {
-    switch (value.type)
+    switch (VALUE_TYPE(value))
     {
     case VAL_BOOL:
         return "Boolean";
@@ -0,0 +1,327 @@
+#include "optimizer.h"
+#include "helper.h"
+#include <stdlib.h>
+
+/* longest sequence a peephole pattern looks at */
+#define OPTIMIZER_WINDOW 7
+
+#define OPTIMIZER_OP(n) array_at(chunk, window[n])
+#define OPTIMIZER_ARG(n) array_at(chunk, window[n] + 1)
+#define OPTIMIZER_CONSTANT(n) array_at(function->values, OPTIMIZER_ARG(n))
+
+/* a jump copied to the new chunk, target is still an offset into the old one */
+typedef struct
+{
+    size_t offset;
+    size_t target;
+} JumpFixup;
+
+define_array(JumpFixups, JumpFixup);
+
+/*
+ * collects the offsets of up to `max` consecutive instructions. a pattern may
+ * only start at a jump target, so the window stops before the next one.
+ */
+static size_t optimizer_window(Chunk *chunk, bool *targets, size_t offset, size_t *window, size_t max)
+{
+    size_t count = 0;
+    while (count < max && offset < array_size(chunk) && (count == 0 || !targets[offset]))
+    {
+        window[count++] = offset;
+        offset += chunk_instruction_length(array_at(chunk, offset));
+    }
+    return count;
+}
+/* bytes keep the source position of the instruction they came from, so runtime errors still point at it */
+static void optimizer_emit(Chunk *to, Chunk *from, size_t origin, byte value)
+{
+    Position position = chunk_position_at(from, origin);
+    chunk_set_position(to, position.row, position.col);
+    chunk_push(to, value);
+}
+static bool optimizer_is_add_or_subtract(byte instruction)
+{
+    return instruction == OP_ADD || instruction == OP_SUBTRACT;
+}
+/* one pass over the chunk, returns the rewritten chunk or NULL when nothing matched */
+static Chunk *optimizer_pass(ObjFunction *function)
+{
+    Chunk *chunk = function->chunk;
+    size_t count = array_size(chunk);
+    bool *targets = calloc(count + 1, sizeof(bool));
+    for (size_t offset = 0; offset < count; offset += chunk_instruction_length(array_at(chunk, offset)))
+        if (chunk_is_jump(array_at(chunk, offset)))
+            targets[chunk_jump_target(chunk, offset)] = true;
+
+    Chunk *optimized = init_chunk();
+    size_t *map = calloc(count + 1, sizeof(size_t)); /* old offset -> new offset */
+    JumpFixups fixups = {0};
+    init_array(&fixups);
+    bool changed = false;
+
+    size_t window[OPTIMIZER_WINDOW];
+    size_t offset = 0;
+    while (offset < count)
+    {
+        map[offset] = array_size(optimized);
+        size_t n = optimizer_window(chunk, targets, offset, window, OPTIMIZER_WINDOW);
+        size_t matched = 0;
+
+        // i++; on a local: GET_LOCAL s, DUP, CONSTANT k, ADD, SET_LOCAL s, POP, POP
+        if (n >= 7 && OPTIMIZER_OP(0) == OP_GET_LOCAL && OPTIMIZER_OP(1) == OP_DUP &&
+            OPTIMIZER_OP(2) == OP_CONSTANT && IS_NUMBER(OPTIMIZER_CONSTANT(2)) &&
+            optimizer_is_add_or_subtract(OPTIMIZER_OP(3)) &&
+            OPTIMIZER_OP(4) == OP_SET_LOCAL && OPTIMIZER_ARG(4) == OPTIMIZER_ARG(0) &&
+            OPTIMIZER_OP(5) == OP_POP && OPTIMIZER_OP(6) == OP_POP)
+        {
+            optimizer_emit(optimized, chunk, window[3], OPTIMIZER_OP(3) == OP_ADD ? OP_INC_LOCAL : OP_DEC_LOCAL);
+            optimizer_emit(optimized, chunk, window[3], OPTIMIZER_ARG(0));
+            optimizer_emit(optimized, chunk, window[3], OPTIMIZER_ARG(2));
+            matched = 7;
+        }
+        // ++i; or i = i + k; on a local: GET_LOCAL s, CONSTANT k, ADD, SET_LOCAL s, POP
+        else if (n >= 5 && OPTIMIZER_OP(0) == OP_GET_LOCAL &&
+                 OPTIMIZER_OP(1) == OP_CONSTANT && IS_NUMBER(OPTIMIZER_CONSTANT(1)) &&
+                 optimizer_is_add_or_subtract(OPTIMIZER_OP(2)) &&
+                 OPTIMIZER_OP(3) == OP_SET_LOCAL && OPTIMIZER_ARG(3) == OPTIMIZER_ARG(0) &&
+                 OPTIMIZER_OP(4) == OP_POP)
+        {
+            optimizer_emit(optimized, chunk, window[2], OPTIMIZER_OP(2) == OP_ADD ? OP_INC_LOCAL : OP_DEC_LOCAL);
+            optimizer_emit(optimized, chunk, window[2], OPTIMIZER_ARG(0));
+            optimizer_emit(optimized, chunk, window[2], OPTIMIZER_ARG(1));
+            matched = 5;
+        }
+        // x + k: CONSTANT k, ADD
+        else if (n >= 2 && OPTIMIZER_OP(0) == OP_CONSTANT && IS_NUMBER(OPTIMIZER_CONSTANT(0)) &&
+                 optimizer_is_add_or_subtract(OPTIMIZER_OP(1)))
+        {
+            optimizer_emit(optimized, chunk, window[1], OPTIMIZER_OP(1) == OP_ADD ? OP_ADD_CONST : OP_SUBTRACT_CONST);
+            optimizer_emit(optimized, chunk, window[1], OPTIMIZER_ARG(0));
+            matched = 2;
+        }
+        // a value pushed only to be popped
+        else if (n >= 2 && OPTIMIZER_OP(1) == OP_POP &&
+                 (OPTIMIZER_OP(0) == OP_CONSTANT || OPTIMIZER_OP(0) == OP_CONSTANT_LONG ||
+                  OPTIMIZER_OP(0) == OP_GET_LOCAL || OPTIMIZER_OP(0) == OP_GET_LOCAL_LONG ||
+                  OPTIMIZER_OP(0) == OP_DUP))
+        {
+            matched = 2;
+        }
+
+        if (matched)
+        {
+            changed = true;
+            offset = window[matched - 1] + chunk_instruction_length(OPTIMIZER_OP(matched - 1));
+            continue;
+        }
+
+        byte instruction = array_at(chunk, offset);
+        if (chunk_is_jump(instruction))
+        {
+            JumpFixup fixup = {array_size(optimized), chunk_jump_target(chunk, offset)};
+            array_push(&fixups, fixup);
+        }
+        size_t length = chunk_instruction_length(instruction);
+        for (size_t i = 0; i < length; i++)
+            optimizer_emit(optimized, chunk, offset, array_at(chunk, offset + i));
+        offset += length;
+    }
+    map[count] = array_size(optimized);
+
+    for (size_t i = 0; i < array_size(&fixups); i++)
+    {
+        JumpFixup fixup = array_at(&fixups, i);
+        chunk_patch_jump(optimized, fixup.offset, map[fixup.target]);
+    }
+
+    array_free(&fixups);
+    free(map);
+    free(targets);
+    if (!changed)
+    {
+        chunk_free(optimized);
+        return NULL;
+    }
+    return optimized;
+}
+void optimizer_optimize(ObjFunction *function)
+{
+    // a rewrite can expose another pattern, e.g. a dead pair around a removed one
+    Chunk *optimized = NULL;
+    while ((optimized = optimizer_pass(function)) != NULL)
+    {
+        chunk_free(function->chunk);
+        function->chunk = optimized;
+    }
+}
+
+/* turns ast into a literal of the given type in place, keeping its token for positions */
+static AST *optimizer_literal(AST *ast, AST_Type type)
+{
+    ast->type = type;
+    ast->name = NULL;
+    ast->value = NULL;
+    ast->left = NULL;
+    ast->right = NULL;
+    return ast;
+}
+static AST *optimizer_number(AST *ast, double number)
+{
+    AST *literal = optimizer_literal(ast, AST_NUMBER);
+    literal->number = number;
+    return literal;
+}
+static AST *optimizer_bool(AST *ast, bool boolean)
+{
+    return optimizer_literal(ast, boolean ? AST_TRUE : AST_FALSE);
+}
+static bool optimizer_is_bool(AST *ast)
+{
+    return ast->type == AST_TRUE || ast->type == AST_FALSE;
+}
+/* a relational operator on two values of the same kind, follows VM_COMPARE */
+static bool optimizer_compare(TokenType type, double a, double b)
+{
+    switch (type)
+    {
+    case TOKEN_EQUALS:
+        return a == b;
+    case TOKEN_NOT_EQUALS:
+        return a != b;
+    case TOKEN_LT:
+        return a < b;
+    case TOKEN_LTE:
+        return a <= b;
+    case TOKEN_GT:
+        return a > b;
+    case TOKEN_GTE:
+        return a >= b;
+    default:
+        NOTREACHABLE;
+    }
+}
+static bool optimizer_is_comparison(TokenType type)
+{
+    return type == TOKEN_EQUALS || type == TOKEN_NOT_EQUALS ||
+           type == TOKEN_LT || type == TOKEN_LTE ||
+           type == TOKEN_GT || type == TOKEN_GTE;
+}
+/*
+ * anything that would fail at runtime, like "a" - 1 or a modulo by zero,
+ * is left alone so the VM still reports it where it happens. so is string
+ * concatenation, a literal is interned and its result is a new string.
+ */
+static AST *optimizer_fold_binary(AST *ast)
+{
+    AST *left = ast->left;
+    AST *right = ast->right;
+    TokenType type = ast->token.type;
+
+    if ((type == TOKEN_AND || type == TOKEN_OR) && ast_is_literal(left))
+    {
+        // a && b is a when a is falsey, a || b is a when a is truthy, b is
+        // only dropped when nothing in it needs compiling
+        bool truthy = ast_literal_truthy(left);
+        bool keep_left = type == TOKEN_AND ? !truthy : truthy;
+        if (!keep_left)
+            return right;
+        return ast_is_literal(right) ? left : ast;
+    }
+    if (type == TOKEN_ASSIGNMENT || !ast_is_literal(left) || !ast_is_literal(right))
+        return ast;
+
+    if (left->type == AST_NUMBER && right->type == AST_NUMBER)
+    {
+        double a = left->number;
+        double b = right->number;
+        if (optimizer_is_comparison(type))
+            return optimizer_bool(ast, optimizer_compare(type, a, b));
+        switch (type)
+        {
+        case TOKEN_PLUS:
+            return optimizer_number(ast, a + b);
+        case TOKEN_MINUS:
+            return optimizer_number(ast, a - b);
+        case TOKEN_MUL:
+            return optimizer_number(ast, a * b);
+        case TOKEN_DIV:
+            return optimizer_number(ast, a / b);
+        case TOKEN_MOD:
+            if ((int)b == 0)
+                return ast;
+            return optimizer_number(ast, (int)a % (int)b);
+        case TOKEN_BITWISE_AND:
+            return optimizer_number(ast, (int)a & (int)b);
+        case TOKEN_BITWISE_OR:
+            return optimizer_number(ast, (int)a | (int)b);
+        case TOKEN_LEFT_SHIFT:
+            return optimizer_number(ast, (int)a << (int)b);
+        case TOKEN_RIGHT_SHIFT:
+            return optimizer_number(ast, (int)a >> (int)b);
+        default:
+            return ast;
+        }
+    }
+    if (optimizer_is_bool(left) && optimizer_is_bool(right) && optimizer_is_comparison(type))
+        return optimizer_bool(ast, optimizer_compare(type, left->type == AST_TRUE, right->type == AST_TRUE));
+    return ast;
+}
+static AST *optimizer_fold_unary(AST *ast)
+{
+    AST *value = ast->value;
+    if (!ast_is_literal(value))
+        return ast;
+    switch (ast->token.type)
+    {
+    case TOKEN_MINUS:
+        if (value->type == AST_NUMBER)
+            return optimizer_number(ast, -value->number);
+        return ast;
+    case TOKEN_BITWISE_NOT:
+        if (value->type == AST_NUMBER)
+            return optimizer_number(ast, ~(int)value->number);
+        return ast;
+    case TOKEN_NOT:
+        return optimizer_bool(ast, !ast_literal_truthy(value));
+    default:
+        return ast;
+    }
+}
+AST *optimizer_fold(AST *ast)
+{
+    if (!ast)
+        return NULL;
+    ast->value = optimizer_fold(ast->value);
+    if (ast_has_childs(ast))
+        for (size_t i = 0; i < array_size(&ast->childs); i++)
+            array_at(&ast->childs, i) = optimizer_fold(array_at(&ast->childs, i));
+    else if (ast->type != AST_NUMBER)
+    {
+        ast->left = optimizer_fold(ast->left);
+        ast->right = optimizer_fold(ast->right);
+    }
+
+    switch (ast->type)
+    {
+    case AST_BINARY:
+        return optimizer_fold_binary(ast);
+    case AST_UNARY:
+        return optimizer_fold_unary(ast);
+    case AST_TERNARY:
+        // a branch is only dropped here when nothing in it needs compiling,
+        // otherwise ast_to_byte compiles it as dead code
+        if (ast_is_literal(ast->value))
+        {
+            bool truthy = ast_literal_truthy(ast->value);
+            if (ast_is_literal(truthy ? ast->right : ast->left))
+                return truthy ? ast->left : ast->right;
+        }
+        return ast;
+    default:
+        return ast;
+    }
+}
+
+#undef OPTIMIZER_OP
+#undef OPTIMIZER_ARG
+#undef OPTIMIZER_CONSTANT
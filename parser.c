@@ -15,7 +15,7 @@
 #define parser_token_location(token)                           \
     do                                                         \
     {                                                          \
-        fprintf(stderr, "%zu:%zu ", (token).row, (token).col); \
+        fprintf(stderr, "%zu:%zu ", (size_t)(token).row, (size_t)(token).col); \
     } while (0)
 #define parser_token_error(token, message) \
     do                                     \
@@ -47,6 +47,14 @@ char *parser_unexpected_token(Token token, char *message)
     return buffer;
 }
 
+/* names are copied into the arena next to the nodes that hold them */
+static char *parser_text(Parser *parser, Token token)
+{
+    if (token.type == TOKEN_EOF)
+        return arena_strndup(parser->arena, "end of file", 11);
+    return arena_strndup(parser->arena, token.start, token.length);
+}
+
 static ParseRule rules[] = {
     [TOKEN_LPAREN] = {parser_parse_group, parser_parse_call, PREC_POSTIFX},
     [TOKEN_RPAREN] = {NULL, NULL, PREC_NONE},
@@ -86,9 +94,10 @@ static ParseRule rules[] = {
     [TOKEN_LCURLY] = {NULL, NULL, PREC_NONE},
     [TOKEN_RCURLY] = {NULL, NULL, PREC_NONE},
 };
-Parser *init_parser(Lexer *lexer)
+Parser *init_parser(Lexer *lexer, Arena *arena)
 {
     Parser *parser = calloc(1, sizeof(Parser));
+    parser->arena = arena;
     parser->current_token = lexer_next_token(lexer);
     parser->had_error = false;
     parser->panic_mode = false;
@@ -181,18 +190,18 @@ void parser_error(Parser *parser, char *message)
 }
 AST *parser_parse_string(Parser *parser)
 {
-    AST *string = init_ast(AST_STRING);
-    string->token = parser->current_token;
-    string->name = token_text(parser->current_token);
+    AST *string = init_ast(parser->arena, AST_STRING);
+    ast_set_token(string, parser->current_token);
+    string->name = parser_text(parser, parser->current_token);
     parser_advance(parser);
     return string;
 }
 AST *parser_parse_id(Parser *parser)
 {
-    AST *id = init_ast(AST_ID);
-    id->name = token_text(parser->current_token);
+    AST *id = init_ast(parser->arena, AST_ID);
+    id->name = parser_text(parser, parser->current_token);
     Token token = parser_eat(parser, TOKEN_ID, "expected an identifier");
-    id->token = token;
+    ast_set_token(id, token);
     return id;
 }
 AST *parser_parse_primary(Parser *parser)
@@ -202,23 +211,23 @@ AST *parser_parse_primary(Parser *parser)
     case TOKEN_TRUE:
     {
 
-        AST *ast_true = init_ast(AST_TRUE);
-        ast_true->token = parser->current_token;
+        AST *ast_true = init_ast(parser->arena, AST_TRUE);
+        ast_set_token(ast_true, parser->current_token);
         parser_advance(parser);
         return ast_true;
     }
     case TOKEN_FALSE:
     {
-        AST *ast_false = init_ast(AST_FALSE);
-        ast_false->token = parser->current_token;
+        AST *ast_false = init_ast(parser->arena, AST_FALSE);
+        ast_set_token(ast_false, parser->current_token);
         parser_advance(parser);
         return ast_false;
     }
     case TOKEN_NULL:
     {
 
-        AST *ast_null = init_ast(AST_NULL);
-        ast_null->token = parser->current_token;
+        AST *ast_null = init_ast(parser->arena, AST_NULL);
+        ast_set_token(ast_null, parser->current_token);
         parser_advance(parser);
         return ast_null;
     }
@@ -258,8 +267,8 @@ AST *parser_parse_precedence(Parser *parser, Precedence precedence)
 }
 AST *parser_parse_number(Parser *parser)
 {
-    AST *number = init_ast(AST_NUMBER);
-    number->token = parser->current_token;
+    AST *number = init_ast(parser->arena, AST_NUMBER);
+    ast_set_token(number, parser->current_token);
     char buffer[parser->current_token.length + 1];
     sprintf(buffer, "%.*s", (int)parser->current_token.length, parser->current_token.start);
     parser_advance(parser);
@@ -284,9 +293,10 @@ AST *parser_parse_call(Parser *parser, AST *callee)
 {
     if (callee->type != AST_ID)
     {
-        parser_token_error(callee->token, parser_unexpected_token(callee->token, "callee should be a identifier."));
+        parser_token_error(callee->token, parser_unexpected_token(ast_token(callee), "callee should be a identifier."));
     }
-    AST *call = init_ast(AST_FUNCTION_CALL);
+    AST *call = init_ast(parser->arena, AST_FUNCTION_CALL);
+    call->token = callee->token;
     call->left = callee;
     parser->parsing_call = 1;
     call->value = parser_parse_group(parser);
@@ -295,9 +305,9 @@ AST *parser_parse_call(Parser *parser, AST *callee)
 }
 AST *parser_parse_prefix(Parser *parser)
 {
-    AST *unary = init_ast(AST_UNARY);
-    unary->token = parser->current_token;
-    unary->name = token_text(parser->current_token);
+    AST *unary = init_ast(parser->arena, AST_UNARY);
+    ast_set_token(unary, parser->current_token);
+    unary->name = parser_text(parser, parser->current_token);
     Token token = parser->current_token;
     parser_advance(parser);
     AST *operand = parser_parse_precedence(parser, PREC_UNARY);
@@ -312,8 +322,8 @@ AST *parser_parse_prefix(Parser *parser)
 }
 AST *parser_parse_comma(Parser *parser, AST *prefix)
 {
-    AST *exprs = init_ast(AST_SEQUENCEEXPR);
-    ast_push(exprs, prefix);
+    AST *exprs = init_ast(parser->arena, AST_SEQUENCEEXPR);
+    ast_push(parser->arena, exprs, prefix);
     while (parser->current_token.type == TOKEN_COMMA)
     {
         Precedence precedence = parser_production(parser->current_token.type)->precedence;
@@ -324,14 +334,14 @@ AST *parser_parse_comma(Parser *parser, AST *prefix)
             parser->panic_mode = 1;
             return NULL;
         }
-        ast_push(exprs, child);
+        ast_push(parser->arena, exprs, child);
     }
     return exprs;
 }
 AST *parser_parse_infix(Parser *parser, AST *prefix)
 {
-    AST *bin = init_ast(AST_BINARY);
-    bin->token = parser->current_token;
+    AST *bin = init_ast(parser->arena, AST_BINARY);
+    ast_set_token(bin, parser->current_token);
     Token token = parser->current_token;
     parser_advance(parser);
     if (token.type == TOKEN_ASSIGNMENT && prefix && prefix->type != AST_ID && prefix->token.type != TOKEN_ASSIGNMENT)
@@ -339,7 +349,7 @@ AST *parser_parse_infix(Parser *parser, AST *prefix)
         parser_token_error(prefix->token, "lvalue cannot be a constant.");
     }
 
-    bin->name = token_text(token);
+    bin->name = parser_text(parser, token);
     ParseRule *rule = parser_production(token.type);
     Precedence precedence = token.type == TOKEN_ASSIGNMENT ? PREC_ASSIGNMENT : rule->precedence + 1;
     AST *right = parser_parse_precedence(parser, precedence);
@@ -353,9 +363,9 @@ AST *parser_parse_infix(Parser *parser, AST *prefix)
 }
 AST *parser_parse_ternary(Parser *parser, AST *condition)
 {
-    AST *ternary = init_ast(AST_TERNARY);
-    ternary->token = parser->current_token;
-    ternary->name = token_text(parser->current_token);
+    AST *ternary = init_ast(parser->arena, AST_TERNARY);
+    ast_set_token(ternary, parser->current_token);
+    ternary->name = parser_text(parser, parser->current_token);
     ternary->value = condition;
     parser_advance(parser);
     AST *then = parser_parse_expr(parser);
@@ -364,7 +374,7 @@ AST *parser_parse_ternary(Parser *parser, AST *condition)
         parser_error(parser, "expect ':' after expr.");
         return NULL;
     }
-    then->token = parser->current_token;
+    ast_set_token(then, parser->current_token);
     parser_advance(parser);
     AST *_else = parser_parse_expr(parser);
     ternary->left = then;
@@ -381,9 +391,9 @@ AST *parser_parse_postfix(Parser *parser, AST *oprand)
         parser_token_error(oprand->token, str);
         free(str);
     }
-    AST *postfix = init_ast(AST_POSTFIX);
-    postfix->token = parser->current_token;
-    postfix->name = token_text(parser->current_token);
+    AST *postfix = init_ast(parser->arena, AST_POSTFIX);
+    ast_set_token(postfix, parser->current_token);
+    postfix->name = parser_text(parser, parser->current_token);
     postfix->value = oprand;
     parser_eat(parser, parser->current_token.type, "expected posfix something");
     return postfix;
@@ -399,9 +409,9 @@ AST *parser_parse_expr(Parser *parser)
 }
 AST *parser_parse_print(Parser *parser)
 {
-    AST *print = init_ast(AST_STMT);
-    print->token = parser->current_token;
-    print->name = token_text(parser->current_token);
+    AST *print = init_ast(parser->arena, AST_STMT);
+    ast_set_token(print, parser->current_token);
+    print->name = parser_text(parser, parser->current_token);
     parser_advance(parser);
     print->value = parser_parse_expr(parser);
     if (print->value == NULL)
@@ -410,11 +420,11 @@ AST *parser_parse_print(Parser *parser)
 }
 AST *parser_parse_var(Parser *parser)
 {
-    AST *var = init_ast(AST_VAR);
+    AST *var = init_ast(parser->arena, AST_VAR);
     parser_advance(parser);
     Token identifier = parser_eat(parser, TOKEN_ID, "expected identifier name.");
-    var->name = token_text(identifier);
-    var->token = identifier;
+    var->name = parser_text(parser, identifier);
+    ast_set_token(var, identifier);
     if (parser->current_token.type == TOKEN_ASSIGNMENT)
     {
         parser_advance(parser);
@@ -422,7 +432,7 @@ AST *parser_parse_var(Parser *parser)
     }
     else
     {
-        var->value = init_ast(AST_NULL);
+        var->value = init_ast(parser->arena, AST_NULL);
         var->value->token = var->token;
     }
     if (parser->had_error)
@@ -433,7 +443,7 @@ AST *parser_parse_var(Parser *parser)
 AST *parser_parse_if(Parser *parser)
 {
     parser_advance(parser);
-    AST *_if = init_ast(AST_IF);
+    AST *_if = init_ast(parser->arena, AST_IF);
     _if->value = parser_parse_group(parser);
 
     if (parser->current_token.type == TOKEN_SEMICOLON)
@@ -453,8 +463,8 @@ AST *parser_parse_if(Parser *parser)
 AST *parser_parse_while(Parser *parser)
 {
     parser->is_looping++;
-    AST *loop = init_ast(AST_WHILE);
-    loop->token = parser->current_token;
+    AST *loop = init_ast(parser->arena, AST_WHILE);
+    ast_set_token(loop, parser->current_token);
     parser_advance(parser);
     loop->value = parser_parse_group(parser);
     loop->left = parser_parse_stmt(parser);
@@ -464,8 +474,8 @@ AST *parser_parse_while(Parser *parser)
 AST *parser_parse_for(Parser *parser)
 {
     parser->is_looping = true;
-    AST *loop = init_ast(AST_FOR_LOOP);
-    loop->token = parser->current_token;
+    AST *loop = init_ast(parser->arena, AST_FOR_LOOP);
+    ast_set_token(loop, parser->current_token);
     parser_advance(parser);
     parser_eat(parser, TOKEN_LPAREN, "expected '(' after for.");
     AST *init = NULL;
@@ -474,29 +484,32 @@ AST *parser_parse_for(Parser *parser)
     else if (parser->current_token.type != TOKEN_SEMICOLON)
         init = parser_parse_expr(parser);
 
-    ast_push(loop, init);
+    ast_push(parser->arena, loop, init);
     parser_eat(parser, TOKEN_SEMICOLON, "expected an ';' after initializer.");
 
+    // a missing clause still takes its slot, the compiler reads them by position
+    AST *condition = NULL;
     if (parser->current_token.type == TOKEN_SEMICOLON)
     {
         parser_advance(parser);
     }
     else
     {
-        AST *condition = parser_parse_expr(parser);
-        ast_push(loop, condition);
+        condition = parser_parse_expr(parser);
         parser_eat(parser, TOKEN_SEMICOLON, "expected an ';' after expression");
     }
+    ast_push(parser->arena, loop, condition);
+    AST *end_expr = NULL;
     if (parser->current_token.type == TOKEN_SEMICOLON || parser->current_token.type == TOKEN_RPAREN)
     {
         parser_advance(parser);
     }
     else
     {
-        AST *end_expr = parser_parse_expr(parser);
-        ast_push(loop, end_expr);
+        end_expr = parser_parse_expr(parser);
         parser_eat(parser, TOKEN_RPAREN, "expected ')'");
     }
+    ast_push(parser->arena, loop, end_expr);
     loop->value = parser_parse_stmt(parser);
     parser->is_looping = false;
     return loop;
@@ -509,24 +522,24 @@ AST *parser_parse_block(Parser *parser)
         parser_advance(parser);
         return NULL;
     }
-    AST *block = init_ast(AST_BLOCK);
-    block->token = lcurly;
+    AST *block = init_ast(parser->arena, AST_BLOCK);
+    ast_set_token(block, lcurly);
     while (parser->current_token.type != TOKEN_EOF && parser->current_token.type != TOKEN_RCURLY)
     {
         AST *child = parser_parse_decl(parser);
-        ast_push(block, child);
+        ast_push(parser->arena, block, child);
     }
     parser_eat(parser, TOKEN_RCURLY, "expected '}'");
     return block;
 }
 AST *parser_parse_return(Parser *parser)
 {
-    AST *ret = init_ast(AST_STMT);
-    ret->token = parser_eat(parser, TOKEN_RETURN, "expeted 'return' keyword.");
+    AST *ret = init_ast(parser->arena, AST_STMT);
+    ast_set_token(ret, parser_eat(parser, TOKEN_RETURN, "expeted 'return' keyword."));
     ret->value = parser_parse_expr(parser);
     if (ret->value == NULL)
     {
-        ret->value = init_ast(AST_NULL);
+        ret->value = init_ast(parser->arena, AST_NULL);
         ret->value->token = ret->token;
     }
     parser_eat(parser, TOKEN_SEMICOLON, "expected semicolon after return statement");
@@ -572,8 +585,8 @@ AST *parser_parse_stmt(Parser *parser)
         {
             parser_error(parser, "'break' or 'continue' statement used outside of a loop.");
         }
-        stmt = init_ast(AST_STMT);
-        stmt->token = parser->current_token;
+        stmt = init_ast(parser->arena, AST_STMT);
+        ast_set_token(stmt, parser->current_token);
         parser_advance(parser);
         break;
     }
@@ -587,21 +600,21 @@ AST *parser_parse_stmt(Parser *parser)
 AST *parser_parse_function(Parser *parser)
 {
     parser_advance(parser);
-    AST *function = init_ast(AST_FUNCTION_DECL);
+    AST *function = init_ast(parser->arena, AST_FUNCTION_DECL);
     Token function_name = parser_eat(parser, TOKEN_ID, "expected function name.");
-    function->token = function_name;
+    ast_set_token(function, function_name);
     parser_eat(parser, TOKEN_LPAREN, "expected '(' after function name.");
     while (parser->current_token.type != TOKEN_RPAREN)
     {
-        AST *var = init_ast(AST_VAR);
-        var->name = token_text(parser->current_token);
+        AST *var = init_ast(parser->arena, AST_VAR);
+        var->name = parser_text(parser, parser->current_token);
         Token token = parser_eat(parser, TOKEN_ID, "expected an identifier");
-        var->token = token;
+        ast_set_token(var, token);
         if (parser->current_token.type == TOKEN_COMMA)
         {
             parser_advance(parser);
         }
-        ast_push(function, var);
+        ast_push(parser->arena, function, var);
     }
     parser_eat(parser, TOKEN_RPAREN, "expected ')' after function agruments.");
     function->value = parser_parse_block(parser);
@@ -626,12 +639,12 @@ AST *parser_parse_decl(Parser *parser)
 }
 AST *parser_parse_compound(Parser *parser)
 {
-    AST *compound = init_ast(AST_COMPOUND);
+    AST *compound = init_ast(parser->arena, AST_COMPOUND);
     while (parser->current_token.type != TOKEN_EOF)
     {
         AST *child = parser_parse_decl(parser);
         if (child)
-            ast_push(compound, child);
+            ast_push(parser->arena, compound, child);
     }
     return compound;
 }
@@ -0,0 +1,143 @@
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+struct Page
+{
+    Page *prev; /* in its class's list of pages with free slots, or the cache */
+    Page *next;
+    void *free; /* slots handed out and freed again */
+    char *bump; /* slots never handed out yet */
+    size_t slot_size;
+    size_t live;
+    bool listed;
+};
+
+#define POOL_PAGE_OF(pointer) ((Page *)((uintptr_t)(pointer) & ~(uintptr_t)(POOL_PAGE_SIZE - 1)))
+#define POOL_PAGE_START(page) ((char *)(page) + ((sizeof(Page) + POOL_GRANULE - 1) & ~(size_t)(POOL_GRANULE - 1)))
+#define POOL_PAGE_END(page) ((char *)(page) + POOL_PAGE_SIZE)
+
+static Page *pool_page_new(Pool *pool, size_t slot_size)
+{
+    Page *page = pool->cached;
+    if (page != NULL)
+    {
+        pool->cached = page->next;
+        pool->cached_count--;
+    }
+    else
+    {
+#ifdef _WIN32
+        page = _aligned_malloc(POOL_PAGE_SIZE, POOL_PAGE_SIZE);
+#else
+        page = aligned_alloc(POOL_PAGE_SIZE, POOL_PAGE_SIZE);
+#endif
+        assert(page != NULL && "cannot allocate memory");
+    }
+    page->prev = page->next = NULL;
+    page->free = NULL;
+    page->bump = POOL_PAGE_START(page);
+    page->slot_size = slot_size;
+    page->live = 0;
+    page->listed = false;
+    return page;
+}
+static void pool_page_release(Page *page)
+{
+#ifdef _WIN32
+    _aligned_free(page);
+#else
+    free(page);
+#endif
+}
+static void pool_link(Page **list, Page *page)
+{
+    page->prev = NULL;
+    page->next = *list;
+    if (*list != NULL)
+        (*list)->prev = page;
+    *list = page;
+    page->listed = true;
+}
+static void pool_unlink(Page **list, Page *page)
+{
+    if (page->prev != NULL)
+        page->prev->next = page->next;
+    else
+        *list = page->next;
+    if (page->next != NULL)
+        page->next->prev = page->prev;
+    page->prev = page->next = NULL;
+    page->listed = false;
+}
+static bool pool_page_full(Page *page)
+{
+    return page->free == NULL && page->bump + page->slot_size > POOL_PAGE_END(page);
+}
+void *pool_allocate(Pool *pool, size_t size)
+{
+    if (size == 0 || size > POOL_SMALL_MAX)
+        return calloc(1, size);
+    size_t size_class = (size - 1) / POOL_GRANULE;
+    Page *page = pool->available[size_class];
+    if (page == NULL)
+    {
+        page = pool_page_new(pool, (size_class + 1) * POOL_GRANULE);
+        pool_link(&pool->available[size_class], page);
+    }
+    void *slot = page->free;
+    if (slot != NULL)
+        page->free = *(void **)slot;
+    else
+    {
+        slot = page->bump;
+        page->bump += page->slot_size;
+    }
+    page->live++;
+    if (pool_page_full(page))
+        pool_unlink(&pool->available[size_class], page);
+    return memset(slot, 0, page->slot_size);
+}
+void pool_free(Pool *pool, void *pointer, size_t size)
+{
+    if (pointer == NULL)
+        return;
+    if (size == 0 || size > POOL_SMALL_MAX)
+    {
+        free(pointer);
+        return;
+    }
+    Page *page = POOL_PAGE_OF(pointer);
+    Page **list = &pool->available[page->slot_size / POOL_GRANULE - 1];
+    *(void **)pointer = page->free;
+    page->free = pointer;
+    page->live--;
+    if (page->live == 0)
+    {
+        // an empty page is no longer tied to its size class
+        if (page->listed)
+            pool_unlink(list, page);
+        if (pool->cached_count < POOL_CACHED_PAGES)
+        {
+            pool_link(&pool->cached, page);
+            pool->cached_count++;
+        }
+        else
+            pool_page_release(page);
+    }
+    else if (!page->listed)
+        pool_link(list, page);
+}
+void pool_release(Pool *pool)
+{
+    while (pool->cached != NULL)
+    {
+        Page *next = pool->cached->next;
+        pool_page_release(pool->cached);
+        pool->cached = next;
+    }
+    pool->cached_count = 0;
+}
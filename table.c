@@ -55,7 +55,7 @@ bool table_remove(Table *table, ObjString *key)
     if (entry->key == NULL)
         return false;
     entry->key = NULL;
-    entry->value = BOOL_VAL(true, 0, 0);
+    entry->value = BOOL_VAL(true);
     return true;
 }
 bool table_get(Table *table, ObjString *key, Value *value)
@@ -74,18 +74,19 @@ bool table_set(Table *table, ObjString *key, Value value)
 {
     if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
     {
-        table->capacity = table->capacity == 0 ? 256 : table->capacity * 2;
+        size_t previous_capacity = table->capacity;
+        table->capacity = table->capacity == 0 ? TABLE_INITIAL_CAPACITY : table->capacity * 2;
         Entry *previous_items = table->items;
         Entry *current_items = calloc(table->capacity, sizeof(*table->items));
         assert(current_items != NULL && "failed to allocate hash table");
         for (size_t i = 0; i < table->capacity; i++)
         {
             current_items[i].key = NULL;
-            current_items[i].value = NULL_VAL(0, 0);
+            current_items[i].value = NULL_VAL;
         }
         // re-hashing 
         table->count = 0;
-        for (size_t i = 0; i < table->capacity && table->items != NULL; i++)
+        for (size_t i = 0; i < previous_capacity && table->items != NULL; i++)
         {
             Entry *entry = &array_at(table, i);
             if (entry->key == NULL)
@@ -12,10 +12,10 @@ Values *init_values()
     return values;
 }
 
-byte value_push(Values *values, Value data)
+size_t value_push(Values *values, Value data)
 {
     array_push(values, data);
-    return (byte)(array_size(values) - 1);
+    return array_size(values) - 1;
 }
 Value value_pop(Values *values)
 {
@@ -28,7 +28,7 @@ void values_dump(Values *values, FILE *stream)
     {
         fprintf(stream, "#%04zu  ", i);
         Value data = array_at(values, i);
-        switch (data.type)
+        switch (VALUE_TYPE(data))
         {
         case VAL_NUMBER:
             fprintf(stream, "%g\n", AS_NUMBER(data));
@@ -66,28 +66,28 @@ void values_free(Values *values)
     free(values);
 }
 
-void value_print(Value value, uint8_t new_ln)
+void value_print(Value value, uint8_t new_ln, FILE *stream)
 {
-    switch (value.type)
+    switch (VALUE_TYPE(value))
     {
     case VAL_BOOL:
-        fprintf(stdout, AS_BOOL(value) ? "true" : "false");
+        fprintf(stream, AS_BOOL(value) ? "true" : "false");
         break;
     case VAL_NULL:
-        fprintf(stdout, "null");
+        fprintf(stream, "null");
         break;
     case VAL_NUMBER:
-        fprintf(stdout, "%g", AS_NUMBER(value));
+        fprintf(stream, "%g", AS_NUMBER(value));
         break;
     case VAL_UNDEF:
-        fprintf(stdout, "undefined");
+        fprintf(stream, "undefined");
         break;
     case VAL_OBJ:
-        object_print(value);
+        object_print(value, stream);
         break;
     default:
         NOTREACHABLE;
     }
     if (new_ln)
-        fprintf(stdout, "\n");
+        fprintf(stream, "\n");
 }